@@ -0,0 +1,90 @@
+#include "CameraPathFile.h"
+#include "ViewBookmarks.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const quint32 magic = 0x4F544350; // "OTCP"
+const quint16 version = 1;
+
+/// About a day of keys at 60 per second
+const quint32 maxKeys = 6000000;
+
+/// Keys reserved up front; the header size is only trusted as far as the
+/// file turns out to hold that many keys
+const quint32 reserveKeys = 4096;
+
+bool fail(QString *error, const QString &text)
+{
+    qWarning("%s", qPrintable(text));
+    if (error)
+        *error = text;
+    return false;
+}
+
+}
+
+bool CameraPathFile::save(const QString &fileName, const ViewingCore::CameraPath &path,
+                          QString *error)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return fail(error, QString("Could not write camera path to %1").arg(fileName));
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << magic << version << quint32(path.size());
+    for (unsigned i=0 ; i < path.size() ; i++)
+        stream << path[i].time << path[i].state;
+
+    if (stream.status() != QDataStream::Ok || !file.commit())
+        return fail(error, QString("Could not write camera path to %1").arg(fileName));
+    return true;
+}
+
+bool CameraPathFile::load(const QString &fileName, ViewingCore::CameraPath &path,
+                          QString *error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return fail(error, QString("Could not read camera path from %1").arg(fileName));
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 fileMagic = 0, size = 0;
+    quint16 fileVersion = 0;
+    stream >> fileMagic >> fileVersion >> size;
+    if (stream.status() != QDataStream::Ok || fileMagic != magic ||
+            fileVersion != version || size > maxKeys)
+        return fail(error, QString("%1 is not a camera path this version can read")
+                    .arg(fileName));
+
+    ViewingCore::CameraPath keys;
+    keys.reserve(std::min(size, reserveKeys));
+    for (quint32 i=0 ; i < size ; i++) {
+        if (stream.atEnd())
+            return fail(error, QString("%1 ends after %2 of %3 keys")
+                        .arg(fileName).arg(i).arg(size));
+
+        ViewingCore::PathKey key;
+        stream >> key.time >> key.state;
+
+        // times may repeat but never go back
+        if (stream.status() != QDataStream::Ok || !std::isfinite(key.time) ||
+                (i > 0 && key.time < keys.back().time) ||
+                !ViewBookmarks::isValid(key.state))
+            return fail(error, QString("%1 is damaged at key %2").arg(fileName).arg(i));
+
+        keys.push_back(key);
+    }
+
+    path.swap(keys);
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef CAMERAPATHFILE_H
+#define CAMERAPATHFILE_H
+
+#include <QString>
+
+#include "ViewingCore.h"
+
+/// Camera paths recorded by an Osg3dView, kept in a binary file so a
+/// navigation session can be played back against other models or builds.
+/// Like ViewBookmarks the file is versioned and checked when read.
+namespace CameraPathFile
+{
+    /// On failure error, when given, says why for the user
+    bool save(const QString &fileName, const ViewingCore::CameraPath &path,
+              QString *error = 0);
+
+    /// Leaves path alone when the file cannot be used
+    bool load(const QString &fileName, ViewingCore::CameraPath &path,
+              QString *error = 0);
+}
+
+#endif // CAMERAPATHFILE_H
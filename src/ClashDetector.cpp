@@ -0,0 +1,302 @@
+#include "ClashDetector.h"
+#include "SpatialIndex.h"
+#include "TriangleTree.h"
+
+#include <QHash>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <osg/Geode>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+
+static bool debugClash = false;
+#define clashDebug if (debugClash) qDebug
+
+namespace {
+
+/// The triangles of one part, in world coordinates
+struct Mesh {
+    osg::ref_ptr<osg::Geode> geode;
+    osg::Matrixd matrix;
+    TriangleTree tree;
+};
+
+void buildMesh(Mesh &mesh)
+{
+    if (mesh.geode.valid())
+        mesh.tree.build(*mesh.geode, mesh.matrix);
+}
+
+/// Some pair of nodes of two parts' hierarchies, to be descended together
+struct PairTask {
+    const Mesh *a;
+    const Mesh *b;
+    unsigned nodeA;
+    unsigned nodeB;
+    unsigned candidate;     ///< which pair of parts this is part of
+    double tolerance;
+
+    unsigned triangles;
+    osg::BoundingBoxd box;
+    unsigned long long tests;
+};
+
+/// Split a task in two by descending into the larger of its nodes.
+/// Returns false for a pair of leaves, which cannot be split.
+bool splitTask(const PairTask &task, PairTask &first, PairTask &second)
+{
+    const TriangleTree::Node &a = task.a->tree.getNodes()[task.nodeA];
+    const TriangleTree::Node &b = task.b->tree.getNodes()[task.nodeB];
+    const bool leafA = task.a->tree.isLeaf(task.nodeA);
+    const bool leafB = task.b->tree.isLeaf(task.nodeB);
+    if (leafA && leafB)
+        return false;
+
+    first = second = task;
+    if (leafB || (!leafA && a.box.radius2() >= b.box.radius2())) {
+        first.nodeA = task.nodeA + 1;
+        second.nodeA = a.right;
+    } else {
+        first.nodeB = task.nodeB + 1;
+        second.nodeB = b.right;
+    }
+    return true;
+}
+
+bool overlaps(const osg::BoundingBoxd &a, const osg::BoundingBoxd &b)
+{
+    return a.intersects(b);
+}
+
+void runPairTask(PairTask &task)
+{
+    task.triangles = 0;
+    task.tests = 0;
+    task.box.init();
+
+    std::vector< std::pair<unsigned, unsigned> > pending;
+    pending.push_back(std::make_pair(task.nodeA, task.nodeB));
+
+    while (!pending.empty()) {
+        const unsigned nodeA = pending.back().first;
+        const unsigned nodeB = pending.back().second;
+        pending.pop_back();
+
+        const TriangleTree::Node &a = task.a->tree.getNodes()[nodeA];
+        const TriangleTree::Node &b = task.b->tree.getNodes()[nodeB];
+        if (!overlaps(a.box, b.box))
+            continue;
+
+        const bool leafA = task.a->tree.isLeaf(nodeA);
+        const bool leafB = task.b->tree.isLeaf(nodeB);
+        if (leafA && leafB) {
+            for (unsigned i = a.first ; i < a.first + a.count ; i++) {
+                const TriangleTree::Triangle &ta = task.a->tree.getTriangles()[i];
+                for (unsigned j = b.first ; j < b.first + b.count ; j++) {
+                    const TriangleTree::Triangle &tb = task.b->tree.getTriangles()[j];
+                    if (!overlaps(ta.box, tb.box))
+                        continue;
+
+                    task.tests++;
+                    if (ClashDetector::trianglesIntersect(ta.v, tb.v, task.tolerance)) {
+                        task.triangles++;
+                        osg::BoundingBoxd both = ta.box.intersect(tb.box);
+                        task.box.expandBy(both);
+                    }
+                }
+            }
+        } else if (leafB || (!leafA && a.box.radius2() >= b.box.radius2())) {
+            pending.push_back(std::make_pair(nodeA + 1, nodeB));
+            pending.push_back(std::make_pair(a.right, nodeB));
+        } else {
+            pending.push_back(std::make_pair(nodeA, nodeB + 1));
+            pending.push_back(std::make_pair(nodeA, b.right));
+        }
+    }
+}
+
+void project(const osg::Vec3d v[3], const osg::Vec3d &axis, double &low, double &high)
+{
+    low = high = v[0] * axis;
+    for (int i=1 ; i < 3 ; i++) {
+        const double d = v[i] * axis;
+        low = std::min(low, d);
+        high = std::max(high, d);
+    }
+}
+
+/// How far v reaches through the plane of the triangle with normal and
+/// first vertex p: the lesser of how far it goes to either side
+double depthThrough(const osg::Vec3d v[3], const osg::Vec3d &normal, const osg::Vec3d &p)
+{
+    double above = 0.0, below = 0.0;
+    for (int i=0 ; i < 3 ; i++) {
+        const double d = (v[i] - p) * normal;
+        above = std::max(above, d);
+        below = std::max(below, -d);
+    }
+    return std::min(above, below);
+}
+
+}
+
+ClashDetector::ClashDetector()
+    : m_tolerance(0.0)
+    , m_numCandidates(0)
+    , m_numTriangleTests(0)
+{
+}
+
+bool ClashDetector::trianglesIntersect(const osg::Vec3d a[3],
+                                       const osg::Vec3d b[3],
+                                       double tolerance)
+{
+    const osg::Vec3d edgesA[3] = { a[1] - a[0], a[2] - a[1], a[0] - a[2] };
+    const osg::Vec3d edgesB[3] = { b[1] - b[0], b[2] - b[1], b[0] - b[2] };
+
+    osg::Vec3d axes[11];
+    axes[0] = edgesA[0] ^ edgesA[1];
+    axes[1] = edgesB[0] ^ edgesB[1];
+    for (int i=0 ; i < 3 ; i++) {
+        for (int j=0 ; j < 3 ; j++)
+            axes[2 + i*3 + j] = edgesA[i] ^ edgesB[j];
+    }
+
+    // Slivers have no face to go into
+    if (axes[0].length2() == 0.0 || axes[1].length2() == 0.0)
+        return false;
+
+    // Separated along any axis means they do not meet.  Projected on its
+    // own face normal a triangle is a single point, so a pair that crosses
+    // overlaps by exactly nothing there; only a gap separates.  Parallel
+    // edges give no axis.
+    for (int i=0 ; i < 11 ; i++) {
+        const double length = axes[i].length();
+        if (length < 1e-12)
+            continue;
+
+        const osg::Vec3d axis = axes[i] / length;
+        double lowA, highA, lowB, highB;
+        project(a, axis, lowA, highA);
+        project(b, axis, lowB, highB);
+        if (std::min(highA, highB) - std::max(lowA, lowB) < 0.0)
+            return false;
+    }
+
+    // They meet.  Touching ones, and faces in one plane, reach no depth
+    // through each other; a crossing reaches as far as the shallower of
+    // the two goes through the other's plane.
+    const double depth = std::min(depthThrough(a, axes[1] / axes[1].length(), b[0]),
+                                  depthThrough(b, axes[0] / axes[0].length(), a[0]));
+    return depth > tolerance;
+}
+
+void ClashDetector::detect(const SpatialIndex &index,
+                           const std::vector<unsigned> &a,
+                           const std::vector<unsigned> &b)
+{
+    m_clashes.clear();
+    m_numCandidates = 0;
+    m_numTriangleTests = 0;
+
+    // Broad phase: parts of b whose boxes overlap a part of a
+    const std::set<unsigned> inB(b.begin(), b.end());
+    std::set< std::pair<unsigned, unsigned> > seen;
+    std::vector< std::pair<unsigned, unsigned> > candidates;
+    for (unsigned i=0 ; i < a.size() ; i++) {
+        const std::vector<unsigned> near = index.findWithin(index.getPart(a[i]).box, 0.0);
+        for (unsigned n=0 ; n < near.size() ; n++) {
+            if (near[n] == a[i] || !inB.count(near[n]))
+                continue;
+
+            // a part in both sets would come up once from each side
+            std::pair<unsigned, unsigned> key(std::min(a[i], near[n]), std::max(a[i], near[n]));
+            if (seen.insert(key).second)
+                candidates.push_back(std::make_pair(a[i], near[n]));
+        }
+    }
+    m_numCandidates = candidates.size();
+    if (candidates.empty())
+        return;
+
+    // Triangle hierarchies for every part in any pair, in parallel
+    QHash<unsigned, unsigned> meshOf;
+    std::vector<Mesh> meshes;
+    for (unsigned c=0 ; c < candidates.size() ; c++) {
+        const unsigned parts[2] = { candidates[c].first, candidates[c].second };
+        for (int p=0 ; p < 2 ; p++) {
+            if (meshOf.contains(parts[p]))
+                continue;
+            meshOf.insert(parts[p], meshes.size());
+
+            Mesh mesh;
+            mesh.geode = dynamic_cast<osg::Geode *>(index.getPart(parts[p]).path.back().get());
+            mesh.matrix = index.getPartMatrix(parts[p]);
+            meshes.push_back(mesh);
+        }
+    }
+    QtConcurrent::blockingMap(meshes, buildMesh);
+
+    // Split the descents until there is plenty to share between threads
+    const unsigned enough = 64 * QThread::idealThreadCount();
+    std::deque<PairTask> splitting;
+    for (unsigned c=0 ; c < candidates.size() ; c++) {
+        PairTask task;
+        task.a = &meshes[meshOf.value(candidates[c].first)];
+        task.b = &meshes[meshOf.value(candidates[c].second)];
+        if (task.a->tree.empty() || task.b->tree.empty())
+            continue;
+        task.nodeA = 0;
+        task.nodeB = 0;
+        task.candidate = c;
+        task.tolerance = m_tolerance;
+        splitting.push_back(task);
+    }
+
+    std::vector<PairTask> tasks;
+    while (!splitting.empty() && splitting.size() + tasks.size() < enough) {
+        PairTask task = splitting.front();
+        splitting.pop_front();
+
+        PairTask first, second;
+        if (!overlaps(task.a->tree.getNodes()[task.nodeA].box,
+                      task.b->tree.getNodes()[task.nodeB].box))
+            continue;
+        if (!splitTask(task, first, second)) {
+            tasks.push_back(task);
+            continue;
+        }
+        splitting.push_back(first);
+        splitting.push_back(second);
+    }
+    tasks.insert(tasks.end(), splitting.begin(), splitting.end());
+
+    QtConcurrent::blockingMap(tasks, runPairTask);
+
+    // Gather the tasks back into their pairs of parts
+    std::vector<Clash> clashes(candidates.size());
+    std::vector<osg::BoundingBoxd> boxes(candidates.size());
+    for (unsigned c=0 ; c < candidates.size() ; c++) {
+        clashes[c].partA = candidates[c].first;
+        clashes[c].partB = candidates[c].second;
+        clashes[c].triangles = 0;
+    }
+    for (unsigned t=0 ; t < tasks.size() ; t++) {
+        clashes[tasks[t].candidate].triangles += tasks[t].triangles;
+        boxes[tasks[t].candidate].expandBy(tasks[t].box);
+        m_numTriangleTests += tasks[t].tests;
+    }
+    for (unsigned c=0 ; c < clashes.size() ; c++) {
+        if (clashes[c].triangles == 0)
+            continue;
+        clashes[c].box = osg::BoundingBox(boxes[c]._min, boxes[c]._max);
+        m_clashes.push_back(clashes[c]);
+    }
+
+    clashDebug("%u candidates, %u meshes, %u tasks, %llu triangle tests, %u clashes",
+               m_numCandidates, (unsigned)meshes.size(), (unsigned)tasks.size(),
+               m_numTriangleTests, (unsigned)m_clashes.size());
+}
@@ -0,0 +1,64 @@
+#ifndef CLASHDETECTOR_H
+#define CLASHDETECTOR_H
+
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Vec3d>
+
+class SpatialIndex;
+
+/// Finds the parts of one set that interfere with parts of another.
+///
+/// The broad phase pairs up parts whose boxes overlap, using the spatial
+/// index.  For the narrow phase every part involved gets a hierarchy over
+/// its triangles (in world coordinates, built in parallel), and each pair
+/// of hierarchies is descended together.  The upper levels of all the
+/// descents are split into tasks first, so one huge pair of parts keeps
+/// every core as busy as many small ones do.
+class ClashDetector
+{
+public:
+    ClashDetector();
+
+    /// Triangles that reach less than tolerance into each other only
+    /// touch, as faces of parts that are mated do, and are not a clash.
+    void setTolerance(double tolerance) { m_tolerance = tolerance; }
+    double getTolerance() const { return m_tolerance; }
+
+    struct Clash {
+        unsigned partA;         ///< part numbers in the SpatialIndex
+        unsigned partB;
+        unsigned triangles;     ///< intersecting triangle pairs
+        osg::BoundingBox box;   ///< around the intersections
+    };
+
+    /// Check every part in a against every part in b (part numbers in
+    /// index).  A part in both sets is not checked against itself.
+    void detect(const SpatialIndex &index,
+                const std::vector<unsigned> &a,
+                const std::vector<unsigned> &b);
+
+    const std::vector<Clash> &getClashes() const { return m_clashes; }
+
+    /// Pairs of parts whose boxes overlapped
+    unsigned getNumCandidates() const { return m_numCandidates; }
+
+    /// Triangle pairs that had to be tested exactly
+    unsigned long long getNumTriangleTests() const { return m_numTriangleTests; }
+
+    /// Whether two triangles reach more than tolerance into each other.
+    /// The separating axis test finds whether they meet at all, then the
+    /// depth is how far the shallower one goes through the other's plane.
+    static bool trianglesIntersect(const osg::Vec3d a[3],
+                                   const osg::Vec3d b[3],
+                                   double tolerance);
+
+private:
+    double m_tolerance;
+    std::vector<Clash> m_clashes;
+    unsigned m_numCandidates;
+    unsigned long long m_numTriangleTests;
+};
+
+#endif // CLASHDETECTOR_H
@@ -0,0 +1,95 @@
+#include "ClashForm.h"
+#include "ui_ClashForm.h"
+
+#include <QHeaderView>
+
+ClashForm::ClashForm(QWidget *parent) :
+    QWidget(parent),
+    ui(new Ui::ClashForm),
+    m_model(0)
+{
+    ui->setupUi(this);
+    ui->clashTree->header()->setStretchLastSection(false);
+    ui->clashTree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    ui->clashTree->header()->setSectionResizeMode(1, QHeaderView::Stretch);
+    ui->clashTree->header()->setSectionResizeMode(2, QHeaderView::ResizeToContents);
+
+    connect(ui->clashTree, SIGNAL(itemClicked(QTreeWidgetItem*,int)),
+            this, SLOT(itemClicked(QTreeWidgetItem*)));
+}
+
+ClashForm::~ClashForm()
+{
+    delete ui;
+}
+
+void ClashForm::setModel(OsgItemModel *model)
+{
+    m_model = model;
+    connect(model, SIGNAL(clashesChanged()),
+            this, SLOT(clashesChanged()));
+    clashesChanged();
+}
+
+void ClashForm::clashesChanged()
+{
+    ui->clashTree->clear();
+    if (!m_model) {
+        ui->summaryLabel->clear();
+        return;
+    }
+
+    const QList<OsgItemModel::Clash> &clashes = m_model->getClashes();
+    unsigned triangles = 0;
+    for (int i=0 ; i < clashes.size() ; i++) {
+        const OsgItemModel::Clash &clash = clashes[i];
+
+        QTreeWidgetItem *item = new QTreeWidgetItem(ui->clashTree);
+        item->setText(0, partName(clash.partA));
+        item->setText(1, partName(clash.partB));
+        item->setText(2, QString::number(clash.triangles));
+        item->setData(0, Qt::UserRole, i);
+        triangles += clash.triangles;
+    }
+
+    ui->summaryLabel->setText(clashes.isEmpty() ?
+                                  QString("No clashes") :
+                                  QString("%1 clashes, %2 triangle pairs")
+                                  .arg(clashes.size()).arg(triangles));
+    ui->clearButton->setEnabled(!clashes.isEmpty());
+}
+
+void ClashForm::itemClicked(QTreeWidgetItem *item)
+{
+    if (!m_model)
+        return;
+
+    const int i = item->data(0, Qt::UserRole).toInt();
+    const QList<OsgItemModel::Clash> &clashes = m_model->getClashes();
+    if (i < 0 || i >= clashes.size())
+        return;
+
+    // the intersection itself is often tiny, show it with its parts around
+    osg::BoundingBox box = clashes[i].box;
+    const osg::Vec3 margin(box.radius(), box.radius(), box.radius());
+    box.expandBy(box._min - margin);
+    box.expandBy(box._max + margin);
+    emit fitRequested(box);
+}
+
+void ClashForm::on_clearButton_clicked()
+{
+    if (m_model)
+        m_model->clearClashes();
+}
+
+QString ClashForm::partName(const SpatialIndex::RefNodePath &path) const
+{
+    // the nearest named node above the geode says the most about it
+    for (size_t i = path.size() ; i > 0 ; i--) {
+        const std::string &name = path[i-1]->getName();
+        if (!name.empty())
+            return QString::fromStdString(name);
+    }
+    return path.empty() ? QString() : QString(path.back()->className());
+}
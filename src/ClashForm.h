@@ -0,0 +1,41 @@
+#ifndef CLASHFORM_H
+#define CLASHFORM_H
+
+#include <QWidget>
+
+#include "OsgItemModel.h"
+
+class QTreeWidgetItem;
+
+namespace Ui {
+class ClashForm;
+}
+
+/// Lists the clashes OsgItemModel::checkClashes() found
+class ClashForm : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ClashForm(QWidget *parent = 0);
+    ~ClashForm();
+
+    void setModel(OsgItemModel *model);
+
+signals:
+    /// A clash was picked from the list, see OsgTreeView::fitRequested()
+    void fitRequested(osg::BoundingBox box);
+
+private slots:
+    void clashesChanged();
+    void itemClicked(QTreeWidgetItem *item);
+    void on_clearButton_clicked();
+
+private:
+    QString partName(const SpatialIndex::RefNodePath &path) const;
+
+    Ui::ClashForm *ui;
+    OsgItemModel *m_model;
+};
+
+#endif // CLASHFORM_H
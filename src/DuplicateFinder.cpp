@@ -0,0 +1,325 @@
+#include "DuplicateFinder.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osg/StateSet>
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+static bool debugDuplicates = false;
+#define dupDebug if (debugDuplicates) qDebug
+
+namespace {
+
+const unsigned long long prime1 = 0x9E3779B185EBCA87ULL;
+const unsigned long long prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+inline unsigned long long mix(unsigned long long h, unsigned long long v)
+{
+    h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    return h;
+}
+
+class GeometryCollector : public osg::NodeVisitor
+{
+public:
+    GeometryCollector()
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Geode &geode) {
+        for (unsigned i=0 ; i < geode.getNumDrawables() ; i++) {
+            osg::Geometry *geometry = geode.getDrawable(i)->asGeometry();
+            if (geometry && m_seen.insert(geometry).second)
+                geometries.push_back(geometry);
+        }
+    }
+
+    std::vector< osg::ref_ptr<osg::Geometry> > geometries;
+
+private:
+    std::set<osg::Geometry *> m_seen;
+};
+
+std::vector<const osg::Array *> arraysOf(const osg::Geometry *geometry)
+{
+    std::vector<const osg::Array *> arrays;
+    arrays.push_back(geometry->getVertexArray());
+    arrays.push_back(geometry->getNormalArray());
+    arrays.push_back(geometry->getColorArray());
+    arrays.push_back(geometry->getSecondaryColorArray());
+    arrays.push_back(geometry->getFogCoordArray());
+    for (unsigned i=0 ; i < geometry->getNumTexCoordArrays() ; i++)
+        arrays.push_back(geometry->getTexCoordArray(i));
+    for (unsigned i=0 ; i < geometry->getNumVertexAttribArrays() ; i++)
+        arrays.push_back(geometry->getVertexAttribArray(i));
+    return arrays;
+}
+
+unsigned long long hashArray(const osg::Array *array, unsigned long long h)
+{
+    if (!array)
+        return mix(h, 0);
+
+    h = mix(h, array->getType());
+    h = mix(h, array->getBinding());
+    h = mix(h, array->getNumElements());
+    return DuplicateFinder::hashBytes(array->getDataPointer(),
+                                      array->getTotalDataSize(), h);
+}
+
+unsigned long long hashPrimitiveSet(const osg::PrimitiveSet *primitiveSet,
+                                    unsigned long long h)
+{
+    h = mix(h, primitiveSet->getType());
+    h = mix(h, primitiveSet->getMode());
+    h = mix(h, primitiveSet->getNumIndices());
+    h = mix(h, primitiveSet->getNumInstances());
+    if (primitiveSet->getNumIndices() > 0)
+        h = mix(h, primitiveSet->index(0));
+    return DuplicateFinder::hashBytes(primitiveSet->getDataPointer(),
+                                      primitiveSet->getTotalDataSize(), h);
+}
+
+/// Hash only the structure of the StateSet; attributes that are separate
+/// objects with equal contents must still land in the same bucket.
+unsigned long long hashStateSet(const osg::StateSet *stateSet, unsigned long long h)
+{
+    if (!stateSet)
+        return mix(h, 0);
+
+    h = mix(h, stateSet->getRenderingHint());
+    h = mix(h, stateSet->getBinNumber());
+
+    const osg::StateSet::ModeList &modes = stateSet->getModeList();
+    for (osg::StateSet::ModeList::const_iterator i = modes.begin() ; i != modes.end() ; ++i)
+        h = mix(mix(h, i->first), i->second);
+
+    const osg::StateSet::AttributeList &attributes = stateSet->getAttributeList();
+    for (osg::StateSet::AttributeList::const_iterator i = attributes.begin() ; i != attributes.end() ; ++i)
+        h = mix(mix(mix(h, i->first.first), i->first.second), i->second.second);
+
+    const osg::StateSet::TextureModeList &textureModes = stateSet->getTextureModeList();
+    for (unsigned unit=0 ; unit < textureModes.size() ; unit++) {
+        for (osg::StateSet::ModeList::const_iterator i = textureModes[unit].begin() ;
+             i != textureModes[unit].end() ; ++i)
+            h = mix(mix(mix(h, unit), i->first), i->second);
+    }
+
+    const osg::StateSet::TextureAttributeList &textureAttributes = stateSet->getTextureAttributeList();
+    for (unsigned unit=0 ; unit < textureAttributes.size() ; unit++) {
+        for (osg::StateSet::AttributeList::const_iterator i = textureAttributes[unit].begin() ;
+             i != textureAttributes[unit].end() ; ++i)
+            h = mix(mix(mix(h, unit), i->first.first), i->second.second);
+    }
+
+    return h;
+}
+
+unsigned long long geometryBytes(const osg::Geometry *geometry)
+{
+    unsigned long long bytes = 0;
+
+    std::vector<const osg::Array *> arrays = arraysOf(geometry);
+    for (unsigned i=0 ; i < arrays.size() ; i++) {
+        if (arrays[i])
+            bytes += arrays[i]->getTotalDataSize();
+    }
+
+    for (unsigned i=0 ; i < geometry->getNumPrimitiveSets() ; i++)
+        bytes += geometry->getPrimitiveSet(i)->getTotalDataSize();
+
+    return bytes;
+}
+
+bool sameArray(const osg::Array *a, const osg::Array *b)
+{
+    if (a == b)
+        return true;
+    if (!a || !b)
+        return false;
+
+    return a->getType() == b->getType() &&
+            a->getBinding() == b->getBinding() &&
+            a->getNumElements() == b->getNumElements() &&
+            a->getTotalDataSize() == b->getTotalDataSize() &&
+            memcmp(a->getDataPointer(), b->getDataPointer(), a->getTotalDataSize()) == 0;
+}
+
+bool samePrimitiveSet(const osg::PrimitiveSet *a, const osg::PrimitiveSet *b)
+{
+    if (a == b)
+        return true;
+
+    if (a->getType() != b->getType() ||
+            a->getMode() != b->getMode() ||
+            a->getNumIndices() != b->getNumIndices() ||
+            a->getNumInstances() != b->getNumInstances() ||
+            a->getTotalDataSize() != b->getTotalDataSize())
+        return false;
+
+    if (a->getNumIndices() > 0 && a->index(0) != b->index(0))
+        return false;
+
+    if (a->getDataPointer() && b->getDataPointer())
+        return memcmp(a->getDataPointer(), b->getDataPointer(), a->getTotalDataSize()) == 0;
+
+    return a->getDataPointer() == b->getDataPointer();
+}
+
+bool sameGeometry(const osg::Geometry *a, const osg::Geometry *b)
+{
+    const osg::StateSet *sa = a->getStateSet();
+    const osg::StateSet *sb = b->getStateSet();
+    if (sa != sb && (!sa || !sb || sa->compare(*sb, true) != 0))
+        return false;
+
+    std::vector<const osg::Array *> arraysA = arraysOf(a);
+    std::vector<const osg::Array *> arraysB = arraysOf(b);
+    if (arraysA.size() != arraysB.size())
+        return false;
+    for (unsigned i=0 ; i < arraysA.size() ; i++) {
+        if (!sameArray(arraysA[i], arraysB[i]))
+            return false;
+    }
+
+    if (a->getNumPrimitiveSets() != b->getNumPrimitiveSets())
+        return false;
+    for (unsigned i=0 ; i < a->getNumPrimitiveSets() ; i++) {
+        if (!samePrimitiveSet(a->getPrimitiveSet(i), b->getPrimitiveSet(i)))
+            return false;
+    }
+
+    return true;
+}
+
+struct Entry {
+    osg::ref_ptr<osg::Geometry> geometry;
+    unsigned long long hash;
+    unsigned long long bytes;
+    unsigned order;
+};
+
+void hashEntry(Entry &entry)
+{
+    const osg::Geometry *geometry = entry.geometry.get();
+
+    unsigned long long h = hashStateSet(geometry->getStateSet(), prime1);
+
+    std::vector<const osg::Array *> arrays = arraysOf(geometry);
+    for (unsigned i=0 ; i < arrays.size() ; i++)
+        h = hashArray(arrays[i], h);
+
+    for (unsigned i=0 ; i < geometry->getNumPrimitiveSets() ; i++)
+        h = hashPrimitiveSet(geometry->getPrimitiveSet(i), h);
+
+    entry.hash = h;
+    entry.bytes = geometryBytes(geometry);
+}
+
+bool byHash(const Entry &a, const Entry &b)
+{
+    if (a.hash != b.hash)
+        return a.hash < b.hash;
+    return a.order < b.order;
+}
+
+}
+
+DuplicateFinder::DuplicateFinder()
+    : m_numGeometries(0)
+    , m_savings(0)
+{
+}
+
+unsigned long long DuplicateFinder::hashBytes(const void *data, size_t size,
+                                              unsigned long long seed)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    if (!bytes)
+        size = 0;
+
+    unsigned long long lanes[4] = {
+        seed + prime1 + prime2, seed + prime2, seed, seed - prime1
+    };
+
+    // Consume 32 byte blocks as four 64 bit words.  The lanes do not depend
+    // on each other, which is what lets this run in vector registers.
+    const size_t blocks = size / 32;
+    for (size_t b=0 ; b < blocks ; b++) {
+        unsigned long long words[4];
+        memcpy(words, bytes + b * 32, sizeof(words));
+        for (int l=0 ; l < 4 ; l++) {
+            lanes[l] += words[l] * prime2;
+            lanes[l] = (lanes[l] << 31) | (lanes[l] >> 33);
+            lanes[l] *= prime1;
+        }
+    }
+
+    unsigned long long h = size;
+    for (int l=0 ; l < 4 ; l++)
+        h = mix(h, lanes[l]);
+
+    for (size_t i = blocks * 32 ; i < size ; i++)
+        h = (h ^ bytes[i]) * 0x100000001B3ULL;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void DuplicateFinder::analyze(osg::Node *subtree)
+{
+    m_numGeometries = 0;
+    m_savings = 0;
+    m_replacements.clear();
+
+    if (!subtree)
+        return;
+
+    GeometryCollector collector;
+    subtree->accept(collector);
+
+    std::vector<Entry> entries(collector.geometries.size());
+    for (unsigned i=0 ; i < entries.size() ; i++) {
+        entries[i].geometry = collector.geometries[i];
+        entries[i].order = i;
+    }
+    m_numGeometries = entries.size();
+
+    QtConcurrent::blockingMap(entries, hashEntry);
+
+    std::sort(entries.begin(), entries.end(), byHash);
+
+    // Within a run of equal hashes, the first geometry that is not a copy
+    // of an earlier one becomes the shared instance.
+    unsigned runStart = 0;
+    while (runStart < entries.size()) {
+        unsigned runEnd = runStart + 1;
+        while (runEnd < entries.size() && entries[runEnd].hash == entries[runStart].hash)
+            runEnd++;
+
+        std::vector<unsigned> canonicals;
+        for (unsigned i = runStart ; i < runEnd ; i++) {
+            bool found = false;
+            for (unsigned c=0 ; c < canonicals.size() && !found ; c++) {
+                const Entry &canonical = entries[canonicals[c]];
+                if (sameGeometry(entries[i].geometry.get(), canonical.geometry.get())) {
+                    m_replacements.push_back(Replacement(entries[i].geometry, canonical.geometry));
+                    m_savings += entries[i].bytes;
+                    found = true;
+                }
+            }
+            if (!found)
+                canonicals.push_back(i);
+        }
+        runStart = runEnd;
+    }
+
+    dupDebug("%u geometries, %u duplicates, %llu bytes",
+             m_numGeometries, (unsigned)m_replacements.size(), m_savings);
+}
@@ -0,0 +1,51 @@
+#ifndef DUPLICATEFINDER_H
+#define DUPLICATEFINDER_H
+
+#include <vector>
+#include <utility>
+
+#include <osg/ref_ptr>
+#include <osg/Node>
+#include <osg/Geometry>
+
+/// Finds Geometry that is identical in content but stored as separate
+/// copies, typically the same part instanced many times by a CAD exporter.
+///
+/// Every Geometry in a subtree is hashed (arrays, primitive sets and
+/// StateSet) in parallel.  Geometry with equal hashes is then compared in
+/// full, so a replacement is only ever suggested for true duplicates.
+class DuplicateFinder
+{
+public:
+    DuplicateFinder();
+
+    /// Hash and group every Geometry beneath (and including) subtree
+    void analyze(osg::Node *subtree);
+
+    /// Number of distinct Geometry objects examined
+    unsigned getNumGeometries() const { return m_numGeometries; }
+
+    /// Number of Geometry objects that duplicate another
+    unsigned getNumDuplicates() const { return m_replacements.size(); }
+
+    /// Bytes of array and primitive data freed by sharing the duplicates
+    unsigned long long getPotentialSavings() const { return m_savings; }
+
+    typedef std::pair< osg::ref_ptr<osg::Geometry>,
+                       osg::ref_ptr<osg::Geometry> > Replacement;
+
+    /// (duplicate, geometry to use instead) for every duplicate found
+    const std::vector<Replacement> &getReplacements() const { return m_replacements; }
+
+    /// Hash of a block of memory, four independent lanes wide so the
+    /// compiler can vectorize it.
+    static unsigned long long hashBytes(const void *data, size_t size,
+                                        unsigned long long seed);
+
+private:
+    unsigned m_numGeometries;
+    unsigned long long m_savings;
+    std::vector<Replacement> m_replacements;
+};
+
+#endif // DUPLICATEFINDER_H
@@ -0,0 +1,193 @@
+#include "LodGenerator.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osg/TriangleFunctor>
+#include <osgUtil/Simplifier>
+
+#include <cfloat>
+#include <cmath>
+#include <set>
+
+static bool debugLod = false;
+#define lodDebug if (debugLod) qDebug
+
+namespace {
+
+/// Count triangles as the TriangleFunctor decomposes the primitive sets
+struct TriangleCount {
+    TriangleCount() : count(0) {}
+    void operator()(const osg::Vec3 &, const osg::Vec3 &, const osg::Vec3 &) { ++count; }
+    void operator()(const osg::Vec3 &, const osg::Vec3 &, const osg::Vec3 &, bool) { ++count; }
+    unsigned count;
+};
+
+unsigned countTriangles(osg::Geode *geode)
+{
+    osg::TriangleFunctor<TriangleCount> counter;
+    for (unsigned i=0 ; i < geode->getNumDrawables() ; i++)
+        geode->getDrawable(i)->accept(counter);
+    return counter.count;
+}
+
+unsigned countVertices(osg::Geode *geode)
+{
+    unsigned vertices = 0;
+    for (unsigned i=0 ; i < geode->getNumDrawables() ; i++) {
+        osg::Geometry *geometry = geode->getDrawable(i)->asGeometry();
+        if (geometry && geometry->getVertexArray())
+            vertices += geometry->getVertexArray()->getNumElements();
+    }
+    return vertices;
+}
+
+/// Gather the geodes that are worth decimating.  Existing LODs are not
+/// entered since they already provide their own levels.
+class HeavyGeodeCollector : public osg::NodeVisitor
+{
+public:
+    HeavyGeodeCollector(unsigned minimumVertexCount)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+        , m_minimumVertexCount(minimumVertexCount) {}
+
+    void apply(osg::LOD &) {}
+
+    void apply(osg::Geode &geode) {
+        if (m_seen.count(&geode))
+            return;
+        m_seen.insert(&geode);
+
+        if (countVertices(&geode) >= m_minimumVertexCount)
+            geodes.push_back(&geode);
+    }
+
+    std::vector<osg::ref_ptr<osg::Geode> > geodes;
+
+private:
+    unsigned m_minimumVertexCount;
+    std::set<osg::Geode *> m_seen;
+};
+
+/// One geometry to be simplified to one level
+struct DecimationJob {
+    osg::ref_ptr<osg::Geometry> geometry;
+    double ratio;
+};
+
+void decimate(DecimationJob &job)
+{
+    osgUtil::Simplifier simplifier(job.ratio);
+    simplifier.simplify(*job.geometry);
+}
+
+}
+
+LodGenerator::LodGenerator()
+    : m_minimumVertexCount(10000)
+    , m_pixelTolerance(1.0)
+{
+    m_sampleRatios.push_back(0.5);
+    m_sampleRatios.push_back(0.2);
+    m_sampleRatios.push_back(0.05);
+}
+
+double LodGenerator::pixelSizeForTriangles(const osg::BoundingSphere &bs,
+                                           unsigned triangles) const
+{
+    if (triangles == 0 || bs.radius() <= 0.0)
+        return 0.0;
+
+    // Spread the triangles evenly over the surface of the bounding sphere
+    // to get a typical edge length, which we take as the geometric error.
+    const double r = bs.radius();
+    const double area = 4.0 * osg::PI * r * r;
+    const double edge = sqrt(4.0 * area / (sqrt(3.0) * triangles));
+
+    // The pixel size of the bound is roughly its diameter on screen, so an
+    // edge covers edge/(2r) of it.  Solve for the pixel size at which the
+    // edge reaches the tolerance.
+    return m_pixelTolerance * 2.0 * r / edge;
+}
+
+std::vector<LodGenerator::Replacement> LodGenerator::generate(osg::Node *subtree) const
+{
+    std::vector<Replacement> replacements;
+    if (!subtree || m_sampleRatios.empty())
+        return replacements;
+
+    HeavyGeodeCollector collector(m_minimumVertexCount);
+    subtree->accept(collector);
+
+    // Create the (still full resolution) copies for every level up front so
+    // that all meshes of all levels can be decimated in one parallel pass.
+    std::vector<DecimationJob> jobs;
+    std::vector< std::vector<osg::ref_ptr<osg::Geode> > > levels(collector.geodes.size());
+
+    for (unsigned g=0 ; g < collector.geodes.size() ; g++) {
+        osg::Geode *geode = collector.geodes[g].get();
+
+        for (unsigned l=0 ; l < m_sampleRatios.size() ; l++) {
+            osg::ref_ptr<osg::Geode> level = new osg::Geode;
+            level->setName(geode->getName() + "_L" + std::to_string(l+1));
+            level->setStateSet(geode->getStateSet());
+
+            for (unsigned d=0 ; d < geode->getNumDrawables() ; d++) {
+                osg::Drawable *drawable = geode->getDrawable(d);
+                osg::Geometry *geometry = drawable->asGeometry();
+                if (!geometry) {
+                    level->addDrawable(drawable);
+                    continue;
+                }
+
+                DecimationJob job;
+                job.geometry = new osg::Geometry(*geometry,
+                                                 osg::CopyOp::DEEP_COPY_ARRAYS |
+                                                 osg::CopyOp::DEEP_COPY_PRIMITIVES);
+                job.ratio = m_sampleRatios[l];
+                level->addDrawable(job.geometry.get());
+                jobs.push_back(job);
+            }
+            levels[g].push_back(level);
+        }
+    }
+
+    lodDebug("decimating %d geometries for %d geodes",
+             (int)jobs.size(), (int)collector.geodes.size());
+
+    QtConcurrent::blockingMap(jobs, decimate);
+
+    for (unsigned g=0 ; g < collector.geodes.size() ; g++) {
+        osg::Geode *geode = collector.geodes[g].get();
+        const osg::BoundingSphere bs = geode->getBound();
+
+        Replacement replacement;
+        replacement.geode = geode;
+        replacement.lod = new osg::LOD;
+        replacement.lod->setName(geode->getName() + "_LOD");
+        replacement.lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+
+        // Each level is good enough up to the pixel size where its error
+        // reaches the tolerance; the next finer level takes over from there.
+        float maxPixels = FLT_MAX;
+        osg::Geode *current = geode;
+        for (unsigned l=0 ; l <= levels[g].size() ; l++) {
+            float minPixels = 0.0f;
+            if (l < levels[g].size())
+                minPixels = pixelSizeForTriangles(bs, countTriangles(levels[g][l].get()));
+
+            replacement.lod->addChild(current, minPixels, maxPixels);
+            lodDebug("%s level %d [%g %g)", current->getName().c_str(), l, minPixels, maxPixels);
+
+            if (l < levels[g].size()) {
+                maxPixels = minPixels;
+                current = levels[g][l].get();
+            }
+        }
+
+        replacements.push_back(replacement);
+    }
+
+    return replacements;
+}
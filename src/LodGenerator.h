@@ -0,0 +1,54 @@
+#ifndef LODGENERATOR_H
+#define LODGENERATOR_H
+
+#include <vector>
+
+#include <osg/ref_ptr>
+#include <osg/Node>
+#include <osg/Geode>
+#include <osg/LOD>
+
+/// Builds osg::LOD nodes with decimated levels for heavy Geodes.
+///
+/// Every Geode in a subtree with more than the minimum number of vertices
+/// gets an LOD whose first child is the original Geode and whose remaining
+/// children hold simplified copies of its Geometry.  The decimation of all
+/// meshes and levels is run concurrently.  Ranges are in pixels on screen
+/// and are chosen so the estimated geometric error of each level, relative
+/// to the bounding sphere, stays below a pixel tolerance.
+class LodGenerator
+{
+public:
+    LodGenerator();
+
+    struct Replacement {
+        osg::ref_ptr<osg::Geode> geode; ///< the original heavy geode
+        osg::ref_ptr<osg::LOD> lod;     ///< LOD that should take its place
+    };
+
+    /// Sample ratios of the decimated levels, most detailed first.
+    void setSampleRatios(const std::vector<double> &ratios) { m_sampleRatios = ratios; }
+    const std::vector<double> &getSampleRatios() const { return m_sampleRatios; }
+
+    /// Geodes with fewer vertices than this are left alone
+    void setMinimumVertexCount(unsigned count) { m_minimumVertexCount = count; }
+    unsigned getMinimumVertexCount() const { return m_minimumVertexCount; }
+
+    /// Largest error (in pixels) tolerated before a finer level is selected
+    void setPixelTolerance(double pixels) { m_pixelTolerance = pixels; }
+    double getPixelTolerance() const { return m_pixelTolerance; }
+
+    /// Build LODs for every heavy geode beneath (and including) subtree.
+    /// The scene graph is not modified; the caller swaps the nodes.
+    std::vector<Replacement> generate(osg::Node *subtree) const;
+
+private:
+    double pixelSizeForTriangles(const osg::BoundingSphere &bs,
+                                 unsigned triangles) const;
+
+    std::vector<double> m_sampleRatios;
+    unsigned m_minimumVertexCount;
+    double m_pixelTolerance;
+};
+
+#endif // LODGENERATOR_H
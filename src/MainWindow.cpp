@@ -13,9 +13,30 @@ MainWindow::MainWindow(QWidget *parent) :
 
     ui->osgTreeForm->setModel(&m_itemModel);
     ui->osg3dView->setScene(&m_itemModel);
+    ui->clashForm->setModel(&m_itemModel);
 
     connect(ui->osg3dView, SIGNAL(updated()),
             ui->osgCameraView, SLOT(updateFromCamera()));
+    connect(ui->osgTreeForm, SIGNAL(fitRequested(osg::BoundingBox)),
+            ui->osg3dView, SLOT(fitToBound(osg::BoundingBox)));
+    connect(ui->osgTreeForm, SIGNAL(sectionRequested(osg::BoundingBox)),
+            ui->osg3dView, SLOT(setClipBox(osg::BoundingBox)));
+    connect(ui->clashForm, SIGNAL(fitRequested(osg::BoundingBox)),
+            ui->osg3dView, SLOT(fitToBound(osg::BoundingBox)));
+    connect(&m_itemModel, SIGNAL(clashesChanged()),
+            this, SLOT(clashesChanged()));
+    connect(ui->osg3dView, SIGNAL(measured(QString)),
+            ui->statusBar, SLOT(showMessage(QString)));
+    connect(ui->osg3dView, SIGNAL(message(QString)),
+            ui->statusBar, SLOT(showMessage(QString)));
+
+    // history is bounded by what it keeps alive, not by how many steps
+    QSettings settings;
+    unsigned undoLimit = settings.value("undoMemoryLimitMB", 256).toUInt();
+    m_itemModel.getUndoStack()->setMemoryLimit((size_t)undoLimit * 1024 * 1024);
+
+    connect(m_itemModel.getUndoStack(), SIGNAL(changed()),
+            this, SLOT(undoStackChanged()));
 }
 
 MainWindow::~MainWindow()
@@ -38,6 +59,7 @@ void MainWindow::on_actionFileOpen_triggered()
 
     m_itemModel.importFileByName(fileName);
     settings.setValue("recentFile", fileName);
+    ui->osg3dView->setBookmarkFile(ViewBookmarks::sidecarFor(fileName));
 }
 
 void MainWindow::on_actionFileSave_triggered()
@@ -67,3 +89,33 @@ void MainWindow::on_actionFileSaveAs_triggered()
         qDebug("no");
 
 }
+
+void MainWindow::on_actionEditUndo_triggered()
+{
+    m_itemModel.getUndoStack()->undo();
+}
+
+void MainWindow::on_actionEditRedo_triggered()
+{
+    m_itemModel.getUndoStack()->redo();
+}
+
+void MainWindow::undoStackChanged()
+{
+    UndoStack *stack = m_itemModel.getUndoStack();
+
+    ui->actionEditUndo->setEnabled(stack->canUndo());
+    ui->actionEditUndo->setText(stack->canUndo() ?
+                                    QString("Undo %1").arg(stack->undoText()) :
+                                    QString("Undo"));
+    ui->actionEditRedo->setEnabled(stack->canRedo());
+    ui->actionEditRedo->setText(stack->canRedo() ?
+                                    QString("Redo %1").arg(stack->redoText()) :
+                                    QString("Redo"));
+}
+
+void MainWindow::clashesChanged()
+{
+    if (!m_itemModel.getClashes().isEmpty())
+        ui->tabWidget->setCurrentWidget(ui->clashTab);
+}
@@ -20,6 +20,10 @@ public slots:
     void on_actionFileOpen_triggered();
     void on_actionFileSave_triggered();
     void on_actionFileSaveAs_triggered();
+    void on_actionEditUndo_triggered();
+    void on_actionEditRedo_triggered();
+    void undoStackChanged();
+    void clashesChanged();
 
 private:
     Ui::MainWindow *ui;
@@ -0,0 +1,149 @@
+#include "MemoryAccounting.h"
+
+#include <osg/Image>
+#include <osg/Texture>
+#include <osg/Uniform>
+
+MemoryAccountingVisitor::MemoryAccountingVisitor()
+    : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN)
+{
+    // hidden nodes take memory too
+    setNodeMaskOverride(0xffffffff);
+}
+
+QString MemoryAccountingVisitor::formatBytes(unsigned long long bytes)
+{
+    if (bytes >= 1024ULL * 1024 * 1024)
+        return QString::asprintf("%.1f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+    if (bytes >= 1024ULL * 1024)
+        return QString::asprintf("%.1f MB", bytes / (1024.0 * 1024.0));
+    if (bytes >= 1024ULL)
+        return QString::asprintf("%.1f KB", bytes / 1024.0);
+    return QString::asprintf("%llu B", bytes);
+}
+
+bool MemoryAccountingVisitor::firstVisit(const osg::Referenced *object)
+{
+    return object && m_seen.insert(object).second;
+}
+
+void MemoryAccountingVisitor::accountArray(const osg::Array *array, MemoryUsage &usage)
+{
+    if (!firstVisit(array))
+        return;
+
+    usage.arrays += sizeof(osg::Array) + array->getTotalDataSize();
+}
+
+void MemoryAccountingVisitor::accountStateSet(const osg::StateSet *stateSet, MemoryUsage &usage)
+{
+    if (!firstVisit(stateSet))
+        return;
+
+    usage.stateSets += sizeof(osg::StateSet);
+    usage.stateSets += stateSet->getModeList().size() * 2 * sizeof(int);
+    usage.stateSets += stateSet->getUniformList().size() * sizeof(osg::Uniform);
+
+    const osg::StateSet::AttributeList &attributes = stateSet->getAttributeList();
+    for (osg::StateSet::AttributeList::const_iterator i = attributes.begin() ;
+         i != attributes.end() ; ++i) {
+        if (firstVisit(i->second.first.get()))
+            usage.stateSets += sizeof(osg::StateAttribute);
+    }
+
+    const osg::StateSet::TextureAttributeList &textureAttributes = stateSet->getTextureAttributeList();
+    for (unsigned unit=0 ; unit < textureAttributes.size() ; unit++) {
+        for (osg::StateSet::AttributeList::const_iterator i = textureAttributes[unit].begin() ;
+             i != textureAttributes[unit].end() ; ++i) {
+            const osg::StateAttribute *attribute = i->second.first.get();
+            if (!firstVisit(attribute))
+                continue;
+
+            usage.stateSets += sizeof(osg::StateAttribute);
+
+            const osg::Texture *texture = dynamic_cast<const osg::Texture *>(attribute);
+            if (!texture)
+                continue;
+
+            for (unsigned n=0 ; n < texture->getNumImages() ; n++) {
+                const osg::Image *image = texture->getImage(n);
+                if (firstVisit(image))
+                    usage.images += sizeof(osg::Image) +
+                            image->getTotalSizeInBytesIncludingMipmaps();
+            }
+        }
+    }
+}
+
+void MemoryAccountingVisitor::accountNode(const osg::Node &node, MemoryUsage &usage)
+{
+    usage.nodes += sizeof(osg::Node);
+
+    if (const osg::Group *group = node.asGroup())
+        usage.nodes += group->getNumChildren() * sizeof(osg::ref_ptr<osg::Node>);
+
+    accountStateSet(node.getStateSet(), usage);
+}
+
+void MemoryAccountingVisitor::accountDrawable(osg::Drawable *drawable, MemoryUsage &usage)
+{
+    MemoryUsage drawableUsage;
+
+    if (firstVisit(drawable)) {
+        drawableUsage.nodes += sizeof(osg::Geometry);
+        accountStateSet(drawable->getStateSet(), drawableUsage);
+
+        if (osg::Geometry *geometry = drawable->asGeometry()) {
+            osg::Geometry::ArrayList arrays;
+            geometry->getArrayList(arrays);
+            for (unsigned i=0 ; i < arrays.size() ; i++)
+                accountArray(arrays[i].get(), drawableUsage);
+
+            for (unsigned i=0 ; i < geometry->getNumPrimitiveSets() ; i++) {
+                const osg::PrimitiveSet *primitiveSet = geometry->getPrimitiveSet(i);
+                if (firstVisit(primitiveSet))
+                    drawableUsage.primitives += sizeof(osg::PrimitiveSet) +
+                            primitiveSet->getTotalDataSize();
+            }
+        }
+        m_report.insert(drawable, drawableUsage);
+    }
+
+    usage += drawableUsage;
+}
+
+void MemoryAccountingVisitor::apply(osg::Node &node)
+{
+    // A shared node was charged to the subtree that reached it first
+    if (!firstVisit(&node))
+        return;
+
+    m_stack.push_back(MemoryUsage());
+    accountNode(node, m_stack.back());
+
+    traverse(node);
+
+    MemoryUsage usage = m_stack.back();
+    m_stack.pop_back();
+
+    m_report.insert(&node, usage);
+    if (!m_stack.empty())
+        m_stack.back() += usage;
+}
+
+void MemoryAccountingVisitor::apply(osg::Geode &geode)
+{
+    if (!firstVisit(&geode))
+        return;
+
+    // drawables are handled here rather than traversed so this works the
+    // same whether or not Drawable is a Node
+    MemoryUsage usage;
+    accountNode(geode, usage);
+    for (unsigned i=0 ; i < geode.getNumDrawables() ; i++)
+        accountDrawable(geode.getDrawable(i), usage);
+
+    m_report.insert(&geode, usage);
+    if (!m_stack.empty())
+        m_stack.back() += usage;
+}
@@ -0,0 +1,72 @@
+#ifndef MEMORYACCOUNTING_H
+#define MEMORYACCOUNTING_H
+
+#include <QHash>
+#include <QString>
+#include <set>
+#include <vector>
+
+#include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/StateSet>
+
+/// Bytes attributed to a subtree, broken down by what holds them
+struct MemoryUsage {
+    MemoryUsage() : arrays(0), primitives(0), images(0), stateSets(0), nodes(0) {}
+
+    unsigned long long total() const {
+        return arrays + primitives + images + stateSets + nodes;
+    }
+
+    MemoryUsage &operator+=(const MemoryUsage &rhs) {
+        arrays += rhs.arrays;
+        primitives += rhs.primitives;
+        images += rhs.images;
+        stateSets += rhs.stateSets;
+        nodes += rhs.nodes;
+        return *this;
+    }
+
+    unsigned long long arrays;      ///< vertex, normal, color, ... arrays
+    unsigned long long primitives;  ///< primitive sets (index data)
+    unsigned long long images;      ///< texture images
+    unsigned long long stateSets;   ///< StateSets and their attributes
+    unsigned long long nodes;       ///< nodes and drawables themselves
+};
+
+typedef QHash<const osg::Object *, MemoryUsage> MemoryReport;
+
+/// Attributes memory to every node and drawable of a scene graph.
+///
+/// Shared objects (nodes, drawables, arrays, StateSets, images) are
+/// counted once, by the first subtree that reaches them, much as du counts
+/// hard links.  That way the totals of sibling subtrees add up to the
+/// total of their parent and the total at the top is the real footprint.
+class MemoryAccountingVisitor : public osg::NodeVisitor
+{
+public:
+    MemoryAccountingVisitor();
+
+    void apply(osg::Node &node);
+    void apply(osg::Geode &geode);
+
+    /// Usage of every node and drawable visited, including its children
+    const MemoryReport &getReport() const { return m_report; }
+
+    /// Format a byte count for display, "12.3 MB" and the like
+    static QString formatBytes(unsigned long long bytes);
+
+private:
+    bool firstVisit(const osg::Referenced *object);
+    void accountNode(const osg::Node &node, MemoryUsage &usage);
+    void accountDrawable(osg::Drawable *drawable, MemoryUsage &usage);
+    void accountStateSet(const osg::StateSet *stateSet, MemoryUsage &usage);
+    void accountArray(const osg::Array *array, MemoryUsage &usage);
+
+    MemoryReport m_report;
+    std::set<const osg::Referenced *> m_seen;
+    std::vector<MemoryUsage> m_stack;
+};
+
+#endif // MEMORYACCOUNTING_H
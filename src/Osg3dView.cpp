@@ -1,27 +1,150 @@
 #include "Osg3dView.h"
 
+#include <QActionGroup>
+#include <QFile>
+#include <QFileDialog>
+#include <QInputDialog>
 #include <QMenu>
+#include <QMessageBox>
+#include <QMutex>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QSettings>
+#include "CameraPathFile.h"
 #include "OsgItemModel.h"
+#include "ProxyCullVisitor.h"
+#include "TriangleTree.h"
 
+#include <osg/ColorMask>
+#include <osg/GraphicsThread>
+#include <osg/Depth>
+#include <osg/Geode>
+#include <osg/Geometry>
 #include <osg/LightModel>
+#include <osg/LineWidth>
+#include <osg/Material>
+#include <osg/MatrixTransform>
+#include <osg/Point>
+#include <osg/PolygonMode>
+#include <osg/PolygonOffset>
+#include <osg/Timer>
+#include <osg/Uniform>
 #include <osgViewer/Renderer>
-#include <osg/ValueObject>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <set>
 
 static bool debugView = false;
 #define vDebug if (debugView) qDebug
 
+namespace {
+
+/// Draws a node of the scene somewhere else without becoming its parent.
+/// Parents belong to the scene (sharing, LOD replacement and bound
+/// invalidation all walk them), so an overlay must never add itself as one.
+class PartHighlight : public osg::Node
+{
+public:
+    PartHighlight() {}
+    PartHighlight(osg::Node *part) : m_part(part) {}
+    PartHighlight(const PartHighlight &rhs, const osg::CopyOp &copyop=osg::CopyOp::SHALLOW_COPY)
+        : osg::Node(rhs, copyop), m_part(rhs.m_part) {}
+
+    META_Node(osgtree, PartHighlight)
+
+    virtual void traverse(osg::NodeVisitor &nv) {
+        if (m_part.valid())
+            m_part->accept(nv);
+    }
+
+    virtual osg::BoundingSphere computeBound() const {
+        return m_part.valid() ? m_part->getBound() : osg::BoundingSphere();
+    }
+
+private:
+    osg::ref_ptr<osg::Node> m_part;
+};
+
+}
+
+/// What a frame costs to render: from the start of frame() to the end of
+/// its draw, with the GL work finished.  Idle time between mouse events and
+/// waits for the swap do not count, so a slow drag over a light model stays
+/// cheap.  frameStarted() is called on the GUI thread and the callback runs
+/// on the draw thread, which may still be drawing an earlier frame; frames
+/// are drawn in the order they were started, so each draw takes the oldest
+/// start.
+class Osg3dView::FrameTimer : public osg::Camera::DrawCallback
+{
+public:
+    void frameStarted() {
+        QMutexLocker lock(&m_mutex);
+        m_starts.push_back(osg::Timer::instance()->tick());
+
+        // a frame that was never drawn must not skew all the ones after it
+        while (m_starts.size() > 4)
+            m_starts.pop_front();
+    }
+
+    void operator()(osg::RenderInfo &) const {
+        glFinish();
+
+        const osg::Timer_t now = osg::Timer::instance()->tick();
+        QMutexLocker lock(&m_mutex);
+        if (m_starts.empty())
+            return;
+        m_usec.store(int(osg::Timer::instance()->delta_u(m_starts.front(), now)));
+        m_starts.pop_front();
+    }
+
+    double lastFrameMs() const { return m_usec.load() / 1000.0; }
+
+private:
+    mutable QMutex m_mutex;
+    mutable std::deque<osg::Timer_t> m_starts;
+    mutable QAtomicInt m_usec;
+};
+
 Osg3dView::Osg3dView(QWidget *parent)
     : QOpenGLWidget(parent)
     , m_viewingCore(new ViewingCore)
     , m_mouseMode(MM_ORBIT)
+    , m_viewRoot(new osg::Group)
+    , m_fillPass(new osg::Group)
+    , m_linePass(new osg::Group)
+    , m_drawMode(D_FACET)
+    , m_clashHighlight(new osg::Group)
+    , m_model(0)
+    , m_hovering(false)
+    , m_measureOverlay(new osg::Group)
+    , m_measureGeometry(new osg::Geometry)
+    , m_clipNode(new osg::ClipNode)
+    , m_activeClipPlane(-1)
+    , m_clipCulling(true)
+    , m_maxClipPlanes(6)
+    , m_needFrame(true)
+    , m_moving(false)
+    , m_degradation(0.0f)
+    , m_renderScale(1.0f)
+    , m_lowResBuffer(0)
+    , m_frameTimer(new FrameTimer)
+    , m_nextFrameHookId(1)
+    , m_lastMoveTime(0.0)
+    , m_throwing(false)
+    , m_throwTime(-1.0)
+    , m_flythroughStep(-1)
 {
     setContextMenuPolicy(Qt::CustomContextMenu);
+    setFocusPolicy(Qt::StrongFocus);
     connect(this, SIGNAL(customContextMenuRequested(QPoint)),
             this, SLOT(customMenuRequested(QPoint)));
     buildPopupMenu();
 
     // Construct the embedded graphics window
-    m_osgGraphicsWindow = new osgViewer::GraphicsWindowEmbedded(0,0,width(),height());
+    m_osgGraphicsWindow = new ThreadedGraphicsWindow(0,0,width(),height());
     getCamera()->setGraphicsContext(m_osgGraphicsWindow);
 
     // Set up the camera
@@ -34,57 +157,331 @@ Osg3dView::Osg3dView(QWidget *parent)
     getCamera()->setCullMask( (unsigned)~0 );
     getCamera()->setDataVariance(osg::Object::DYNAMIC);
 
-    // As of July 2010 there wasn't really a good way to multi-thread OSG
-    // under Qt so just set the threading model to be SingleThreaded
+    // There is no GL context to share until the widget is shown, so start
+    // out SingleThreaded.  initializeGL() switches to the saved model.
     setThreadingModel(osgViewer::Viewer::SingleThreaded);
 
     // draw both sides of polygons
     setLightingTwoSided();
 
-    update();
+    // Compressed geometry keeps its own colors (see VertexCompressor) where
+    // no clash highlight overrides this
+    m_viewRoot->getOrCreateStateSet()->addUniform(new osg::Uniform("highlightColor", osg::Vec4()));
+
+    // The hidden line passes.  Filling lays down depth only, pushed back so
+    // the visible edges pass the depth test in the line pass after it.
+    osg::StateSet *ss = m_fillPass->getOrCreateStateSet();
+    ss->setAttributeAndModes(new osg::PolygonOffset(1.0f, 1.0f),
+                             osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+    ss->setAttribute(new osg::PolygonMode(osg::PolygonMode::FRONT_AND_BACK,
+                                          osg::PolygonMode::FILL),
+                     osg::StateAttribute::OVERRIDE);
+    ss->setAttribute(new osg::ColorMask(false, false, false, false),
+                     osg::StateAttribute::OVERRIDE);
+    ss = m_linePass->getOrCreateStateSet();
+    ss->setAttribute(new osg::PolygonMode(osg::PolygonMode::FRONT_AND_BACK,
+                                          osg::PolygonMode::LINE),
+                     osg::StateAttribute::OVERRIDE);
+    ss->setRenderBinDetails(1, "RenderBin");
+
+    // Measurements are drawn last, through whatever is in front of them
+    ss = m_measureOverlay->getOrCreateStateSet();
+    ss->setMode(GL_LIGHTING, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED);
+    ss->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF | osg::StateAttribute::PROTECTED);
+    ss->setAttributeAndModes(new osg::Point(8.0f), osg::StateAttribute::ON);
+    ss->setAttributeAndModes(new osg::LineWidth(2.0f), osg::StateAttribute::ON);
+    ss->setRenderBinDetails(20, "RenderBin");
+
+    // One geometry for all of them, changed in place as the mouse moves.
+    // Being DYNAMIC, frame() does not return until it has been drawn.
+    m_measureGeometry->setDataVariance(osg::Object::DYNAMIC);
+    m_measureGeometry->setUseDisplayList(false);
+    m_measureGeometry->setVertexArray(new osg::Vec3Array);
+    m_measureGeometry->setColorArray(new osg::Vec4Array, osg::Array::BIND_PER_VERTEX);
+    m_measureGeometry->addPrimitiveSet(new osg::DrawArrays(GL_LINES, 0, 0));
+    m_measureGeometry->addPrimitiveSet(new osg::DrawArrays(GL_POINTS, 0, 0));
+    osg::ref_ptr<osg::Geode> measureGeode = new osg::Geode;
+    measureGeode->addDrawable(m_measureGeometry);
+    m_measureOverlay->addChild(measureGeode);
+
+    // Small subtrees can be drawn as boxes while moving (see degrade())
+    osgViewer::Renderer *renderer = static_cast<osgViewer::Renderer *>(getCamera()->getRenderer());
+    for (int i=0 ; i < 2 ; i++)
+        renderer->getSceneView(i)->setCullVisitor(new ProxyCullVisitor);
+    getCamera()->setFinalDrawCallback(m_frameTimer.get());
+
+    // what paintGL() used to print every frame, now only when asked for
+    addFrameHook("Log Frames", [](Osg3dView *view) {
+        qDebug("frame %u", view->getFrameStamp()->getFrameNumber());
+    }, false);
+
+    // What to leave out of the cull, when still and when moving.  Moving
+    // trades detail for frame rate until the camera has settled.
+    QSettings settings;
+    m_stillQuality.smallFeaturePixels = settings.value("view/smallFeaturePixels", 1.0).toFloat();
+    m_stillQuality.lodScale = settings.value("view/lodScale", 1.0).toFloat();
+    m_motionQuality.smallFeaturePixels = settings.value("view/motionSmallFeaturePixels", 8.0).toFloat();
+    m_motionQuality.lodScale = settings.value("view/motionLodScale", 4.0).toFloat();
+    applyCullQuality(m_stillQuality);
+
+    m_nearFarMode = static_cast<osg::CullSettings::ComputeNearFarMode>(
+                settings.value("view/nearFarMode",
+                               osg::CullSettings::COMPUTE_NEAR_FAR_USING_BOUNDING_VOLUMES).toInt());
+    foreach (QAction *a, m_nearFarActions)
+        a->setChecked(a->data().toInt() == m_nearFarMode);
+    setTightNearFar(settings.value("view/tightNearFar", false).toBool());
+
+    m_frameTargetMs = settings.value("view/frameTargetMs", 33).toInt();
+
+    // a release within this long of the last move throws the view
+    m_throwTimeTolerance = settings.value("view/throwTimeToleranceMs", 100).toInt();
+    m_throwDecay = settings.value("view/throwDecaySeconds", 0.6).toDouble();
+    m_throwMinimumSpeed = 0.05;
+
+    m_motionTimer.setSingleShot(true);
+    m_motionTimer.setInterval(settings.value("view/motionSettleMs", 300).toInt());
+    connect(&m_motionTimer, SIGNAL(timeout()),
+            this, SLOT(motionStopped()));
+
+    m_flythroughSeconds = settings.value("view/flythroughSeconds", 2.0).toDouble();
+    m_pathStep = settings.value("view/pathStepMs", 1000.0 / 60.0).toDouble() / 1000.0;
+    m_snapPixels = settings.value("view/snapPixels", 8).toInt();
+    m_clipCulling = settings.value("view/clipCulling", true).toBool();
+
+    requestRedraw();
+}
+
+Osg3dView::~Osg3dView()
+{
+    // the draw thread's context has to go before the thread does
+    m_osgGraphicsWindow->destroyDrawContext();
+    stopThreading();
+
+    makeCurrent();
+    m_blitter.destroy();
+    delete m_lowResBuffer;
+    doneCurrent();
 }
 
 void Osg3dView::setScene(OsgItemModel *model)
 {
+    m_model = model;
     connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)),
             this, SLOT(fitScreenTopView(QModelIndex,int,int)));
     connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)),
-            this, SLOT(update()));
+            this, SLOT(requestRedraw()));
+    connect(model, SIGNAL(sceneChanged()),
+            this, SLOT(requestRedraw()));
+    connect(model, SIGNAL(sceneAboutToChange()),
+            this, SLOT(waitForDraw()), Qt::DirectConnection);
+    connect(model, SIGNAL(cullMaskChanged(unsigned)),
+            this, SLOT(setCullMask(unsigned)));
+    connect(model, SIGNAL(clashesChanged()),
+            this, SLOT(clashesChanged()));
+    setCullMask(model->getCullMask());
 
     osg::ref_ptr<osg::Group> root = model->getRoot();
-    this->setSceneData(root);
+    m_sceneRoot = root;
+    setDrawMode(m_drawMode);
+    this->setSceneData(m_viewRoot);
     m_viewingCore->setSceneData(root);
 }
 
+void Osg3dView::initializeGL()
+{
+    vDebug("initializeGL");
+
+    QSettings settings;
+    setThreading(static_cast<ThreadingModel>(
+                     settings.value("threadingModel", SingleThreaded).toInt()));
+
+#ifdef GL_MAX_CLIP_PLANES
+    GLint maxClipPlanes = 0;
+    context()->functions()->glGetIntegerv(GL_MAX_CLIP_PLANES, &maxClipPlanes);
+    if (maxClipPlanes > 0)
+        m_maxClipPlanes = maxClipPlanes;
+#endif
+}
+
 void Osg3dView::paintGL()
 {
     vDebug("paintGL");
 
-    // Update the camera
+    // With a draw thread a paint may only be Qt wanting the widget back
+    // (expose, or a frame finishing), which needs no new frame.
+    const bool threaded = m_osgGraphicsWindow->hasShareContext();
+    if (threaded && !m_needFrame) {
+        presentFrame();
+        return;
+    }
+    m_needFrame = false;
+
+    // Transitions advance on the frame clock: one step per frame drawn,
+    // and another frame asked for only while one is going
+    if (m_flythroughStep >= 0 && !m_viewingCore->isAnimating())
+        advanceFlythrough();
+
+    if (m_viewingCore->isPlaying()) {
+        if (m_viewingCore->updatePlayback()) {
+            cameraMoved();
+            requestRedraw();
+        } else {
+            endFrameTimeRun();
+        }
+    }
+
+    const double frameTime = osg::Timer::instance()->time_s();
+    if (m_viewingCore->updateAnimation(frameTime) || advanceThrow(frameTime)) {
+        cameraMoved();
+        requestRedraw();
+    } else if (m_flythroughStep >= 0) {
+        // on to the next bookmark
+        requestRedraw();
+    }
+
+    // throws and transitions are part of the path too
+    m_viewingCore->recordPathKey(frameTime);
+
+    if (m_moving)
+        adaptToFrameTime();
+
+    // Update the camera.  At reduced resolution only the lower left part
+    // of the framebuffer is drawn into, and stretched over the widget.
     osg::Camera *cam = this->getCamera();
+    const osg::GraphicsContext::Traits *traits = m_osgGraphicsWindow->getTraits();
+    const QSize fullSize(std::max(traits->width, 1), std::max(traits->height, 1));
+    cam->setViewport(0, 0,
+                     std::max(1, int(fullSize.width() * m_renderScale)),
+                     std::max(1, int(fullSize.height() * m_renderScale)));
     const osg::Viewport* vp = cam->getViewport();
 
     m_viewingCore->setAspect(vp->width() / vp->height());
-    osg::Node *n = this->getSceneData();
 
-    int i;
-    if (n->getUserValue("fred", i)) {
-        qDebug("fred is %d", i);
-    } else {
-        qDebug("fred not set");
-    }
+    runFrameHooks();
+
     cam->setViewMatrix(m_viewingCore->getInverseMatrix());
     cam->setProjectionMatrix(m_viewingCore->computeProjection());
+    updateClipCulling();
+
+    // Invoke the OSG traversal pipeline.  With a draw thread this returns
+    // once the frame is handed over; it shows when the thread is done.
+    m_frameTimer->frameStarted();
+    if (threaded) {
+        frame();
+        presentFrame();
+    } else if (m_renderScale < 1.0f) {
+        if (m_lowResBuffer && m_lowResBuffer->size() != fullSize) {
+            delete m_lowResBuffer;
+            m_lowResBuffer = 0;
+        }
+        if (!m_lowResBuffer)
+            m_lowResBuffer = new QOpenGLFramebufferObject(fullSize,
+                                                          QOpenGLFramebufferObject::CombinedDepthStencil);
+        m_lowResBuffer->bind();
+        m_osgGraphicsWindow->setDefaultFboId(m_lowResBuffer->handle());
+        frame();
+
+        context()->functions()->glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+        blitFrame(m_lowResBuffer->texture(), fullSize,
+                  QRect(vp->x(), vp->y(), vp->width(), vp->height()));
+    } else {
+        // QOpenGLWidget draws into a framebuffer object of its own
+        m_osgGraphicsWindow->setDefaultFboId(defaultFramebufferObject());
+        frame();
+    }
 
-    // Invoke the OSG traversal pipeline
-    frame();
+    // Tight near/far comes from this frame's cull for the next one.  When
+    // this frame's planes were too tight for what the cull kept, draw again.
+    if (m_viewingCore->getTightNearFar() && takeCulledDepthRange())
+        requestRedraw();
+
+    if (!m_frameTimeRun.isEmpty())
+        m_frameTimes.push_back(m_frameTimer->lastFrameMs());
 
     emit updated();
 }
 
+void Osg3dView::presentFrame()
+{
+    QSize size;
+    QRect viewport;
+    unsigned texture = m_osgGraphicsWindow->takeFrame(size, viewport);
+    if (texture)
+        blitFrame(texture, size, viewport);
+}
+
+void Osg3dView::blitFrame(unsigned texture, const QSize &size, const QRect &viewport)
+{
+    if (!m_blitter.isCreated())
+        m_blitter.create();
+
+    QOpenGLFunctions *gl = context()->functions();
+    gl->glViewport(0, 0, width() * devicePixelRatio(), height() * devicePixelRatio());
+    gl->glDisable(GL_DEPTH_TEST);
+
+    m_blitter.bind();
+    m_blitter.blit(texture, QMatrix4x4(),
+                   QOpenGLTextureBlitter::sourceTransform(viewport, size,
+                                                          QOpenGLTextureBlitter::OriginBottomLeft));
+    m_blitter.release();
+}
+
+void Osg3dView::requestRedraw()
+{
+    m_needFrame = true;
+    update();
+}
+
+void Osg3dView::waitForDraw()
+{
+    osg::GraphicsThread *thread = m_osgGraphicsWindow->getGraphicsThread();
+    if (!thread || !thread->isRunning())
+        return;
+
+    osg::ref_ptr<osg::BlockAndFlushOperation> block = new osg::BlockAndFlushOperation;
+    thread->add(block.get());
+    block->block();
+}
+
+void Osg3dView::setThreading(ThreadingModel model)
+{
+    if (model != SingleThreaded && !QOpenGLContext::supportsThreadedOpenGL()) {
+        qWarning("this platform cannot draw from another thread");
+        model = SingleThreaded;
+    }
+
+    if (model != getThreadingModel()) {
+        m_osgGraphicsWindow->destroyDrawContext();
+        stopThreading();
+
+        m_osgGraphicsWindow->setShareContext(model == SingleThreaded ? 0 : context(), this);
+        setThreadingModel(model);
+
+        // frame() waits at the end barrier for the cull/draw thread.  Once
+        // the draw is issued the scene is free again, so let the GUI go
+        // there rather than after the swap, which waits on glFinish() to
+        // hand the frame over.
+        if (model == CullDrawThreadPerContext)
+            setEndBarrierPosition(BeforeSwapBuffers);
+        else
+            setEndBarrierPosition(AfterSwapBuffers);
+        if (model != SingleThreaded)
+            startThreading();
+    }
+
+    foreach (QAction *a, m_threadingActions)
+        a->setChecked(a->data().toInt() == model);
+
+    QSettings settings;
+    settings.setValue("threadingModel", static_cast<int>(model));
+
+    requestRedraw();
+}
+
 void Osg3dView::resizeGL(int w, int h)
 {
     vDebug("resizeGL");
+    m_needFrame = true;
 
     m_osgGraphicsWindow->getEventQueue()->windowResize(9, 0, w, h);
     m_osgGraphicsWindow->resized(0,0,w,h);
@@ -97,8 +494,13 @@ void Osg3dView::hello()
 
 void Osg3dView::setMouseMode(Osg3dView::MouseMode mode)
 {
+    if (mode != m_mouseMode)
+        clearMeasurement();
     m_mouseMode = mode;
 
+    // measuring follows the cursor to show where a click would snap to
+    setMouseTracking(isMeasuring());
+
     if(mode == MM_ROTATE)
         m_viewingCore->setViewingCoreMode( ViewingCore::FIRST_PERSON );
     else {
@@ -131,6 +533,14 @@ void Osg3dView::mousePressEvent(QMouseEvent *event)
 {
     vDebug("mousePressEvent");
 
+    // the user takes over from any transition or throw
+    stopBenchmarkRun();
+    m_viewingCore->stopAnimation();
+    m_throwing = false;
+    m_throwVelocity = osg::Vec2d();
+    m_moveClock.start();
+    m_lastMoveTime = 0.0;
+
     if (event->button() == Qt::LeftButton) {
         m_savedEventNDCoords = getNormalized(event->x(), event->y());
 
@@ -139,8 +549,13 @@ void Osg3dView::mousePressEvent(QMouseEvent *event)
             m_viewingCore->setPanStart( m_savedEventNDCoords.x(),
                                         m_savedEventNDCoords.y());
         else if (m_mouseMode & MM_PICK_CENTER) {
-            m_viewingCore->pickCenter(m_savedEventNDCoords.x(),
-                                      m_savedEventNDCoords.y() );
+            pickCenter(m_savedEventNDCoords);
+            m_viewingCore->recordPathKey(osg::Timer::instance()->time_s());
+        }
+        else if (isMeasuring()) {
+            MeasurePoint point;
+            if (pickMeasurePoint(event->pos(), point))
+                addMeasurePoint(point);
         }
     }
 }
@@ -148,6 +563,13 @@ void Osg3dView::mousePressEvent(QMouseEvent *event)
 void Osg3dView::mouseMoveEvent(QMouseEvent *event)
 {
     vDebug("mouseMoveEvent");
+
+    if (isMeasuring()) {
+        m_hovering = pickMeasurePoint(event->pos(), m_hoverPoint);
+        updateMeasureOverlay();
+        return;
+    }
+
     osg::Vec2d currentNDC = getNormalized(event->x(), event->y());
     osg::Vec2d delta = currentNDC - m_savedEventNDCoords;
 
@@ -174,28 +596,97 @@ void Osg3dView::mouseMoveEvent(QMouseEvent *event)
     case MM_ROTATE:
         m_viewingCore->rotate(  m_savedEventNDCoords, delta );
         break;
+    case MM_DRAG_CLIP_PLANE:
+        moveClipPlane(delta.y());
+        break;
     default:
         break;
     }
 
+    // Keep a smoothed velocity for throwing.  Single events are too jittery
+    // to go by alone.
+    const double now = m_moveClock.isValid() ? m_moveClock.nsecsElapsed() * 1e-9 : 0.0;
+    const double dt = now - m_lastMoveTime;
+    if (dt > 0.0) {
+        if (dt * 1000.0 > m_throwTimeTolerance)
+            m_throwVelocity = osg::Vec2d();
+        m_throwVelocity = m_throwVelocity * 0.5 + delta * (0.5 / dt);
+    }
+    m_lastMoveTime = now;
+
     m_savedEventNDCoords = currentNDC;
-    update();
+    m_viewingCore->recordPathKey(osg::Timer::instance()->time_s());
+    cameraMoved();
+    requestRedraw();
 }
 
 void Osg3dView::mouseReleaseEvent(QMouseEvent *event)
 {
     vDebug("mouseReleaseEvent");
     m_savedEventNDCoords = getNormalized(event->x(), event->y());
+
+    // Still moving when let go: keep going, see advanceThrow()
+    const double now = m_moveClock.isValid() ? m_moveClock.nsecsElapsed() * 1e-9 : 0.0;
+    if (event->button() == Qt::LeftButton &&
+            (m_mouseMode & (MM_ORBIT|MM_PAN|MM_ROTATE)) &&
+            (now - m_lastMoveTime) * 1000.0 < m_throwTimeTolerance &&
+            m_throwVelocity.length() > m_throwMinimumSpeed) {
+        m_throwing = true;
+        m_throwTime = -1.0;
+        requestRedraw();
+    }
+}
+
+bool Osg3dView::advanceThrow(double time)
+{
+    if (!m_throwing)
+        return false;
+
+    // the first frame only starts the clock
+    if (m_throwTime < 0.0) {
+        m_throwTime = time;
+        return true;
+    }
+
+    // A long stall would otherwise throw the view a long way in one step
+    const double dt = std::min(time - m_throwTime, 0.1);
+    m_throwTime = time;
+
+    const osg::Vec2d delta = m_throwVelocity * dt;
+    switch (m_mouseMode) {
+    case MM_ORBIT:
+    case MM_ROTATE:
+        m_viewingCore->rotate(m_savedEventNDCoords, delta);
+        break;
+    case MM_PAN:
+        m_viewingCore->pan(delta.x(), delta.y());
+        break;
+    default:
+        m_throwing = false;
+        return false;
+    }
+
+    // Exponential decay, the same over a second however many frames it took
+    m_throwVelocity *= exp(-dt / m_throwDecay);
+    if (m_throwVelocity.length() < m_throwMinimumSpeed)
+        m_throwing = false;
+
+    return true;
 }
 
 
 void Osg3dView::wheelEvent(QWheelEvent *event)
 {
+    stopBenchmarkRun();
+    m_viewingCore->stopAnimation();
+    m_throwing = false;
     if(event->delta() > 0)
         m_viewingCore->dolly(0.5);
     else
         m_viewingCore->dolly(-0.5);
-    update();
+    m_viewingCore->recordPathKey(osg::Timer::instance()->time_s());
+    cameraMoved();
+    requestRedraw();
 }
 
 void Osg3dView::buildPopupMenu()
@@ -213,6 +704,13 @@ void Osg3dView::buildPopupMenu()
     a->setData(QVariant(MM_ZOOM));
     a = sub->addAction("Pick Center", this, SLOT(setMouseMode()));
     a->setData(QVariant(MM_PICK_CENTER));
+    sub->addSeparator();
+    a = sub->addAction("Measure Distance", this, SLOT(setMouseMode()));
+    a->setData(QVariant(MM_MEASURE_DISTANCE));
+    a = sub->addAction("Measure Point To Plane", this, SLOT(setMouseMode()));
+    a->setData(QVariant(MM_MEASURE_PLANE));
+    a = sub->addAction("Measure Angle", this, SLOT(setMouseMode()));
+    a->setData(QVariant(MM_MEASURE_ANGLE));
 
     sub = m_popupMenu.addMenu("Std View...");
     a = sub->addAction("Top", this, SLOT(setStandardView()));
@@ -241,6 +739,72 @@ void Osg3dView::buildPopupMenu()
     a->setData(D_WIRE);
     a = sub->addAction("Points", this, SLOT(setDrawMode()));
     a->setData(D_POINT);
+    a = sub->addAction("Hidden Line", this, SLOT(setDrawMode()));
+    a->setData(D_HIDDEN_LINE);
+
+    sub = m_popupMenu.addMenu("Camera Path...");
+    m_recordPathAction = sub->addAction("Record", this, SLOT(recordCameraPath(bool)));
+    m_recordPathAction->setCheckable(true);
+    sub->addAction("Play", this, SLOT(playCameraPath()));
+    sub->addSeparator();
+    sub->addAction("Load Path...", this, SLOT(loadCameraPath()));
+    sub->addAction("Save Path...", this, SLOT(saveCameraPath()));
+    sub->addAction("Save Frame Times...", this, SLOT(saveFrameTimes()));
+
+    m_clipMenu = m_popupMenu.addMenu("Clipping...");
+    connect(m_clipMenu, SIGNAL(aboutToShow()),
+            this, SLOT(buildClipMenu()));
+
+    m_bookmarkMenu = m_popupMenu.addMenu("Bookmarks...");
+    connect(m_bookmarkMenu, SIGNAL(aboutToShow()),
+            this, SLOT(buildBookmarkMenu()));
+
+    m_frameHookMenu = m_popupMenu.addMenu("Frame Hooks...");
+    connect(m_frameHookMenu, SIGNAL(aboutToShow()),
+            this, SLOT(buildFrameHookMenu()));
+    connect(m_frameHookMenu, SIGNAL(triggered(QAction*)),
+            this, SLOT(toggleFrameHook(QAction*)));
+
+    // Cull and draw can overlap with each other and with the GUI
+    sub = m_popupMenu.addMenu("Threading...");
+    QActionGroup *group = new QActionGroup(this);
+    a = sub->addAction("Single Threaded", this, SLOT(setThreading()));
+    a->setData(SingleThreaded);
+    m_threadingActions.append(a);
+    a = sub->addAction("Cull/Draw Thread", this, SLOT(setThreading()));
+    a->setData(CullDrawThreadPerContext);
+    m_threadingActions.append(a);
+    a = sub->addAction("Draw Thread", this, SLOT(setThreading()));
+    a->setData(DrawThreadPerContext);
+    m_threadingActions.append(a);
+    foreach (QAction *threading, m_threadingActions) {
+        threading->setCheckable(true);
+        threading->setChecked(threading->data().toInt() == SingleThreaded);
+        group->addAction(threading);
+    }
+
+    sub = m_popupMenu.addMenu("Culling...");
+    sub->addAction("Quality...", this, SLOT(editStillQuality()));
+    sub->addAction("Quality While Moving...", this, SLOT(editMotionQuality()));
+    sub->addAction("Frame Time Target...", this, SLOT(editFrameTarget()));
+    sub->addSeparator();
+    group = new QActionGroup(this);
+    a = sub->addAction("Near/Far From Bounds", this, SLOT(setNearFarMode()));
+    a->setData(osg::CullSettings::COMPUTE_NEAR_FAR_USING_BOUNDING_VOLUMES);
+    m_nearFarActions.append(a);
+    a = sub->addAction("Near/Far From Primitives", this, SLOT(setNearFarMode()));
+    a->setData(osg::CullSettings::COMPUTE_NEAR_FAR_USING_PRIMITIVES);
+    m_nearFarActions.append(a);
+    a = sub->addAction("Near/Far From View", this, SLOT(setNearFarMode()));
+    a->setData(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+    m_nearFarActions.append(a);
+    foreach (QAction *nearFar, m_nearFarActions) {
+        nearFar->setCheckable(true);
+        group->addAction(nearFar);
+    }
+    sub->addSeparator();
+    m_tightNearFarAction = sub->addAction("Tight Near/Far", this, SLOT(setTightNearFar(bool)));
+    m_tightNearFarAction->setCheckable(true);
 }
 
 void Osg3dView::customMenuRequested(const QPoint &pos)
@@ -253,15 +817,30 @@ void Osg3dView::customMenuRequested(const QPoint &pos)
 void Osg3dView::fitScreenTopView(const QModelIndex &parent, int first, int last)
 {
     vDebug("rowsInserted");
+
+    // Only a newly loaded model warrants a new view, edits further down
+    // the tree just need a redraw.
+    if (parent.isValid()) {
+        requestRedraw();
+        return;
+    }
+
     m_viewingCore->viewTop();
     m_viewingCore->fitToScreen();
-    update();
+    requestRedraw();
+}
+
+void Osg3dView::setCullMask(unsigned mask)
+{
+    // layers are switched here alone, the scene graph is left untouched
+    getCamera()->setCullMask(mask);
+    requestRedraw();
 }
 
 void Osg3dView::dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
 {
     vDebug("dataChanged");
-    update();
+    requestRedraw();
 }
 
 void Osg3dView::setLightingTwoSided()
@@ -306,7 +885,7 @@ void Osg3dView::setStandardView()
     case V_RIGHT: m_viewingCore->viewRight(); break;
     case V_LEFT: m_viewingCore->viewLeft(); break;
     }
-    update();
+    requestRedraw();
 }
 
 void Osg3dView::setDrawMode()
@@ -315,15 +894,109 @@ void Osg3dView::setDrawMode()
     if (!a)
         return;
 
-    DrawMode drawMode = static_cast<DrawMode>(a->data().toUInt());
-    switch (drawMode) {
+    setDrawMode(static_cast<DrawMode>(a->data().toUInt()));
+}
+
+void Osg3dView::setDrawMode(DrawMode mode)
+{
+    // The camera's state and the passes are rebuilt under the draw thread
+    waitForDraw();
+
+    m_drawMode = mode;
+
+    // One override on the camera reaches every drawable, whatever state
+    // the scene carries itself
+    osg::StateSet *ss = getCamera()->getOrCreateStateSet();
+    switch (mode) {
     case D_FACET:
+    case D_HIDDEN_LINE:
+        ss->removeAttribute(osg::StateAttribute::POLYGONMODE);
         break;
     case D_WIRE:
+        ss->setAttribute(new osg::PolygonMode(osg::PolygonMode::FRONT_AND_BACK,
+                                              osg::PolygonMode::LINE),
+                         osg::StateAttribute::OVERRIDE);
         break;
     case D_POINT:
+        ss->setAttribute(new osg::PolygonMode(osg::PolygonMode::FRONT_AND_BACK,
+                                              osg::PolygonMode::POINT),
+                         osg::StateAttribute::OVERRIDE);
         break;
     }
+
+    m_viewRoot->removeChildren(0, m_viewRoot->getNumChildren());
+    m_clipNode->removeChildren(0, m_clipNode->getNumChildren());
+    m_fillPass->removeChildren(0, m_fillPass->getNumChildren());
+    m_linePass->removeChildren(0, m_linePass->getNumChildren());
+    if (m_sceneRoot.valid()) {
+        if (mode == D_HIDDEN_LINE) {
+            m_fillPass->addChild(m_sceneRoot);
+            m_linePass->addChild(m_sceneRoot);
+            m_clipNode->addChild(m_fillPass);
+            m_clipNode->addChild(m_linePass);
+        } else {
+            m_clipNode->addChild(m_sceneRoot);
+        }
+    }
+    m_clipNode->addChild(m_clashHighlight);
+    m_viewRoot->addChild(m_clipNode);
+    m_viewRoot->addChild(m_measureOverlay);
+
+    requestRedraw();
+}
+
+void Osg3dView::clashesChanged()
+{
+    OsgItemModel *model = dynamic_cast<OsgItemModel *>(sender());
+    if (!model)
+        return;
+
+    waitForDraw();
+    m_clashHighlight->removeChildren(0, m_clashHighlight->getNumChildren());
+
+    // Each part once, however many clashes it is in
+    std::set< std::pair<const osg::Node *, osg::Matrixd> > shown;
+    foreach (const OsgItemModel::Clash &clash, model->getClashes()) {
+        const SpatialIndex::RefNodePath *paths[2] = { &clash.partA, &clash.partB };
+        const osg::Matrixd *matrices[2] = { &clash.matrixA, &clash.matrixB };
+        for (int p=0 ; p < 2 ; p++) {
+            if (paths[p]->empty())
+                continue;
+
+            osg::Node *part = paths[p]->back().get();
+            if (!shown.insert(std::make_pair((const osg::Node *)part, *matrices[p])).second)
+                continue;
+
+            osg::ref_ptr<osg::MatrixTransform> mt = new osg::MatrixTransform(*matrices[p]);
+            mt->addChild(new PartHighlight(part));
+            m_clashHighlight->addChild(mt);
+        }
+    }
+
+    if (!m_clashHighlight->getStateSet()) {
+        // Drawn over the same surfaces, pulled forward enough to win
+        osg::StateSet *ss = m_clashHighlight->getOrCreateStateSet();
+        osg::ref_ptr<osg::Material> material = new osg::Material;
+        material->setColorMode(osg::Material::OFF);
+        material->setDiffuse(osg::Material::FRONT_AND_BACK, osg::Vec4(1.0f, 0.1f, 0.1f, 1.0f));
+        material->setAmbient(osg::Material::FRONT_AND_BACK, osg::Vec4(0.4f, 0.0f, 0.0f, 1.0f));
+        material->setEmission(osg::Material::FRONT_AND_BACK, osg::Vec4(0.3f, 0.0f, 0.0f, 1.0f));
+        ss->setAttributeAndModes(material,
+                                 osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+        // compressed geometry's program has no use for the material
+        ss->addUniform(new osg::Uniform("highlightColor", material->getDiffuse(osg::Material::FRONT)),
+                       osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+        ss->setTextureMode(0, GL_TEXTURE_2D,
+                           osg::StateAttribute::OFF | osg::StateAttribute::OVERRIDE);
+        ss->setAttributeAndModes(new osg::PolygonOffset(-1.0f, -1.0f),
+                                 osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+        ss->setAttributeAndModes(new osg::Depth(osg::Depth::LEQUAL),
+                                 osg::StateAttribute::ON | osg::StateAttribute::OVERRIDE);
+        ss->setRenderBinDetails(10, "RenderBin");
+    }
+
+    vDebug("%u clash parts highlighted", m_clashHighlight->getNumChildren());
+    requestRedraw();
 }
 
 void Osg3dView::setProjection()
@@ -341,5 +1014,1105 @@ void Osg3dView::setProjection()
         m_viewingCore->setOrtho(false);
         break;
     }
-    update();
+    requestRedraw();
+}
+
+void Osg3dView::setThreading()
+{
+    QAction *a = dynamic_cast<QAction *>(sender());
+    if (!a)
+        return;
+
+    setThreading(static_cast<ThreadingModel>(a->data().toInt()));
+}
+
+void Osg3dView::setNearFarMode()
+{
+    QAction *a = dynamic_cast<QAction *>(sender());
+    if (!a)
+        return;
+
+    // Primitives give the tightest depth range but cost the most cull time,
+    // From View trusts the planes ViewingCore puts in the projection.
+    m_nearFarMode = static_cast<osg::CullSettings::ComputeNearFarMode>(a->data().toInt());
+    applyNearFarMode();
+
+    QSettings settings;
+    settings.setValue("view/nearFarMode", a->data().toInt());
+    requestRedraw();
+}
+
+void Osg3dView::setTightNearFar(bool tight)
+{
+    m_viewingCore->setTightNearFar(tight);
+    m_tightNearFarAction->setChecked(tight);
+    applyNearFarMode();
+
+    QSettings settings;
+    settings.setValue("view/tightNearFar", tight);
+    requestRedraw();
+}
+
+void Osg3dView::applyNearFarMode()
+{
+    // Tight near/far needs near/far computed, but the cull only records it
+    // for the next frame (see takeCulledDepthRange()) rather than replacing
+    // the planes ViewingCore put in the projection.
+    const bool tight = m_viewingCore->getTightNearFar();
+    osg::CullSettings::ComputeNearFarMode mode = m_nearFarMode;
+    if (tight && mode == osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR)
+        mode = osg::CullSettings::COMPUTE_NEAR_FAR_USING_BOUNDING_VOLUMES;
+
+    waitForDraw();
+    getCamera()->setComputeNearFarMode(mode);
+    osgViewer::Renderer *renderer = static_cast<osgViewer::Renderer *>(getCamera()->getRenderer());
+    for (int i=0 ; i < 2 ; i++) {
+        ProxyCullVisitor *cv = dynamic_cast<ProxyCullVisitor *>(
+                    renderer->getSceneView(i)->getCullVisitor());
+        if (cv)
+            cv->setKeepNearFar(tight);
+    }
+    m_viewingCore->clearVisibleDepthRange();
+}
+
+bool Osg3dView::takeCulledDepthRange()
+{
+    // The two scene views take turns, only the one that culled the frame
+    // just drawn has its number.  Neither having it means nothing was kept.
+    const unsigned frameNumber = getFrameStamp()->getFrameNumber();
+    osgViewer::Renderer *renderer = static_cast<osgViewer::Renderer *>(getCamera()->getRenderer());
+    for (int i=0 ; i < 2 ; i++) {
+        ProxyCullVisitor *cv = dynamic_cast<ProxyCullVisitor *>(
+                    renderer->getSceneView(i)->getCullVisitor());
+        double zNear, zFar;
+        unsigned culled;
+        if (cv && cv->getCulledDepthRange(zNear, zFar, culled) && culled == frameNumber)
+            return m_viewingCore->setVisibleDepthRange(zNear, zFar);
+    }
+    m_viewingCore->clearVisibleDepthRange();
+    return false;
+}
+
+void Osg3dView::setStillQuality(const CullQuality &quality)
+{
+    m_stillQuality = quality;
+    if (!m_moving)
+        applyCullQuality(m_stillQuality);
+
+    QSettings settings;
+    settings.setValue("view/smallFeaturePixels", quality.smallFeaturePixels);
+    settings.setValue("view/lodScale", quality.lodScale);
+    requestRedraw();
+}
+
+void Osg3dView::setMotionQuality(const CullQuality &quality)
+{
+    m_motionQuality = quality;
+    if (m_moving)
+        applyCullQuality(m_motionQuality);
+
+    QSettings settings;
+    settings.setValue("view/motionSmallFeaturePixels", quality.smallFeaturePixels);
+    settings.setValue("view/motionLodScale", quality.lodScale);
+}
+
+void Osg3dView::editStillQuality()
+{
+    CullQuality quality = m_stillQuality;
+    if (editCullQuality("Culling Quality", quality))
+        setStillQuality(quality);
+}
+
+void Osg3dView::editMotionQuality()
+{
+    CullQuality quality = m_motionQuality;
+    if (editCullQuality("Culling Quality While Moving", quality))
+        setMotionQuality(quality);
+}
+
+bool Osg3dView::editCullQuality(const QString &title, CullQuality &quality)
+{
+    bool ok = false;
+    double pixels = QInputDialog::getDouble(this, title,
+                                            "Cull features smaller than (pixels, 0 for none)",
+                                            quality.smallFeaturePixels, 0.0, 1000.0, 1, &ok);
+    if (!ok)
+        return false;
+
+    double lodScale = QInputDialog::getDouble(this, title,
+                                              "LOD scale (above 1 is coarser)",
+                                              quality.lodScale, 0.01, 100.0, 2, &ok);
+    if (!ok)
+        return false;
+
+    quality.smallFeaturePixels = pixels;
+    quality.lodScale = lodScale;
+    return true;
+}
+
+void Osg3dView::applyCullQuality(const CullQuality &quality)
+{
+    osg::Camera *cam = getCamera();
+
+    osg::CullSettings::CullingMode mode = cam->getCullingMode();
+    if (quality.smallFeaturePixels > 0.0f) {
+        cam->setCullingMode(mode | osg::CullSettings::SMALL_FEATURE_CULLING);
+        cam->setSmallFeatureCullingPixelSize(quality.smallFeaturePixels);
+    } else {
+        cam->setCullingMode(mode & ~osg::CullSettings::SMALL_FEATURE_CULLING);
+    }
+    cam->setLODScale(quality.lodScale);
+}
+
+void Osg3dView::cameraMoved()
+{
+    // A benchmark run measures the scene at full quality, the same on
+    // every run, rather than whatever degradation the frame times settle on
+    if (!m_frameTimeRun.isEmpty())
+        return;
+
+    if (!m_moving) {
+        m_moving = true;
+        applyCullQuality(m_motionQuality);
+        degrade(m_degradation);
+    }
+    m_motionTimer.start();
+}
+
+void Osg3dView::motionStopped()
+{
+    m_moving = false;
+    applyCullQuality(m_stillQuality);
+
+    // m_degradation is kept, the next drag starts where this one settled
+    degrade(0.0f);
+    requestRedraw();
+}
+
+void Osg3dView::adaptToFrameTime()
+{
+    // The cost of drawing, so pauses between mouse events do not count
+    const double frameMs = m_frameTimer->lastFrameMs();
+    if (m_frameTargetMs <= 0 || frameMs <= 0.0)
+        return;
+
+    // Back off quickly when too slow, recover slowly when there is room,
+    // and leave a band in between so it does not oscillate
+    float level = m_degradation;
+    if (frameMs > m_frameTargetMs * 1.2)
+        level = std::min(1.0f, level + 0.1f);
+    else if (frameMs < m_frameTargetMs * 0.6)
+        level = std::max(0.0f, level - 0.05f);
+
+    if (level != m_degradation) {
+        vDebug("frame %.1f ms, degradation %.2f", frameMs, level);
+        m_degradation = level;
+        degrade(level);
+    }
+}
+
+void Osg3dView::degrade(float level)
+{
+    // at worst half resolution, and boxes for anything under 32 pixels
+    m_renderScale = 1.0f - 0.5f * level;
+
+    osgViewer::Renderer *renderer = static_cast<osgViewer::Renderer *>(getCamera()->getRenderer());
+    for (int i=0 ; i < 2 ; i++) {
+        ProxyCullVisitor *cv = dynamic_cast<ProxyCullVisitor *>(
+                    renderer->getSceneView(i)->getCullVisitor());
+        if (cv)
+            cv->setProxyPixelSize(32.0f * level);
+    }
+}
+
+void Osg3dView::editFrameTarget()
+{
+    bool ok = false;
+    int ms = QInputDialog::getInt(this, "Frame Time Target",
+                                  "Frame time to hold while moving (ms, 0 for no limit)",
+                                  m_frameTargetMs, 0, 1000, 1, &ok);
+    if (!ok)
+        return;
+
+    m_frameTargetMs = ms;
+    if (ms <= 0)
+        m_degradation = 0.0f;
+
+    QSettings settings;
+    settings.setValue("view/frameTargetMs", ms);
+}
+
+int Osg3dView::addFrameHook(const QString &name, const FrameHook &hook, bool enabled)
+{
+    FrameHookEntry entry;
+    entry.hook = hook;
+    entry.cost.id = m_nextFrameHookId++;
+    entry.cost.name = name;
+    entry.cost.enabled = enabled;
+    entry.cost.calls = 0;
+    entry.cost.totalMs = 0.0;
+    entry.cost.lastMs = 0.0;
+    m_frameHooks.append(entry);
+
+    return entry.cost.id;
+}
+
+void Osg3dView::removeFrameHook(int id)
+{
+    for (int i=0 ; i < m_frameHooks.size() ; i++) {
+        if (m_frameHooks[i].cost.id == id) {
+            m_frameHooks.removeAt(i);
+            return;
+        }
+    }
+}
+
+void Osg3dView::setFrameHookEnabled(int id, bool enabled)
+{
+    for (int i=0 ; i < m_frameHooks.size() ; i++) {
+        if (m_frameHooks[i].cost.id == id)
+            m_frameHooks[i].cost.enabled = enabled;
+    }
+}
+
+QList<Osg3dView::FrameHookCost> Osg3dView::getFrameHookCosts() const
+{
+    QList<FrameHookCost> costs;
+    foreach (const FrameHookEntry &entry, m_frameHooks)
+        costs.append(entry.cost);
+    return costs;
+}
+
+int Osg3dView::frameHookIndex(int id) const
+{
+    for (int i=0 ; i < m_frameHooks.size() ; i++) {
+        if (m_frameHooks[i].cost.id == id)
+            return i;
+    }
+    return -1;
+}
+
+void Osg3dView::runFrameHooks()
+{
+    osg::Timer *timer = osg::Timer::instance();
+
+    // A hook may add or remove hooks, itself included, so they are run
+    // from a copy and looked up again by id before and after each call
+    const QList<FrameHookEntry> hooks = m_frameHooks;
+    foreach (const FrameHookEntry &entry, hooks) {
+        int i = frameHookIndex(entry.cost.id);
+        if (i < 0 || !m_frameHooks[i].cost.enabled)
+            continue;
+
+        osg::Timer_t start = timer->tick();
+        entry.hook(this);
+        const double ms = timer->delta_m(start, timer->tick());
+
+        i = frameHookIndex(entry.cost.id);
+        if (i < 0)
+            continue;
+
+        FrameHookCost &cost = m_frameHooks[i].cost;
+        cost.lastMs = ms;
+        cost.totalMs += ms;
+        cost.calls++;
+    }
+}
+
+void Osg3dView::buildFrameHookMenu()
+{
+    m_frameHookMenu->clear();
+
+    foreach (const FrameHookCost &cost, getFrameHookCosts()) {
+        QString text = cost.name;
+        if (cost.calls > 0)
+            text += QString(" (%1 ms/frame)").arg(cost.totalMs / cost.calls, 0, 'f', 3);
+
+        QAction *a = m_frameHookMenu->addAction(text);
+        a->setCheckable(true);
+        a->setChecked(cost.enabled);
+        a->setData(cost.id);
+    }
+}
+
+void Osg3dView::toggleFrameHook(QAction *action)
+{
+    setFrameHookEnabled(action->data().toInt(), action->isChecked());
+    requestRedraw();
+}
+
+void Osg3dView::fitToBound(const osg::BoundingBox &box)
+{
+    if (!box.valid())
+        return;
+
+    m_viewingCore->fitToBound(box);
+    requestRedraw();
+}
+
+void Osg3dView::setBookmarkFile(const QString &fileName)
+{
+    m_bookmarkFile = fileName;
+    if (fileName.isEmpty() || !m_bookmarks.load(fileName))
+        m_bookmarks.clear();
+}
+
+void Osg3dView::saveBookmark(int i, const QString &name, int key)
+{
+    ViewBookmarks::Bookmark bookmark;
+    bookmark.name = name;
+    bookmark.state = m_viewingCore->getViewState();
+    bookmark.ortho = m_viewingCore->getOrtho();
+    bookmark.key = key;
+    m_bookmarks.set(std::min(i, m_bookmarks.count()), bookmark);
+
+    if (!m_bookmarkFile.isEmpty())
+        m_bookmarks.save(m_bookmarkFile);
+}
+
+void Osg3dView::restoreBookmark(int i, double seconds)
+{
+    if (i < 0 || i >= m_bookmarks.count())
+        return;
+
+    const ViewBookmarks::Bookmark &bookmark = m_bookmarks.at(i);
+
+    // projection changes at once, everything else is animated
+    if (bookmark.ortho != m_viewingCore->getOrtho())
+        m_viewingCore->setOrtho(bookmark.ortho);
+
+    m_viewingCore->startTransition(bookmark.state,
+                                   seconds < 0.0 ? m_viewingCore->getTransitionDuration() : seconds);
+    requestRedraw();
+}
+
+void Osg3dView::buildBookmarkMenu()
+{
+    m_bookmarkMenu->clear();
+
+    m_bookmarkMenu->addAction("Add Bookmark...", this, SLOT(addBookmark()));
+    QAction *a = m_bookmarkMenu->addAction("Fly Through Bookmarks", this, SLOT(flyThroughBookmarks()));
+    a->setEnabled(m_bookmarks.count() > 1);
+
+    if (m_bookmarks.count() == 0)
+        return;
+
+    m_bookmarkMenu->addSeparator();
+    QMenu *remove = new QMenu("Remove...", m_bookmarkMenu);
+    for (int i=0 ; i < m_bookmarks.count() ; i++) {
+        QString text = m_bookmarks.at(i).name;
+        if (m_bookmarks.at(i).key)
+            text += QString("\t%1").arg(m_bookmarks.at(i).key);
+
+        a = m_bookmarkMenu->addAction(text, this, SLOT(restoreBookmark()));
+        a->setData(i);
+        a = remove->addAction(m_bookmarks.at(i).name, this, SLOT(removeBookmark()));
+        a->setData(i);
+    }
+    m_bookmarkMenu->addSeparator();
+    m_bookmarkMenu->addMenu(remove);
+}
+
+void Osg3dView::addBookmark()
+{
+    bool ok = false;
+    QString name = QInputDialog::getText(this, "Add Bookmark", "Name:", QLineEdit::Normal,
+                                         QString("View %1").arg(m_bookmarks.count() + 1), &ok);
+    if (ok && !name.isEmpty())
+        saveBookmark(m_bookmarks.count(), name, m_bookmarks.freeKey());
+}
+
+void Osg3dView::restoreBookmark()
+{
+    QAction *a = dynamic_cast<QAction *>(sender());
+    if (a)
+        restoreBookmark(a->data().toInt());
+}
+
+void Osg3dView::removeBookmark()
+{
+    QAction *a = dynamic_cast<QAction *>(sender());
+    if (!a)
+        return;
+
+    m_bookmarks.remove(a->data().toInt());
+    if (!m_bookmarkFile.isEmpty())
+        m_bookmarks.save(m_bookmarkFile);
+}
+
+void Osg3dView::keyPressEvent(QKeyEvent *event)
+{
+    // 1-9 go to a bookmark, Ctrl with them puts the current view there
+    if (event->key() >= Qt::Key_1 && event->key() <= Qt::Key_9) {
+        const int key = event->key() - Qt::Key_0;
+        const int i = m_bookmarks.find(key);
+        if (event->modifiers() & Qt::ControlModifier) {
+            saveBookmark(i < 0 ? m_bookmarks.count() : i, QString("View %1").arg(key), key);
+        } else {
+            stopBenchmarkRun();
+            restoreBookmark(i);
+        }
+        return;
+    }
+
+    if (event->key() == Qt::Key_Escape && !m_frameTimeRun.isEmpty()) {
+        stopBenchmarkRun();
+        return;
+    }
+
+    if (event->key() == Qt::Key_Escape && !m_measurePoints.isEmpty()) {
+        clearMeasurement();
+        return;
+    }
+
+    QOpenGLWidget::keyPressEvent(event);
+}
+
+void Osg3dView::flyThroughBookmarks()
+{
+    if (m_bookmarks.count() == 0)
+        return;
+
+    // Start from the first bookmark so every run covers the same path
+    m_viewingCore->stopAnimation();
+    m_viewingCore->setOrtho(m_bookmarks.at(0).ortho);
+    m_viewingCore->setViewState(m_bookmarks.at(0).state);
+    m_flythroughStep = 1;
+
+    beginFrameTimeRun("Bookmark flythrough");
+    requestRedraw();
+}
+
+void Osg3dView::advanceFlythrough()
+{
+    if (m_flythroughStep >= m_bookmarks.count()) {
+        m_flythroughStep = -1;
+        endFrameTimeRun();
+        return;
+    }
+
+    restoreBookmark(m_flythroughStep++, m_flythroughSeconds);
+}
+
+void Osg3dView::stopBenchmarkRun()
+{
+    if (m_frameTimeRun.isEmpty())
+        return;
+
+    // an interrupted run measures nothing worth reporting
+    m_flythroughStep = -1;
+    m_viewingCore->stopPlayback();
+    m_frameTimeRun.clear();
+    m_frameTimes.clear();
+}
+
+void Osg3dView::beginFrameTimeRun(const QString &name)
+{
+    m_frameTimeRun = name;
+    m_frameTimes.clear();
+
+    // cameraMoved() leaves quality alone during the run, so start from still
+    if (m_moving) {
+        m_motionTimer.stop();
+        motionStopped();
+    }
+}
+
+void Osg3dView::endFrameTimeRun()
+{
+    const QString name = m_frameTimeRun;
+    m_frameTimeRun.clear();
+
+    // The first interval reaches back to whatever was drawn before the run
+    std::vector<double> times(m_frameTimes.begin() + std::min<size_t>(1, m_frameTimes.size()),
+                              m_frameTimes.end());
+    m_frameTimes.clear();
+    m_lastRunTimes = times;
+    if (times.empty())
+        return;
+
+    double total = 0.0;
+    for (unsigned i=0 ; i < times.size() ; i++)
+        total += times[i];
+    std::sort(times.begin(), times.end());
+
+    const QString report = QString("%1 frames, %2 s rendering, "
+                                   "mean %3 ms, median %4 ms, "
+                                   "95th percentile %5 ms, worst %6 ms")
+            .arg(times.size())
+            .arg(total / 1000.0, 0, 'f', 2)
+            .arg(total / times.size(), 0, 'f', 2)
+            .arg(times[times.size() / 2], 0, 'f', 2)
+            .arg(times[std::min(times.size() - 1, times.size() * 95 / 100)], 0, 'f', 2)
+            .arg(times.back(), 0, 'f', 2);
+
+    // Runs end inside paintGL(), no place for a dialog's event loop
+    const QString line = QString("%1: %2").arg(name, report);
+    vDebug("%s", qPrintable(line));
+    emit message(line);
+}
+
+void Osg3dView::recordCameraPath(bool record)
+{
+    const double now = osg::Timer::instance()->time_s();
+    if (record)
+        m_viewingCore->startRecording(now);
+    else if (m_viewingCore->isRecording())
+        m_cameraPath = m_viewingCore->stopRecording();
+    m_recordPathAction->setChecked(record);
+}
+
+void Osg3dView::playCameraPath()
+{
+    recordCameraPath(false);
+    if (m_cameraPath.empty())
+        return;
+
+    stopBenchmarkRun();
+    m_viewingCore->stopAnimation();
+    m_throwing = false;
+    m_viewingCore->startPlayback(m_cameraPath, m_pathStep);
+
+    beginFrameTimeRun("Camera path playback");
+    requestRedraw();
+}
+
+void Osg3dView::loadCameraPath()
+{
+    QSettings settings;
+    QString fileName = QFileDialog::getOpenFileName(this, "Load Camera Path",
+                                                    settings.value("currentDirectory").toString(),
+                                                    "Camera paths (*.path)");
+    if (fileName.isEmpty())
+        return;
+
+    QString error;
+    if (CameraPathFile::load(fileName, m_cameraPath, &error))
+        emit message(QString("Loaded a camera path of %1 keys").arg(m_cameraPath.size()));
+    else
+        emit message(error);
+}
+
+void Osg3dView::saveCameraPath()
+{
+    recordCameraPath(false);
+    if (m_cameraPath.empty())
+        return;
+
+    QSettings settings;
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Camera Path",
+                                                    settings.value("currentDirectory").toString(),
+                                                    "Camera paths (*.path)");
+    if (fileName.isEmpty())
+        return;
+
+    QString error;
+    if (CameraPathFile::save(fileName, m_cameraPath, &error))
+        emit message(QString("Saved a camera path of %1 keys").arg(m_cameraPath.size()));
+    else
+        emit message(error);
+}
+
+void Osg3dView::saveFrameTimes()
+{
+    if (m_lastRunTimes.empty())
+        return;
+
+    QSettings settings;
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Frame Times",
+                                                    settings.value("currentDirectory").toString(),
+                                                    "CSV (*.csv)");
+    if (fileName.isEmpty())
+        return;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning("could not write frame times to %s", qPrintable(fileName));
+        return;
+    }
+
+    // one line per frame, in the order drawn, to line runs up side by side
+    file.write("frame,ms\n");
+    for (unsigned i=0 ; i < m_lastRunTimes.size() ; i++)
+        file.write(QString("%1,%2\n").arg(i).arg(m_lastRunTimes[i], 0, 'f', 3).toLatin1());
+}
+
+bool Osg3dView::isMeasuring() const
+{
+    return (m_mouseMode & (MM_MEASURE_DISTANCE|MM_MEASURE_PLANE|MM_MEASURE_ANGLE)) != 0;
+}
+
+void Osg3dView::pickCenter(const osg::Vec2d &ndc)
+{
+    if (!m_model)
+        return;
+
+    // Through the model's triangle trees rather than an intersection
+    // visitor, which cannot see compressed geometry.  The segment runs
+    // through the whole view volume, as for measuring, and what is clipped
+    // away cannot be picked.
+    const osg::Matrixd inverse = osg::Matrixd::inverse(m_viewingCore->getInverseMatrix() *
+                                                       m_viewingCore->computeProjection());
+    osg::Vec3d start = osg::Vec3d(ndc.x(), ndc.y(), -1.0) * inverse;
+    osg::Vec3d end = osg::Vec3d(ndc.x(), ndc.y(), 1.0) * inverse;
+
+    OsgItemModel::PartHit hit;
+    if (clipSegment(start, end) && m_model->pickPart(start, end, hit))
+        m_viewingCore->pickCenter(hit.point);
+}
+
+bool Osg3dView::pickMeasurePoint(const QPoint &pos, MeasurePoint &result)
+{
+    if (!m_model)
+        return false;
+
+    osg::ElapsedTime elapsed;
+
+    // The cursor as a segment through the whole view volume
+    const osg::Vec2d ndc = getNormalized(pos.x(), pos.y());
+    const osg::Matrixd viewProjection = m_viewingCore->getInverseMatrix() *
+            m_viewingCore->computeProjection();
+    const osg::Matrixd inverse = osg::Matrixd::inverse(viewProjection);
+    const osg::Vec3d start = osg::Vec3d(ndc.x(), ndc.y(), -1.0) * inverse;
+    const osg::Vec3d end = osg::Vec3d(ndc.x(), ndc.y(), 1.0) * inverse;
+
+    // only what shows can be picked
+    osg::Vec3d from = start;
+    osg::Vec3d to = end;
+    OsgItemModel::PartHit hit;
+    if (!clipSegment(from, to) || !m_model->pickPart(from, to, hit))
+        return false;
+
+    result.point = hit.point;
+    result.normal = hit.normal;
+    result.snap = SNAP_SURFACE;
+
+    // How far snapping reaches, in the scene at the depth of the hit
+    const osg::Vec3d clip = hit.point * viewProjection;
+    const double reach = 2.0 * m_snapPixels / std::max(width(), 1);
+    const double radius = ((osg::Vec3d(clip.x() + reach, clip.y(), clip.z()) * inverse) -
+                           hit.point).length();
+
+    const osg::Vec2d halfSize(width() * 0.5, height() * 0.5);
+    auto pixelsFromCursor = [&](const osg::Vec3d &p) {
+        const osg::Vec3d c = p * viewProjection;
+        const osg::Vec2d d(c.x() - ndc.x(), c.y() - ndc.y());
+        return osg::Vec2d(d.x() * halfSize.x(), d.y() * halfSize.y()).length();
+    };
+
+    // Only the triangles of the part that are around the hit can be
+    // snapped to, found through the part's hierarchy
+    const osg::Matrixd toPart = osg::Matrixd::inverse(hit.matrix);
+    osg::BoundingBoxd around;
+    for (int c=0 ; c < 8 ; c++) {
+        const osg::Vec3d corner(c & 1 ? radius : -radius,
+                                c & 2 ? radius : -radius,
+                                c & 4 ? radius : -radius);
+        around.expandBy((hit.point + corner) * toPart);
+    }
+    const std::vector<TriangleTree::Triangle> &triangles = hit.triangles->getTriangles();
+    const std::vector<unsigned> nearby = hit.triangles->findWithin(around);
+
+    // A vertex wins over an edge, and the nearest of either on screen
+    double bestVertex = m_snapPixels;
+    double bestEdge = m_snapPixels;
+    osg::Vec3d edgePoint;
+    const osg::Vec3d ray = end - start;
+    for (unsigned n=0 ; n < nearby.size() ; n++) {
+        const TriangleTree::Triangle &triangle = triangles[nearby[n]];
+        osg::Vec3d v[3];
+        for (int i=0 ; i < 3 ; i++)
+            v[i] = triangle.v[i] * hit.matrix;
+
+        for (int i=0 ; i < 3 ; i++) {
+            const double pixels = pixelsFromCursor(v[i]);
+            if (pixels <= bestVertex && !isClipped(v[i])) {
+                bestVertex = pixels;
+                result.point = v[i];
+                result.snap = SNAP_VERTEX;
+            }
+        }
+        if (result.snap == SNAP_VERTEX)
+            continue;
+
+        // the point of each edge nearest the line under the cursor
+        for (int i=0 ; i < 3 ; i++) {
+            const osg::Vec3d &a = v[i];
+            const osg::Vec3d edge = v[(i + 1) % 3] - a;
+            const osg::Vec3d w = a - start;
+            const double ee = edge * edge, er = edge * ray, rr = ray * ray;
+            const double denominator = ee * rr - er * er;
+            if (ee <= 0.0 || denominator <= 0.0)
+                continue;
+            const double s = osg::clampBetween((er * (ray * w) - rr * (edge * w)) / denominator,
+                                               0.0, 1.0);
+            const osg::Vec3d p = a + edge * s;
+            const double pixels = pixelsFromCursor(p);
+            if (pixels <= bestEdge && !isClipped(p)) {
+                bestEdge = pixels;
+                edgePoint = p;
+            }
+        }
+    }
+    if (result.snap != SNAP_VERTEX && bestEdge < m_snapPixels) {
+        result.point = edgePoint;
+        result.snap = SNAP_EDGE;
+    }
+
+    vDebug("pick %.2f ms, %u triangles near, snap %d",
+           elapsed.elapsedTime_m(), (unsigned)nearby.size(), result.snap);
+    return true;
+}
+
+void Osg3dView::addMeasurePoint(const MeasurePoint &point)
+{
+    const unsigned needed = m_mouseMode == MM_MEASURE_ANGLE ? 3 : 2;
+
+    // a click after a finished measurement starts the next one
+    if ((unsigned)m_measurePoints.size() >= needed)
+        m_measurePoints.clear();
+    m_measurePoints << point;
+
+    if ((unsigned)m_measurePoints.size() == needed) {
+        const osg::Vec3d &a = m_measurePoints[0].point;
+        const osg::Vec3d &b = m_measurePoints[1].point;
+        QString text;
+        switch (m_mouseMode) {
+        case MM_MEASURE_DISTANCE: {
+            const osg::Vec3d d = b - a;
+            text = QString("Distance %1 (dx %2, dy %3, dz %4)")
+                    .arg(d.length()).arg(d.x()).arg(d.y()).arg(d.z());
+            break;
+        }
+        case MM_MEASURE_PLANE: {
+            // the plane of the face the first click was on
+            const osg::Vec3d &normal = m_measurePoints[0].normal;
+            text = QString("Distance to plane %1").arg(fabs((b - a) * normal));
+            break;
+        }
+        case MM_MEASURE_ANGLE: {
+            osg::Vec3d u = a - b;
+            osg::Vec3d v = m_measurePoints[2].point - b;
+            u.normalize();
+            v.normalize();
+            const double angle = acos(osg::clampBetween(u * v, -1.0, 1.0));
+            text = QString("Angle %1 degrees").arg(osg::RadiansToDegrees(angle));
+            break;
+        }
+        default:
+            break;
+        }
+
+        vDebug("%s", qPrintable(text));
+        emit measured(text);
+    }
+
+    updateMeasureOverlay();
+}
+
+void Osg3dView::clearMeasurement()
+{
+    m_measurePoints.clear();
+    m_hovering = false;
+    updateMeasureOverlay();
+}
+
+void Osg3dView::updateMeasureOverlay()
+{
+    // No draw can be using m_measureGeometry between frames (it is DYNAMIC)
+    osg::Vec3Array *vertices = static_cast<osg::Vec3Array *>(m_measureGeometry->getVertexArray());
+    osg::Vec4Array *colors = static_cast<osg::Vec4Array *>(m_measureGeometry->getColorArray());
+    vertices->clear();
+    colors->clear();
+    const osg::Vec4 lineColor(1.0f, 0.8f, 0.0f, 1.0f);
+
+    // Lines first: between the points, or from the point to the plane
+    for (int i=1 ; i < m_measurePoints.size() ; i++) {
+        osg::Vec3d from = m_measurePoints[i-1].point;
+        const osg::Vec3d &to = m_measurePoints[i].point;
+        if (m_mouseMode == MM_MEASURE_PLANE) {
+            const osg::Vec3d &normal = m_measurePoints[0].normal;
+            from = to - normal * ((to - m_measurePoints[0].point) * normal);
+        }
+        vertices->push_back(from);
+        vertices->push_back(to);
+        colors->push_back(lineColor);
+        colors->push_back(lineColor);
+    }
+    const unsigned lineVertices = vertices->size();
+
+    // Then the points, coloured by what they snapped to
+    QList<MeasurePoint> points = m_measurePoints;
+    if (m_hovering)
+        points << m_hoverPoint;
+    foreach (const MeasurePoint &point, points) {
+        vertices->push_back(point.point);
+        switch (point.snap) {
+        case SNAP_VERTEX: colors->push_back(osg::Vec4(1.0f, 0.2f, 0.2f, 1.0f)); break;
+        case SNAP_EDGE: colors->push_back(osg::Vec4(0.2f, 1.0f, 1.0f, 1.0f)); break;
+        case SNAP_SURFACE: colors->push_back(osg::Vec4(1.0f, 1.0f, 1.0f, 1.0f)); break;
+        }
+    }
+
+    osg::DrawArrays *lines = static_cast<osg::DrawArrays *>(m_measureGeometry->getPrimitiveSet(0));
+    lines->setCount(lineVertices);
+    osg::DrawArrays *dots = static_cast<osg::DrawArrays *>(m_measureGeometry->getPrimitiveSet(1));
+    dots->setFirst(lineVertices);
+    dots->setCount(vertices->size() - lineVertices);
+
+    vertices->dirty();
+    colors->dirty();
+    m_measureGeometry->dirtyBound();
+    requestRedraw();
+}
+
+int Osg3dView::addClipPlane(const osg::Plane &plane)
+{
+    const int boxPlanes = m_clipBox.valid() ? 6 : 0;
+    if (m_clipPlanes.size() >= 6 ||
+            (int)m_clipPlanes.size() + boxPlanes >= m_maxClipPlanes)
+        return -1;
+
+    m_clipPlanes.push_back(plane);
+    m_activeClipPlane = m_clipPlanes.size() - 1;
+    rebuildClipPlanes();
+    return m_activeClipPlane;
+}
+
+void Osg3dView::setClipPlane(int i, const osg::Plane &plane)
+{
+    if (i < 0 || i >= (int)m_clipPlanes.size())
+        return;
+
+    // A fresh attribute instead of changing the one a frame still being
+    // drawn may use.  The render stage holds on to the old one until then.
+    m_clipPlanes[i] = plane;
+    osg::ClipNode::ClipPlaneList &planes = m_clipNode->getClipPlaneList();
+    planes[i] = new osg::ClipPlane(planes[i]->getClipPlaneNum(), plane);
+    requestRedraw();
+}
+
+void Osg3dView::removeClipPlane(int i)
+{
+    if (i < 0 || i >= (int)m_clipPlanes.size())
+        return;
+
+    m_clipPlanes.erase(m_clipPlanes.begin() + i);
+    if (m_activeClipPlane >= (int)m_clipPlanes.size())
+        m_activeClipPlane = (int)m_clipPlanes.size() - 1;
+    rebuildClipPlanes();
+}
+
+void Osg3dView::setClipBox(const osg::BoundingBox &box)
+{
+    if (box.valid() && (int)m_clipPlanes.size() + 6 > m_maxClipPlanes) {
+        QMessageBox::warning(this, "Section Box",
+                             QString("A section box takes six clip planes, and with %1 "
+                                     "in use there are only %2 left.")
+                             .arg(m_clipPlanes.size())
+                             .arg(m_maxClipPlanes - (int)m_clipPlanes.size()));
+        return;
+    }
+
+    m_clipBox = box;
+    rebuildClipPlanes();
+}
+
+void Osg3dView::clearClipBox()
+{
+    setClipBox(osg::BoundingBox());
+}
+
+void Osg3dView::clearClipping()
+{
+    m_clipPlanes.clear();
+    m_activeClipPlane = -1;
+    m_clipBox.init();
+    rebuildClipPlanes();
+}
+
+void Osg3dView::setClipCulling(bool cull)
+{
+    m_clipCulling = cull;
+
+    QSettings settings;
+    settings.setValue("view/clipCulling", cull);
+    requestRedraw();
+}
+
+void Osg3dView::rebuildClipPlanes()
+{
+    waitForDraw();
+    while (m_clipNode->getNumClipPlanes() > 0)
+        m_clipNode->removeClipPlane(m_clipNode->getNumClipPlanes() - 1);
+
+    unsigned n = 0;
+    for (unsigned i=0 ; i < m_clipPlanes.size() ; i++)
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, m_clipPlanes[i]));
+
+    if (m_clipBox.valid()) {
+        const osg::Vec3 &low = m_clipBox._min;
+        const osg::Vec3 &high = m_clipBox._max;
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, 1.0, 0.0, 0.0, -low.x()));
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, -1.0, 0.0, 0.0, high.x()));
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, 0.0, 1.0, 0.0, -low.y()));
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, 0.0, -1.0, 0.0, high.y()));
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, 0.0, 0.0, 1.0, -low.z()));
+        m_clipNode->addClipPlane(new osg::ClipPlane(n++, 0.0, 0.0, -1.0, high.z()));
+    }
+
+    vDebug("%u clip planes", n);
+    requestRedraw();
+}
+
+bool Osg3dView::clipSegment(osg::Vec3d &start, osg::Vec3d &end) const
+{
+    // What shows is on the kept side of every plane, so trimming against
+    // each in turn leaves just that
+    for (unsigned i=0 ; i < m_clipNode->getNumClipPlanes() ; i++) {
+        const osg::Plane plane(m_clipNode->getClipPlane(i)->getClipPlane());
+        const double a = plane.distance(start);
+        const double b = plane.distance(end);
+        if (a < 0.0 && b < 0.0)
+            return false;
+        if (a < 0.0)
+            start = start + (end - start) * (a / (a - b));
+        else if (b < 0.0)
+            end = start + (end - start) * (a / (a - b));
+    }
+    return true;
+}
+
+bool Osg3dView::isClipped(const osg::Vec3d &point) const
+{
+    for (unsigned i=0 ; i < m_clipNode->getNumClipPlanes() ; i++) {
+        if (osg::Plane(m_clipNode->getClipPlane(i)->getClipPlane()).distance(point) < 0.0)
+            return true;
+    }
+    return false;
+}
+
+void Osg3dView::updateClipCulling()
+{
+    // Into eye coordinates once a frame, from there the cull brings them
+    // to each node it tests
+    std::vector<osg::Plane> planes;
+    if (m_clipCulling) {
+        const osg::Matrixd toWorld = m_viewingCore->getMatrix();
+        for (unsigned i=0 ; i < m_clipNode->getNumClipPlanes() ; i++) {
+            osg::Plane plane(m_clipNode->getClipPlane(i)->getClipPlane());
+            plane.transformProvidingInverse(toWorld);
+            planes.push_back(plane);
+        }
+    }
+
+    osgViewer::Renderer *renderer = static_cast<osgViewer::Renderer *>(getCamera()->getRenderer());
+    for (int i=0 ; i < 2 ; i++) {
+        ProxyCullVisitor *cv = dynamic_cast<ProxyCullVisitor *>(
+                    renderer->getSceneView(i)->getCullVisitor());
+        if (cv)
+            cv->setClipPlanes(planes);
+    }
+}
+
+void Osg3dView::moveClipPlane(double ndc)
+{
+    if (m_activeClipPlane < 0 || !m_sceneRoot.valid())
+        return;
+
+    osg::Plane plane = m_clipPlanes[m_activeClipPlane];
+    plane[3] -= ndc * m_sceneRoot->getBound().radius();
+    setClipPlane(m_activeClipPlane, plane);
+}
+
+void Osg3dView::buildClipMenu()
+{
+    m_clipMenu->clear();
+
+    // new planes go through the middle of the view
+    const bool canAdd = m_clipPlanes.size() < 6 &&
+            (int)m_clipPlanes.size() + (m_clipBox.valid() ? 6 : 0) < m_maxClipPlanes;
+    QAction *a = m_clipMenu->addAction("Add Plane Facing View", this, SLOT(addClipPlane()));
+    a->setData(3);
+    a->setEnabled(canAdd);
+    a = m_clipMenu->addAction("Add X Plane", this, SLOT(addClipPlane()));
+    a->setData(0);
+    a->setEnabled(canAdd);
+    a = m_clipMenu->addAction("Add Y Plane", this, SLOT(addClipPlane()));
+    a->setData(1);
+    a->setEnabled(canAdd);
+    a = m_clipMenu->addAction("Add Z Plane", this, SLOT(addClipPlane()));
+    a->setData(2);
+    a->setEnabled(canAdd);
+    a = m_clipMenu->addAction("Drag Clip Plane", this, SLOT(setMouseMode()));
+    a->setData(QVariant(MM_DRAG_CLIP_PLANE));
+    a->setEnabled(!m_clipPlanes.empty());
+
+    if (!m_clipPlanes.empty()) {
+        m_clipMenu->addSeparator();
+        QActionGroup *group = new QActionGroup(m_clipMenu);
+        for (unsigned i=0 ; i < m_clipPlanes.size() ; i++) {
+            const osg::Vec3d normal = m_clipPlanes[i].getNormal();
+            a = m_clipMenu->addAction(QString("Plane %1 (%2 %3 %4)").arg(i + 1)
+                                      .arg(normal.x(), 0, 'g', 3)
+                                      .arg(normal.y(), 0, 'g', 3)
+                                      .arg(normal.z(), 0, 'g', 3),
+                                      this, SLOT(selectClipPlane()));
+            a->setData(i);
+            a->setCheckable(true);
+            a->setChecked((int)i == m_activeClipPlane);
+            group->addAction(a);
+        }
+        m_clipMenu->addAction("Flip Plane", this, SLOT(flipClipPlane()));
+        m_clipMenu->addAction("Remove Plane", this, SLOT(removeClipPlane()));
+    }
+
+    m_clipMenu->addSeparator();
+    a = m_clipMenu->addAction("Remove Section Box", this, SLOT(clearClipBox()));
+    a->setEnabled(m_clipBox.valid());
+    a = m_clipMenu->addAction("Remove All Clipping", this, SLOT(clearClipping()));
+    a->setEnabled(!m_clipPlanes.empty() || m_clipBox.valid());
+    m_clipMenu->addSeparator();
+    a = m_clipMenu->addAction("Cull Clipped Subtrees", this, SLOT(setClipCulling(bool)));
+    a->setCheckable(true);
+    a->setChecked(m_clipCulling);
+}
+
+void Osg3dView::addClipPlane()
+{
+    QAction *a = dynamic_cast<QAction *>(sender());
+    if (!a)
+        return;
+
+    osg::Vec3d normal;
+    const int axis = a->data().toInt();
+    if (axis < 3)
+        normal[axis] = 1.0;
+    else
+        normal = m_viewingCore->getViewDir(); // keeps what is beyond the center
+
+    const osg::Vec3d center = m_viewingCore->getViewCenter();
+    addClipPlane(osg::Plane(normal, center));
+}
+
+void Osg3dView::selectClipPlane()
+{
+    QAction *a = dynamic_cast<QAction *>(sender());
+    if (a)
+        m_activeClipPlane = a->data().toInt();
+}
+
+void Osg3dView::flipClipPlane()
+{
+    if (m_activeClipPlane < 0)
+        return;
+
+    osg::Plane plane = m_clipPlanes[m_activeClipPlane];
+    plane.flip();
+    setClipPlane(m_activeClipPlane, plane);
+}
+
+void Osg3dView::removeClipPlane()
+{
+    removeClipPlane(m_activeClipPlane);
 }
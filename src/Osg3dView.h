@@ -2,14 +2,24 @@
 #define OSGVIEW_H
 
 #include <QOpenGLWidget>
+#include <QOpenGLTextureBlitter>
 #include <QMouseEvent>
 #include <QMenu>
+#include <QElapsedTimer>
+#include <QTimer>
 
+#include <functional>
+
+#include <osg/ClipNode>
+#include <osg/Geometry>
 #include <osgViewer/Viewer>
 
 #include "ViewingCore.h"
+#include "ThreadedGraphicsWindow.h"
+#include "ViewBookmarks.h"
 
 class OsgItemModel;
+class QOpenGLFramebufferObject;
 
 class Osg3dView : public QOpenGLWidget, public osgViewer::Viewer
 {
@@ -17,13 +27,18 @@ class Osg3dView : public QOpenGLWidget, public osgViewer::Viewer
 
 public:
     Osg3dView(QWidget * parent = 0);
+    ~Osg3dView();
 
     enum MouseMode {
         MM_ORBIT = (1<<1),
         MM_PAN = (1<<2),
         MM_ZOOM = (1<<3),
         MM_ROTATE = (1<<4),
-        MM_PICK_CENTER = (1<<5)
+        MM_PICK_CENTER = (1<<5),
+        MM_MEASURE_DISTANCE = (1<<6),
+        MM_MEASURE_PLANE = (1<<7),
+        MM_MEASURE_ANGLE = (1<<8),
+        MM_DRAG_CLIP_PLANE = (1<<9)
     };
     enum StandardView {
         V_TOP = (1<<0),
@@ -40,7 +55,8 @@ public:
     enum DrawMode {
         D_FACET = (1<<1),
         D_WIRE = (1<<2),
-        D_POINT = (1<<3)
+        D_POINT = (1<<3),
+        D_HIDDEN_LINE = (1<<4)
     };
 
     /// Let others tell what scene graph we should be drawing
@@ -48,7 +64,97 @@ public:
 
     osg::ref_ptr<ViewingCore> getViewingCore() const { return m_viewingCore; }
 
+    /// Switch threading models while running.  With anything but
+    /// SingleThreaded, OSG draws from a thread of its own into a context
+    /// shared with the widget and paintGL() only shows the newest frame.
+    void setThreading(ThreadingModel model);
+
+    /// Draw everything filled, as lines, as points, or as lines with the
+    /// hidden ones removed.  Only the camera and the few nodes above the
+    /// scene change, never the scene itself.
+    void setDrawMode(DrawMode mode);
+    DrawMode getDrawMode() const { return m_drawMode; }
+
+    /// Something to run on the GUI thread before every frame.  A disabled
+    /// hook costs one test of a flag per frame and is not timed.
+    typedef std::function<void (Osg3dView *)> FrameHook;
+
+    /// Returns the id to pass to the other frame hook methods
+    int addFrameHook(const QString &name, const FrameHook &hook, bool enabled=true);
+    void removeFrameHook(int id);
+    void setFrameHookEnabled(int id, bool enabled);
+
+    /// What a frame hook has cost so far, while enabled
+    struct FrameHookCost {
+        int id;
+        QString name;
+        bool enabled;
+        unsigned calls;
+        double totalMs;
+        double lastMs;
+    };
+    QList<FrameHookCost> getFrameHookCosts() const;
+
+    /// What the cull throws away.  Features smaller than
+    /// smallFeaturePixels on screen are skipped (0 keeps them all) and LOD
+    /// ranges are scaled by lodScale, so above 1 coarser levels are used.
+    struct CullQuality {
+        float smallFeaturePixels;
+        float lodScale;
+    };
+
+    /// Quality while the camera is still, and while it is being moved
+    void setStillQuality(const CullQuality &quality);
+    void setMotionQuality(const CullQuality &quality);
+    CullQuality getStillQuality() const { return m_stillQuality; }
+    CullQuality getMotionQuality() const { return m_motionQuality; }
+
+    /// Keep the bookmarks in fileName (see ViewBookmarks::sidecarFor()),
+    /// or only for this session when it is empty
+    void setBookmarkFile(const QString &fileName);
+    const ViewBookmarks &getBookmarks() const { return m_bookmarks; }
+
+    /// Make bookmark i the current view, or add it when i is the count.
+    /// It goes on number key (1-9), or on none when key is 0.
+    void saveBookmark(int i, const QString &name, int key);
+
+    /// Animate to bookmark i over seconds (the ViewingCore default when
+    /// negative)
+    void restoreBookmark(int i, double seconds=-1.0);
+
+    /// What a measurement point was pulled to
+    enum Snap {
+        SNAP_SURFACE,
+        SNAP_EDGE,
+        SNAP_VERTEX
+    };
+    struct MeasurePoint {
+        osg::Vec3d point;   ///< in the coordinates of the model's root
+        osg::Vec3d normal;  ///< of the face under the cursor
+        Snap snap;
+    };
+
+    /// The point of the scene under pos (widget pixels), moved to a vertex
+    /// or else an edge within m_snapPixels of it.  False over nothing, and
+    /// what is clipped away counts as nothing.
+    bool pickMeasurePoint(const QPoint &pos, MeasurePoint &result);
+
+    /// Make the point of the scene under ndc the view center
+    void pickCenter(const osg::Vec2d &ndc);
+
+    /// Clip planes, in the coordinates of the model's root.  Each keeps
+    /// what is on the side its normal points to.  They all sit in one
+    /// ClipNode above the scene, so moving a plane changes only its
+    /// ClipPlane and nothing in the scene.  Returns the new plane's number,
+    /// -1 when six are in use or GL has no clip plane left.
+    int addClipPlane(const osg::Plane &plane);
+    void setClipPlane(int i, const osg::Plane &plane);
+    void removeClipPlane(int i);
+    const std::vector<osg::Plane> &getClipPlanes() const { return m_clipPlanes; }
+    const osg::BoundingBox &getClipBox() const { return m_clipBox; }
+
 public slots:
+    void initializeGL();
     void paintGL();
     void resizeGL(int w, int h);
     void hello();
@@ -58,14 +164,77 @@ public slots:
     void setStandardView();
     void setDrawMode();
     void setProjection();
+    void setThreading();
+    void setNearFarMode();
+    void setTightNearFar(bool tight);
+    void editStillQuality();
+    void editMotionQuality();
+    void editFrameTarget();
+    void buildFrameHookMenu();
+    void toggleFrameHook(QAction *action);
+    void buildBookmarkMenu();
+    void addBookmark();
+    void restoreBookmark();
+    void removeBookmark();
+    void buildClipMenu();
+    void addClipPlane();
+    void selectClipPlane();
+    void flipClipPlane();
+    void removeClipPlane();
+
+    /// Visit every bookmark in turn, then report the frame times
+    void flyThroughBookmarks();
+
+    /// Record the camera as it is moved, until called with false
+    void recordCameraPath(bool record);
+
+    /// Play the camera path back a fixed step per frame, then report the
+    /// frame times.  The same path draws the same frames every time.
+    void playCameraPath();
+    void loadCameraPath();
+    void saveCameraPath();
+
+    /// Write the frame times of the last run (flythrough or playback)
+    void saveFrameTimes();
+
+    /// Ask for a new frame.  Use this rather than update(), which with a
+    /// draw thread only shows the last frame again.
+    void requestRedraw();
+
+    /// Wait for the draw thread to finish with the scene graph
+    void waitForDraw();
+
+private slots:
+    /// The camera has been still for a while, draw at full quality again
+    void motionStopped();
 
     void mousePressEvent( QMouseEvent* event );
     void mouseReleaseEvent(QMouseEvent* event);
     void mouseMoveEvent(QMouseEvent* event);
     void wheelEvent(QWheelEvent *event);
+    void keyPressEvent(QKeyEvent *event);
     void customMenuRequested(const QPoint &pos);
 
     void fitScreenTopView(const QModelIndex & parent, int first, int last);
+    void setCullMask(unsigned mask);
+
+    /// Animate to a view of box, in the coordinates of the model's root
+    void fitToBound(const osg::BoundingBox &box);
+
+    /// Show the model's clashes over the scene
+    void clashesChanged();
+
+    /// Forget the points of the measurement under way, or the last one
+    void clearMeasurement();
+
+    /// Keep only what is inside box (model root coordinates), six clip
+    /// planes' worth.  An invalid box takes the section box away.
+    void setClipBox(const osg::BoundingBox &box);
+    void clearClipBox();
+    void clearClipping();
+
+    /// Leave subtrees that are wholly clipped away out of the cull too
+    void setClipCulling(bool cull);
 
     void dataChanged(const QModelIndex & topLeft,
                      const QModelIndex & bottomRight,
@@ -76,6 +245,12 @@ signals:
     void mouseModeChanged(Osg3dView::MouseMode);
     void updated();
 
+    /// A measurement was completed, described for the user
+    void measured(const QString &text);
+
+    /// Something for the status bar, such as why a file could not be read
+    void message(const QString &text);
+
 private:
     osg::Vec2d getNormalized(const int ix, const int iy);
 
@@ -88,10 +263,166 @@ private:
 
     void buildPopupMenu();
 
+    /// Blit the newest frame of the draw thread into the widget
+    void presentFrame();
+    int frameHookIndex(int id) const;
+    void runFrameHooks();
+
+    /// Move the view on by the throw velocity for the frame at time
+    /// (seconds).  Returns false once the throw has died away.
+    bool advanceThrow(double time);
+    void blitFrame(unsigned texture, const QSize &size, const QRect &viewport);
+
+    /// The camera is being moved: drop to m_motionQuality until it has
+    /// been still for a while
+    void cameraMoved();
+    void applyCullQuality(const CullQuality &quality);
+    bool editCullQuality(const QString &title, CullQuality &quality);
+
+    /// Move m_degradation toward holding m_frameTargetMs
+    void adaptToFrameTime();
+
+    /// Lower resolution and draw small subtrees as boxes, more of both as
+    /// level goes from 0 (full quality) to 1
+    void degrade(float level);
+
+    /// Collect the time of every frame drawn until endFrameTimeRun(),
+    /// which reports them
+    void beginFrameTimeRun(const QString &name);
+    void endFrameTimeRun();
+
+    void advanceFlythrough();
+    void stopBenchmarkRun();
+
+    /// Put m_clipPlanes and m_clipBox into m_clipNode
+    void rebuildClipPlanes();
+
+    /// m_nearFarMode on the camera, only recorded by the cull while tight
+    /// near/far is on
+    void applyNearFarMode();
+
+    /// Hand the depth range the last cull kept to m_viewingCore, true when
+    /// the frame was drawn with planes that could have clipped some of it
+    bool takeCulledDepthRange();
+
+    /// Trim the segment (in the coordinates of the model's root) to what
+    /// the clip planes and section box leave showing, false if nothing
+    bool clipSegment(osg::Vec3d &start, osg::Vec3d &end) const;
+    bool isClipped(const osg::Vec3d &point) const;
+
+    /// Give the cull visitors the clip planes in eye coordinates, for the
+    /// view matrix just set
+    void updateClipCulling();
+
+    /// Slide the active clip plane along its normal, by ndc of the scene's
+    /// radius
+    void moveClipPlane(double ndc);
+
+    bool isMeasuring() const;
+    void addMeasurePoint(const MeasurePoint &point);
+    void updateMeasureOverlay();
+
     QMenu m_popupMenu;
+    QList<QAction *> m_threadingActions;
+    QList<QAction *> m_nearFarActions;
+    osg::CullSettings::ComputeNearFarMode m_nearFarMode; ///< as chosen in the menu
+    QAction *m_tightNearFarAction;
+    QMenu *m_frameHookMenu;
+    QMenu *m_bookmarkMenu;
+    QMenu *m_clipMenu;
+    QAction *m_recordPathAction;
+
+    /// What the viewer draws: the model's root, once or once per pass
+    osg::ref_ptr<osg::Group> m_viewRoot;
+    osg::ref_ptr<osg::Group> m_sceneRoot;
+
+    /// Hidden line passes: depth only with the polygons pushed back, then
+    /// the lines
+    osg::ref_ptr<osg::Group> m_fillPass;
+    osg::ref_ptr<osg::Group> m_linePass;
+    DrawMode m_drawMode;
+
+    /// The parts of every clash, drawn again in red on top of the scene
+    osg::ref_ptr<osg::Group> m_clashHighlight;
+
+    // Clipping
+
+    /// Above everything that is clipped, holding every clip plane
+    osg::ref_ptr<osg::ClipNode> m_clipNode;
+    std::vector<osg::Plane> m_clipPlanes;
+    osg::BoundingBox m_clipBox;    ///< invalid for none
+    int m_activeClipPlane;         ///< the one dragging moves, -1 for none
+    bool m_clipCulling;
+    int m_maxClipPlanes;           ///< GL's limit, for planes and box together
+
+    // Measuring
+
+    OsgItemModel *m_model;
+    QList<MeasurePoint> m_measurePoints;
+    MeasurePoint m_hoverPoint;
+    bool m_hovering;               ///< m_hoverPoint is over something
+    int m_snapPixels;              ///< how far from the cursor snapping reaches
+    osg::ref_ptr<osg::Group> m_measureOverlay; ///< the points and lines, over everything
+    osg::ref_ptr<osg::Geometry> m_measureGeometry; ///< m_measureOverlay's only drawable
 
     /// OSG graphics window
-    osg::ref_ptr<osgViewer::GraphicsWindowEmbedded> m_osgGraphicsWindow;
+    osg::ref_ptr<ThreadedGraphicsWindow> m_osgGraphicsWindow;
+
+    /// A draw thread frame has been asked for since the last one started
+    bool m_needFrame;
+
+    QOpenGLTextureBlitter m_blitter;
+
+    CullQuality m_stillQuality;
+    CullQuality m_motionQuality;
+    bool m_moving;
+    QTimer m_motionTimer;
+
+    class FrameTimer;
+    int m_frameTargetMs;
+    float m_degradation;  ///< how far motion quality is lowered, 0 to 1
+    float m_renderScale;  ///< fraction of the resolution drawn at
+    QOpenGLFramebufferObject *m_lowResBuffer;
+    osg::ref_ptr<FrameTimer> m_frameTimer;
+
+    QString m_frameTimeRun;        ///< name of the run, empty when not timing
+    std::vector<double> m_frameTimes; ///< ms of rendering, see FrameTimer
+    std::vector<double> m_lastRunTimes; ///< of the last run that finished, in order
+
+    ViewingCore::CameraPath m_cameraPath;
+    double m_pathStep; ///< seconds of path time per frame played back
+
+    ViewBookmarks m_bookmarks;
+    QString m_bookmarkFile;
+    int m_flythroughStep;          ///< next bookmark to fly to, -1 when not flying
+    double m_flythroughSeconds;    ///< time from one bookmark to the next
+
+    struct FrameHookEntry {
+        FrameHook hook;
+        FrameHookCost cost;
+    };
+    QList<FrameHookEntry> m_frameHooks;
+    int m_nextFrameHookId;
+
+    // Throwing support
+
+    /// Times the mouse moves, in seconds
+    QElapsedTimer m_moveClock;
+    double m_lastMoveTime;
+
+    /// If the button is released within this many ms of the last move, the
+    /// view is thrown
+    int m_throwTimeTolerance;
+
+    /// Time (seconds) for the throw speed to fall to 1/e
+    double m_throwDecay;
+
+    /// Throws slower than this (NDC units per second) stop
+    double m_throwMinimumSpeed;
+
+    osg::Vec2d m_throwVelocity; ///< NDC units per second
+    bool m_throwing;
+    double m_throwTime; ///< frame time of the last throw step, -1 before the first
 
     /// Camera manager
     osg::ref_ptr<ViewingCore> m_viewingCore;
@@ -1,11 +1,28 @@
 #include "OsgItemModel.h"
 #include <QBrush>
+#include <QDataStream>
+#include <QMimeData>
+#include <QSet>
+#include <QSettings>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <osg/ComputeBoundsVisitor>
 #include <osg/Node>
 #include <osg/MatrixTransform>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
-#include <osg/ValueObject>
+#include "ClashDetector.h"
+#include "LodGenerator.h"
+#include "DuplicateFinder.h"
+#include "VertexCacheOptimizer.h"
+#include "VertexCompressor.h"
+#include "TriangleTree.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <deque>
+#include <set>
 
 static bool debugModel = false;
 #define modelDebug if (debugModel) qDebug
@@ -16,15 +33,47 @@ OsgItemModel::OsgItemModel(QObject * parent)
     : QAbstractItemModel(parent)
     , m_root(new osg::Group)
     , m_loadedModel(new osg::MatrixTransform)
-    , m_clipBoard(new osg::Group)
+    , m_rootItem(new Item)
+    , m_memoryTimer(new QTimer(this))
+    , m_memoryPending(false)
+    , m_indexPending(false)
+    , m_triangleTreeBytes(0)
+    , m_triangleTreeLimit(0)
+    , m_macro(0)
+    , m_macroDepth(0)
+    , m_cullMask(~0u)
 {
+    m_rootItem->parent = 0;
+    m_rootItem->object = m_loadedModel.get();
+    m_rootItem->row = -1;
+
     m_root->setName("__root");
     m_loadedModel->setName("__loadedModel");
 
     m_root->addChild(m_loadedModel);
-    m_root->setUserValue("fred", 10);
 
-    m_clipBoard->setName("__clipBoard");
+    // Edits tend to come in bursts, only account once things settle
+    m_memoryTimer->setSingleShot(true);
+    m_memoryTimer->setInterval(250);
+    connect(m_memoryTimer, SIGNAL(timeout()),
+            this, SLOT(startMemoryAccounting()));
+    connect(&m_memoryWatcher, SIGNAL(finished()),
+            this, SLOT(memoryAccountingFinished()));
+    connect(m_memoryTimer, SIGNAL(timeout()),
+            this, SLOT(startIndexing()));
+    connect(&m_indexWatcher, SIGNAL(finished()),
+            this, SLOT(indexingFinished()));
+
+    QSettings settings;
+    m_triangleTreeLimit = (size_t)settings.value("view/pickCacheMB", 256).toUInt() * 1024 * 1024;
+}
+
+OsgItemModel::~OsgItemModel()
+{
+    waitForMemoryAccounting();
+    waitForIndexing();
+    clearItems();
+    delete m_rootItem;
 }
 
 int OsgItemModel::columnCount(const QModelIndex & parent) const
@@ -33,9 +82,9 @@ int OsgItemModel::columnCount(const QModelIndex & parent) const
     if (!parent.isValid()) {
         // looking at root node
         if (m_loadedModel->getNumChildren() > 0)
-            numberOfColumns = 3;
+            numberOfColumns = 4;
     } else {
-        numberOfColumns = 3; // XXX how to tell the real number of columns?
+        numberOfColumns = 4; // XXX how to tell the real number of columns?
     }
 
     modelDebug("columnCount(%d,%d) = %d",
@@ -111,10 +160,47 @@ QVariant OsgItemModel::data(const QModelIndex &index, int role) const
             }
             break;
         }
+        case 3: {
+            MemoryUsage usage;
+            if (getMemoryUsage(object.get(), usage))
+                variant = QVariant(MemoryAccountingVisitor::formatBytes(usage.total()));
+            break;
+        }
         default:
             break;
         }
         break;
+    }
+    case Qt::CheckStateRole: {
+        // Only the cull mask is consulted, so switching layers costs a
+        // repaint of the rows showing and nothing else
+        osg::Node *node = dynamic_cast<osg::Node *>(object.get());
+        if (index.column() == 0 && node)
+            variant = QVariant((node->getNodeMask() & m_cullMask) ? Qt::Checked : Qt::Unchecked);
+        break;
+    }
+    case Qt::ToolTipRole: {
+        MemoryUsage usage;
+        if (index.column() == 3 && getMemoryUsage(object.get(), usage))
+            variant = QVariant(QString("arrays %1\nprimitive sets %2\nimages %3\n"
+                                       "state sets %4\nnodes %5")
+                               .arg(MemoryAccountingVisitor::formatBytes(usage.arrays))
+                               .arg(MemoryAccountingVisitor::formatBytes(usage.primitives))
+                               .arg(MemoryAccountingVisitor::formatBytes(usage.images))
+                               .arg(MemoryAccountingVisitor::formatBytes(usage.stateSets))
+                               .arg(MemoryAccountingVisitor::formatBytes(usage.nodes)));
+        break;
+    }
+    case Qt::UserRole: {
+        // sort key: raw numbers where the display is formatted
+        if (index.column() == 3) {
+            MemoryUsage usage;
+            getMemoryUsage(object.get(), usage);
+            variant = QVariant(usage.total());
+        } else {
+            variant = data(index, Qt::DisplayRole);
+        }
+        break;
     }
      default:
         variant = QVariant();
@@ -136,19 +222,152 @@ Qt::ItemFlags OsgItemModel::flags(const QModelIndex &index) const
         flags |= Qt::ItemIsEditable | Qt::ItemIsSelectable;
     }
 
+    if (index.isValid())
+        flags |= Qt::ItemIsDragEnabled;
+    if (index.column() == 0 && dynamic_cast<osg::Node *>(object.get()))
+        flags |= Qt::ItemIsUserCheckable;
+    if (dynamic_cast<osg::Group *>(object.get()))
+        flags |= Qt::ItemIsDropEnabled;
+
     return flags;
 }
 
 osg::ref_ptr<osg::Object>  OsgItemModel::getObjectFromModelIndex(const QModelIndex &index) const
 {
-    if (index.isValid()) {
-        osg::ref_ptr<osg::Object> obj = static_cast<osg::Node *>(index.internalPointer());
-        if (obj)
-            return obj;
+    return itemFromIndex(index)->object;
+}
+
+static unsigned numChildrenOf(osg::Object *object)
+{
+    if (osg::Geode *geode = dynamic_cast<osg::Geode *>(object))
+        return geode->getNumDrawables();
+    if (osg::Group *group = dynamic_cast<osg::Group *>(object))
+        return group->getNumChildren();
+    return 0;
+}
+
+static osg::Object *childOf(osg::Object *object, unsigned position)
+{
+    if (osg::Geode *geode = dynamic_cast<osg::Geode *>(object))
+        return geode->getDrawable(position);
+    if (osg::Group *group = dynamic_cast<osg::Group *>(object))
+        return group->getChild(position);
+    return 0;
+}
+
+/// Position of child under parent or -1.  Only compares pointers so it is
+/// safe to ask about a child that may since have been deleted.
+static int childPosition(osg::Object *parent, osg::Object *child)
+{
+    unsigned kids = numChildrenOf(parent);
+    for (unsigned i=0 ; i < kids ; i++) {
+        if (childOf(parent, i) == child)
+            return i;
+    }
+    return -1;
+}
+
+OsgItemModel::Item *OsgItemModel::itemFor(Item *parent, osg::Object *object) const
+{
+    QPair<Item *, osg::Object *> key(parent, object);
+
+    Item *item = m_items.value(key, 0);
+    if (!item) {
+        item = new Item;
+        item->parent = parent;
+        item->object = object;
+        item->row = -1;
+        m_items.insert(key, item);
+        m_itemsByObject.insert(object, item);
+        m_parentItems.insert(parent);
+    }
+    return item;
+}
+
+OsgItemModel::Item *OsgItemModel::itemFromIndex(const QModelIndex &index) const
+{
+    if (index.isValid() && index.model() == this && index.internalPointer())
+        return static_cast<Item *>(index.internalPointer());
+
+    return m_rootItem;
+}
+
+QModelIndex OsgItemModel::indexFromItem(Item *item, int column) const
+{
+    if (!item || item == m_rootItem)
+        return QModelIndex();
+
+    int row = itemRow(item);
+    if (row < 0)
+        return QModelIndex();
+
+    return createIndex(row, column, item);
+}
+
+/// Row of item under its parent or -1.  Most edits leave an item where it
+/// was, so the row it was last found at is tried before searching.
+int OsgItemModel::itemRow(Item *item) const
+{
+    osg::Object *parent = item->parent->object;
+    if (item->row >= 0 && (unsigned)item->row < numChildrenOf(parent) &&
+            childOf(parent, item->row) == item->object)
+        return item->row;
+
+    item->row = childPosition(parent, item->object);
+    return item->row;
+}
+
+/// Whether item is still in the tree.  Answers are added to known when it
+/// is given, so that checking many items only looks at each parent once.
+bool OsgItemModel::itemIsLive(Item *item, QHash<Item *, bool> *known) const
+{
+    // Check from the top down so that we only ever look inside objects
+    // already known to be in the tree.
+    QList<Item *> chain;
+    bool live = true;
+    for (Item *i = item ; i != m_rootItem ; i = i->parent) {
+        if (!i) {
+            live = false;
+            break;
+        }
+        if (known && known->contains(i)) {
+            live = known->value(i);
+            break;
+        }
+        chain.prepend(i);
+    }
+
+    foreach (Item *i, chain) {
+        live = live && itemRow(i) >= 0;
+        if (known)
+            known->insert(i, live);
+    }
+    return live;
+}
+
+QList<OsgItemModel::Item *> OsgItemModel::itemsForObject(osg::Object *object) const
+{
+    QList<Item *> items;
+
+    if (object == m_loadedModel.get()) {
+        items << m_rootItem;
+        return items;
+    }
+
+    foreach (Item *item, m_itemsByObject.values(object)) {
+        if (itemIsLive(item))
+            items << item;
     }
-    return m_loadedModel;
+    return items;
 }
 
+void OsgItemModel::clearItems()
+{
+    qDeleteAll(m_items);
+    m_items.clear();
+    m_itemsByObject.clear();
+    m_parentItems.clear();
+}
 
 bool OsgItemModel::hasChildren ( const QModelIndex & parent ) const
 {
@@ -188,6 +407,7 @@ QVariant OsgItemModel::headerData(int section, Qt::Orientation orientation, int
         case 0:  return QVariant(QString("Name"));
         case 1:  return QVariant(QString("Type"));
         case 2:  return QVariant(QString("mask"));
+        case 3:  return QVariant(QString("memory"));
         default: return QVariant(QString("col %1").arg(section));
         }
     }
@@ -196,225 +416,1789 @@ QVariant OsgItemModel::headerData(int section, Qt::Orientation orientation, int
 
 QModelIndex OsgItemModel::index(int row, int column, const QModelIndex &parent) const
 {
-    qDebug("parent row:%d col:%d Valid: %s",
+    modelDebug("parent row:%d col:%d Valid: %s",
            parent.row(), parent.column(), parent.isValid()?"true":"false");
 
-    osg::ref_ptr<osg::Object> parentItem = getObjectFromModelIndex(parent);
+    Item *parentItem = itemFromIndex(parent);
 
-    if (osg::Group *group = dynamic_cast<osg::Group *>(parentItem.get())) {
-        if (group->getNumChildren() > (unsigned)row)
-            return createIndex(row, column, group->getChild(row));
-    } else if (osg::Geode *geode = dynamic_cast<osg::Geode *>(parentItem.get())) {
-        if (geode->getNumDrawables() > (unsigned)row) {
-            return createIndex(row, column, geode->getDrawable(row));
-        }
-    }
+    if (row < 0 || (unsigned)row >= numChildrenOf(parentItem->object))
+        return QModelIndex();
 
-    return QModelIndex();
+    return createIndex(row, column,
+                       itemFor(parentItem, childOf(parentItem->object, row)));
 }
 
 QModelIndex OsgItemModel::modelIndexFromNode(osg::ref_ptr<osg::Node> ptr,
                   int column) const
 {
-    if (!ptr.valid() || ptr == m_loadedModel || ptr->getNumParents() <= 0)
+    if (!ptr.valid() || ptr == m_loadedModel)
+        return QModelIndex();
+
+    // Prefer a place where the node is already showing
+    QList<Item *> items = itemsForObject(ptr.get());
+    if (!items.isEmpty())
+        return indexFromItem(items.first(), column);
+
+    // otherwise follow the first parents up to the loaded model
+    std::vector<osg::Node *> chain;
+    osg::Node *node = ptr.get();
+    while (node && node != m_loadedModel.get()) {
+        chain.push_back(node);
+        node = node->getNumParents() > 0 ? node->getParent(0) : 0;
+    }
+    if (!node)
         return QModelIndex();
 
-    osg::ref_ptr<osg::Group> parent = ptr->getParent(0);
-    int idx = parent->getChildIndex(ptr);
-    return createIndex(idx, column, ptr);
+    Item *item = m_rootItem;
+    for (int i = chain.size()-1 ; i >= 0 ; i--)
+        item = itemFor(item, chain[i]);
+
+    return indexFromItem(item, column);
 }
 
+/// Insert, remove or replace one child of a group.  Only references are
+/// kept, so this is cheap unless it is all that keeps a removed subtree
+/// alive.
+class OsgItemModel::ChildCommand : public UndoCommand
+{
+public:
+    enum Kind { INSERT, REMOVE, REPLACE };
+
+    ChildCommand(OsgItemModel *model, Kind kind, osg::Group *parent, unsigned position,
+                 osg::Node *before, osg::Node *after)
+        : UndoCommand(kind == INSERT ? "Insert" : kind == REMOVE ? "Remove" : "Replace")
+        , m_model(model)
+        , m_kind(kind)
+        , m_parent(parent)
+        , m_position(position)
+        , m_before(before)
+        , m_after(after)
+        , m_cost(0)
+    {
+        // What the last accounting found, from before the edit.  A subtree
+        // not accounted for yet costs nothing rather than a traversal here.
+        osg::Node *dropped = kind == INSERT ? 0 : before;
+        MemoryUsage usage;
+        if (dropped && dropped->getNumParents() == 0 && model->getMemoryUsage(dropped, usage))
+            m_cost = usage.total();
+    }
+
+    void undo() {
+        switch (m_kind) {
+        case INSERT:  m_model->removeChild(m_parent.get(), m_position); break;
+        case REMOVE:  m_model->insertChild(m_parent.get(), m_position, m_before.get()); break;
+        case REPLACE: m_model->replaceChild(m_parent.get(), m_position, m_before.get()); break;
+        }
+    }
+
+    void redo() {
+        switch (m_kind) {
+        case INSERT:  m_model->insertChild(m_parent.get(), m_position, m_after.get()); break;
+        case REMOVE:  m_model->removeChild(m_parent.get(), m_position); break;
+        case REPLACE: m_model->replaceChild(m_parent.get(), m_position, m_after.get()); break;
+        }
+    }
+
+    size_t memoryCost() const { return sizeof(*this) + m_cost; }
+
+private:
+    OsgItemModel *m_model;
+    Kind m_kind;
+    osg::ref_ptr<osg::Group> m_parent;
+    unsigned m_position;
+    osg::ref_ptr<osg::Node> m_before;
+    osg::ref_ptr<osg::Node> m_after;
+    size_t m_cost;
+};
+
+/// One run of adjacent children moved by moveChildren()
+class OsgItemModel::MoveCommand : public UndoCommand
+{
+public:
+    MoveCommand(OsgItemModel *model, osg::Group *source, unsigned first, unsigned count,
+                osg::Group *destination, unsigned position, unsigned at)
+        : UndoCommand("Move")
+        , m_model(model)
+        , m_source(source)
+        , m_first(first)
+        , m_count(count)
+        , m_destination(destination)
+        , m_position(position)
+        , m_at(at)
+    {
+    }
+
+    void undo() {
+        unsigned position = m_first;
+        if (m_source == m_destination && m_first > m_at)
+            position = m_first + m_count;
+
+        m_model->moveChildren(m_destination.get(), m_at, m_count, m_source.get(), position);
+        m_model->sceneEdited(m_source.get());
+        m_model->sceneEdited(m_destination.get());
+    }
+
+    void redo() {
+        m_model->moveChildren(m_source.get(), m_first, m_count, m_destination.get(), m_position);
+        m_model->sceneEdited(m_source.get());
+        m_model->sceneEdited(m_destination.get());
+    }
+
+private:
+    OsgItemModel *m_model;
+    osg::ref_ptr<osg::Group> m_source;
+    unsigned m_first;
+    unsigned m_count;
+    osg::ref_ptr<osg::Group> m_destination;
+    unsigned m_position;
+    unsigned m_at;
+};
+
+/// Name or mask changes.  Changes to the same column made in quick
+/// succession merge, so toggling the masks of many nodes one after the
+/// other undoes in one step.
+class OsgItemModel::ValueCommand : public UndoCommand
+{
+public:
+    ValueCommand(OsgItemModel *model, int column)
+        : UndoCommand(column == 0 ? "Rename" : "Set Mask")
+        , m_model(model)
+        , m_column(column)
+    {
+    }
+
+    void addChange(osg::Object *object, const QVariant &before, const QVariant &after) {
+        QHash<osg::Object *, unsigned>::const_iterator i = m_positions.find(object);
+        if (i != m_positions.end()) {
+            m_changes[i.value()].after = after;
+            return;
+        }
+
+        Change change = { object, before, after };
+        m_positions.insert(object, m_changes.size());
+        m_changes.push_back(change);
+    }
+
+    void undo() {
+        QHash<osg::Object *, QVariant> values;
+        for (unsigned i=0 ; i < m_changes.size() ; i++)
+            values.insert(m_changes[i].object.get(), m_changes[i].before);
+        m_model->setObjectValues(m_column, values);
+    }
+
+    void redo() {
+        QHash<osg::Object *, QVariant> values;
+        for (unsigned i=0 ; i < m_changes.size() ; i++)
+            values.insert(m_changes[i].object.get(), m_changes[i].after);
+        m_model->setObjectValues(m_column, values);
+    }
+
+    int id() const { return m_column; }
+
+    bool mergeWith(const UndoCommand *other) {
+        const ValueCommand *command = dynamic_cast<const ValueCommand *>(other);
+        if (!command || command->m_column != m_column)
+            return false;
+
+        for (unsigned i=0 ; i < command->m_changes.size() ; i++) {
+            const Change &change = command->m_changes[i];
+            addChange(change.object.get(), change.before, change.after);
+        }
+        return true;
+    }
+
+    size_t memoryCost() const {
+        return sizeof(*this) + m_changes.size() * (sizeof(Change) + 2 * sizeof(void *));
+    }
+
+private:
+    struct Change {
+        osg::ref_ptr<osg::Object> object;
+        QVariant before;
+        QVariant after;
+    };
+
+    OsgItemModel *m_model;
+    int m_column;
+    std::vector<Change> m_changes;
+    QHash<osg::Object *, unsigned> m_positions;
+};
+
 void OsgItemModel::insertNode(osg::ref_ptr<osg::Group> parent,
                               osg::ref_ptr<osg::Node> newChild,
-                              int childPositionInParent,
-                              int row)
+                              int childPositionInParent)
 {
     if (!parent.valid()) abort();
 
-    QModelIndex pIndex = this->modelIndexFromNode(parent, 0);
-    beginInsertRows(pIndex, row, row);
-    parent->insertChild(childPositionInParent, newChild);
-    endInsertRows();
+    unsigned position = std::min((unsigned)childPositionInParent, parent->getNumChildren());
+    insertChild(parent, position, newChild);
+    record(new ChildCommand(this, ChildCommand::INSERT, parent, position, 0, newChild));
 }
 
-QModelIndex OsgItemModel::parentOfNode(osg::Node *childNode) const
+void OsgItemModel::insertChild(osg::Group *parent, unsigned position, osg::Node *child)
 {
-    if (childNode == m_loadedModel)
-        return QModelIndex();
-
-    // get the osg parent
-    // XXX this assumes one parent
-    osg::ref_ptr<osg::Group> parent = childNode->getParent(0);
+    aboutToEdit();
+
+    position = std::min(position, parent->getNumChildren());
+
+    QList<Item *> locations = itemsForObject(parent);
+
+    if (locations.size() > 1) {
+        // Qt has no way to announce one change showing up in several
+        // places at once, so have the views start over.
+        beginResetModel();
+        parent->insertChild(position, child);
+        clearItems();
+        endResetModel();
+    } else if (locations.size() == 1) {
+        beginInsertRows(indexFromItem(locations.first(), 0), position, position);
+        parent->insertChild(position, child);
+        endInsertRows();
+    } else {
+        // nobody has looked inside parent yet
+        parent->insertChild(position, child);
+    }
 
-    return modelIndexFromNode(parent, 0);
+    sceneEdited(child);
 }
 
-QModelIndex OsgItemModel::parentOfDrawable(osg::Drawable *childDrawable) const
+void OsgItemModel::removeChild(osg::Group *parent, unsigned position)
 {
-    if (childDrawable->getNumParents() == 0)
-        return QModelIndex();
+    if (position >= parent->getNumChildren())
+        return;
+
+    aboutToEdit();
 
-    osg::ref_ptr<osg::Node> parentNode = childDrawable->getParent(0);
+    QList<Item *> locations = itemsForObject(parent);
 
-    return modelIndexFromNode(parentNode, 0);
+    if (locations.size() > 1) {
+        beginResetModel();
+        parent->removeChild(position);
+        clearItems();
+        endResetModel();
+    } else if (locations.size() == 1) {
+        beginRemoveRows(indexFromItem(locations.first(), 0), position, position);
+        parent->removeChild(position);
+        endRemoveRows();
+    } else {
+        parent->removeChild(position);
+    }
+
+    sceneEdited(parent);
 }
 
+void OsgItemModel::replaceNode(osg::ref_ptr<osg::Group> parent,
+                               osg::ref_ptr<osg::Node> oldChild,
+                               osg::ref_ptr<osg::Node> newChild)
+{
+    if (!parent.valid()) abort();
+
+    unsigned position = parent->getChildIndex(oldChild);
+    if (position >= parent->getNumChildren())
+        return;
 
-QModelIndex OsgItemModel::parent(const QModelIndex &index) const
+    replaceChild(parent, position, newChild);
+    record(new ChildCommand(this, ChildCommand::REPLACE, parent, position, oldChild, newChild));
+}
+
+void OsgItemModel::replaceChild(osg::Group *parent, unsigned position, osg::Node *child)
 {
-    if (! index.isValid())
-        return QModelIndex();
+    if (position >= parent->getNumChildren())
+        return;
 
-    osg::ref_ptr<osg::Object> childObject = getObjectFromModelIndex(index);
+    aboutToEdit();
 
-    if (osg::Node *node = dynamic_cast<osg::Node *>(childObject.get()))
-        return parentOfNode(node);
+    osg::ref_ptr<osg::Node> old = parent->getChild(position);
+    QList<Item *> locations = itemsForObject(parent);
 
-    osg::Drawable *drawable = dynamic_cast<osg::Drawable *>(childObject.get());
-    if (!drawable) {
-        abort();
+    // The row stays where it is, only the object behind it changes
+    emit layoutAboutToBeChanged();
+
+    parent->setChild(position, child);
+
+    QHash<Item *, Item *> replaced;
+    foreach (Item *location, locations) {
+        Item *oldItem = m_items.value(qMakePair(location, (osg::Object *)old.get()), 0);
+        if (oldItem)
+            replaced.insert(oldItem, itemFor(location, child));
+    }
+
+    foreach (const QModelIndex &persistent, persistentIndexList()) {
+        QList<Item *> chain;
+        for (Item *i = itemFromIndex(persistent) ; i && i != m_rootItem ; i = i->parent)
+            chain.prepend(i);
+
+        for (int i=0 ; i < chain.size() ; i++) {
+            if (!replaced.contains(chain[i]))
+                continue;
+
+            // whatever was open beneath the old child went with it
+            if (i == chain.size()-1)
+                changePersistentIndex(persistent, createIndex(persistent.row(),
+                                                              persistent.column(),
+                                                              replaced.value(chain[i])));
+            else
+                changePersistentIndex(persistent, QModelIndex());
+            break;
+        }
     }
-    return parentOfDrawable(drawable);
+
+    emit layoutChanged();
+    sceneEdited(child);
 }
 
-void OsgItemModel::printNode(osg::ref_ptr<osg::Node> n, const int level) const
+unsigned OsgItemModel::moveChildren(osg::Group *source, unsigned first, unsigned count,
+                                    osg::Group *destination, unsigned position)
 {
-    modelDebug("%*s%s  %s\n", level, "", n->getName().c_str(), qPrintable(maskToString(n->getNodeMask())));
+    aboutToEdit();
+
+    const unsigned last = first + count - 1;
+
+    // position is counted before the move, as for beginMoveRows()
+    unsigned at = position;
+    if (source == destination && position > last)
+        at -= count;
+
+    std::vector< osg::ref_ptr<osg::Node> > nodes;
+    for (unsigned i = first ; i <= last ; i++)
+        nodes.push_back(source->getChild(i));
+
+    QList<Item *> sourceLocations = itemsForObject(source);
+    QList<Item *> destinationLocations = itemsForObject(destination);
+
+    if (sourceLocations.size() > 1 || destinationLocations.size() > 1) {
+        // Qt can't announce one change showing up in several places
+        beginResetModel();
+        source->removeChildren(first, count);
+        for (unsigned i=0 ; i < count ; i++)
+            destination->insertChild(at+i, nodes[i].get());
+        clearItems();
+        endResetModel();
+        return at;
+    }
 
-    osg::ref_ptr<osg::Group> g = n->asGroup();
-    if (g) {
-        int kids = g->getNumChildren();
-        for (int kid=0 ; kid < kids ; kid++) {
-            osg::ref_ptr<osg::Node> child = g->getChild(kid);
-            printNode(child, level+2);
+    Item *sourceItem = sourceLocations.value(0, 0);
+    Item *destinationItem = destinationLocations.value(0, 0);
+
+    QHash<Item *, Item *> moved;
+    if (sourceItem && destinationItem) {
+        for (unsigned i=0 ; i < count ; i++) {
+            Item *old = m_items.value(qMakePair(sourceItem, (osg::Object *)nodes[i].get()), 0);
+            if (old)
+                moved.insert(old, 0);
         }
-        return;
     }
+
+    if (sourceItem && destinationItem &&
+            beginMoveRows(indexFromItem(sourceItem, 0), first, last,
+                          indexFromItem(destinationItem, 0), position)) {
+        source->removeChildren(first, count);
+        for (unsigned i=0 ; i < count ; i++)
+            destination->insertChild(at+i, nodes[i].get());
+        endMoveRows();
+
+        // Qt moves the rows themselves, anything open beneath them
+        // has to be pointed at its new parent
+        foreach (Item *old, moved.keys())
+            moved[old] = itemFor(destinationItem, old->object);
+        replacePersistentItems(moved);
+    } else {
+        if (sourceItem)
+            beginRemoveRows(indexFromItem(sourceItem, 0), first, last);
+        source->removeChildren(first, count);
+        if (sourceItem)
+            endRemoveRows();
+
+        if (destinationItem)
+            beginInsertRows(indexFromItem(destinationItem, 0), at, at+count-1);
+        for (unsigned i=0 ; i < count ; i++)
+            destination->insertChild(at+i, nodes[i].get());
+        if (destinationItem)
+            endInsertRows();
+    }
+
+    return at;
 }
 
-QString OsgItemModel::maskToString(const osg::Node::NodeMask mask) const
+void OsgItemModel::record(UndoCommand *command)
 {
-    QString maskString = QString::asprintf("%08x", (unsigned)mask);
-    modelDebug("maskToString %s", qPrintable(maskString));
-    return maskString;
+    if (m_macro)
+        m_macro->addChild(command);
+    else
+        m_undoStack.push(command);
 }
-void OsgItemModel::printTree() const
+
+void OsgItemModel::beginMacro(const QString &text)
 {
-    printNode(m_loadedModel, 2);
+    if (m_macroDepth++ == 0)
+        m_macro = new UndoCommand(text);
 }
 
-
-int OsgItemModel::rowCount(const QModelIndex &parent) const
+void OsgItemModel::endMacro()
 {
-    osg::ref_ptr<osg::Object> object = getObjectFromModelIndex(parent);
-    int kids = 0;
+    if (--m_macroDepth > 0)
+        return;
 
-    if (osg::Group *group = dynamic_cast<osg::Group *>(object.get())) {
-        kids = group->getNumChildren();
-    } else if (osg::Geode *geode = dynamic_cast<osg::Geode *>(object.get())) {
-        kids = geode->getNumDrawables();
+    UndoCommand *macro = m_macro;
+    m_macro = 0;
+
+    if (macro->childCount() == 1) {
+        // pushed on its own so that it can merge with its neighbours
+        UndoCommand *command = macro->takeChild(0);
+        command->setText(macro->text());
+        m_undoStack.push(command);
+        delete macro;
+    } else if (macro->childCount() > 1) {
+        m_undoStack.push(macro);
+    } else {
+        delete macro;
     }
-
-    modelDebug("rowCount %d %d %s == %d\n",
-           parent.row(),
-           parent.column(),
-           object->getName().c_str(), kids);
-
-    return kids;
 }
 
-bool OsgItemModel::setObjectName(const QModelIndex & index,
-                   const QVariant & value)
+/// true if node is ancestor or one of its parents, grandparents, ...
+static bool isAncestorOf(osg::Node *node, osg::Node *descendant)
 {
-    getObjectFromModelIndex(index)->setName(qPrintable(value.toString()));
-    return true;
+    std::vector<osg::Node *> pending(1, descendant);
+    std::set<osg::Node *> visited;
+    while (!pending.empty()) {
+        osg::Node *n = pending.back();
+        pending.pop_back();
+        if (n == node)
+            return true;
+        if (!visited.insert(n).second)
+            continue;
+
+        for (unsigned p=0 ; p < n->getNumParents() ; p++)
+            pending.push_back(n->getParent(p));
+    }
+    return false;
 }
-bool OsgItemModel::setObjectMask(const QModelIndex & index,
-                   const QVariant & value)
+
+/// Drawables only go in Geodes, and Geodes only hold Drawables
+static bool canHold(osg::Group *group, osg::Node *child)
 {
-    bool ok = false;
-    osg::ref_ptr<osg::Object> object = getObjectFromModelIndex(index);
-    if (osg::Node *node = dynamic_cast<osg::Node *>(object.get())) {
+    return (group->asGeode() != 0) == (dynamic_cast<osg::Drawable *>(child) != 0);
+}
 
-        int number = value.toString().toUInt(&ok, 16);
-        if (ok) {
-            node->setNodeMask(number);
-        } else {
-            qDebug("set mask: %s %d", qPrintable(value.toString()), number);
-        }
-    }
-    return ok;
+static const char *nodeMimeType = "application/x-osgtree-nodes";
+
+QStringList OsgItemModel::mimeTypes() const
+{
+    return QStringList(nodeMimeType);
 }
 
-bool OsgItemModel::setData(const QModelIndex & index,
-                           const QVariant & value,
-                           int role )
+Qt::DropActions OsgItemModel::supportedDropActions() const
 {
-    qDebug("setData(%d %d %s) = \"%s\"",
-           index.row(), index.column(),
-           qPrintable(stringFromRole(role)),
-           qPrintable(value.toString()));
+    // a copy is a shared reference, the same as paste()
+    return Qt::MoveAction | Qt::CopyAction;
+}
 
-    if (role != Qt::EditRole || value.toString().size() <= 0)
-        return false;
+QList<int> OsgItemModel::rowPath(Item *item) const
+{
+    QList<int> rows;
+    for (Item *i = item ; i != m_rootItem ; i = i->parent)
+        rows.prepend(itemRow(i));
+    return rows;
+}
 
-    bool dataWasSet = false;
+QMimeData *OsgItemModel::mimeData(const QModelIndexList &indexes) const
+{
+    QSet<Item *> selected;
+    foreach (const QModelIndex &index, indexes) {
+        if (index.isValid())
+            selected << itemFromIndex(index);
+    }
 
-    switch (index.column()) {
-    case 0: dataWasSet = setObjectName(index, value); break;
-    case 2: dataWasSet = setObjectMask(index, value); break;
-    default:
-        break;
+    // Items are only good for this model, so record the way to them from
+    // the top and check it still leads to the same object on the drop.
+    QByteArray encoded;
+    QDataStream stream(&encoded, QIODevice::WriteOnly);
+    stream << quint64(quintptr(this));
+
+    foreach (Item *item, selected) {
+        // taking an ancestor along already brings this one
+        bool covered = false;
+        for (Item *i = item->parent ; i != m_rootItem && !covered ; i = i->parent)
+            covered = selected.contains(i);
+        if (covered)
+            continue;
+
+        stream << quint64(quintptr(item->object)) << rowPath(item);
     }
 
-    if (dataWasSet)
-        emit dataChanged(index, index);
+    QMimeData *data = new QMimeData;
+    data->setData(nodeMimeType, encoded);
+    return data;
+}
+
+QList<OsgItemModel::Item *> OsgItemModel::itemsFromMimeData(const QMimeData *data) const
+{
+    QList<Item *> items;
+
+    QByteArray encoded = data->data(nodeMimeType);
+    QDataStream stream(&encoded, QIODevice::ReadOnly);
+
+    quint64 model = 0;
+    stream >> model;
+    if (model != quint64(quintptr(this)))
+        return items;
+
+    while (!stream.atEnd()) {
+        quint64 object = 0;
+        QList<int> rows;
+        stream >> object >> rows;
+
+        Item *item = m_rootItem;
+        foreach (int row, rows) {
+            if (row < 0 || (unsigned)row >= numChildrenOf(item->object)) {
+                item = 0;
+                break;
+            }
+            item = itemFor(item, childOf(item->object, row));
+        }
 
-    return dataWasSet;
+        if (item && item != m_rootItem && quint64(quintptr(item->object)) == object)
+            items << item;
+    }
+    return items;
 }
 
-void OsgItemModel::importFileByName(const QString fileName)
+bool OsgItemModel::dropMimeData(const QMimeData *data,
+                                Qt::DropAction action,
+                                int row,
+                                int column,
+                                const QModelIndex &parent)
 {
-    osg::Node *loaded = osgDB::readNodeFile(fileName.toStdString());
+    Q_UNUSED(column);
 
+    if (action == Qt::IgnoreAction)
+        return true;
+    if (!data->hasFormat(nodeMimeType))
+        return false;
 
-    if (!loaded)
-        return;
+    osg::Group *group = dynamic_cast<osg::Group *>(itemFromIndex(parent)->object);
+    if (!group)
+        return false;
 
+    unsigned position = row < 0 ? group->getNumChildren() : row;
 
-    if (loaded->getName().size() == 0)
-        loaded->setName(basename(qPrintable(fileName)));
+    QList<Item *> items;
+    foreach (Item *item, itemsFromMimeData(data)) {
+        osg::Node *node = dynamic_cast<osg::Node *>(item->object);
+        if (node && canHold(group, node) && !isAncestorOf(node, group))
+            items << item;
+    }
+    if (items.isEmpty())
+        return false;
+    if (action != Qt::CopyAction && action != Qt::MoveAction)
+        return false;
 
-    int childNumber = m_loadedModel->getNumChildren();
-    loaded->setUserValue("childIndex", childNumber);
+    beginMacro(action == Qt::CopyAction ? "Copy" : "Move");
+
+    // Change only the groups at these places, not every place they show.
+    // The dragged nodes themselves stay the same objects, so looking them
+    // up again finds them beneath any copies made.
+    group = dynamic_cast<osg::Group *>(getObjectFromModelIndex(unshare(parent)).get());
+    if (action == Qt::MoveAction) {
+        QList<QPersistentModelIndex> sources;
+        foreach (Item *item, items)
+            sources << QPersistentModelIndex(indexFromItem(item->parent, 0));
+        foreach (const QPersistentModelIndex &source, sources)
+            unshare(source);
+
+        QSet<osg::Object *> wanted;
+        foreach (Item *item, items)
+            wanted << item->object;
+        items.clear();
+        foreach (Item *item, itemsFromMimeData(data)) {
+            if (wanted.contains(item->object))
+                items << item;
+        }
+    }
 
-    if (childNumber == 0) {
-        beginInsertColumns(createIndex(-1, -1), 1, 2);
-        insertNode(m_loadedModel, loaded, m_loadedModel->getNumChildren(), 0);
-        endInsertColumns();
+    if (action == Qt::CopyAction) {
+        foreach (Item *item, items) {
+            osg::Node *node = dynamic_cast<osg::Node *>(item->object);
+            position = std::min(position, group->getNumChildren());
+            insertChild(group, position, node);
+            record(new ChildCommand(this, ChildCommand::INSERT, group, position, 0, node));
+            position++;
+        }
     } else {
-        insertNode(m_loadedModel, loaded, m_loadedModel->getNumChildren(), 0);
+        // The view will call removeRows() for a move, which is left at the
+        // default (refuse) since moveItems() already took them out.
+        moveItems(items, group, position);
     }
+
+    endMacro();
+    return true;
 }
 
-bool OsgItemModel::saveToFileByName(const QString fileName)
+/// Where the whole sequence nodes sits in group, or -1
+static int findRun(osg::Group *group, const std::vector< osg::ref_ptr<osg::Node> > &nodes)
 {
-    if (m_loadedModel->getNumChildren() == 1) {
-        return osgDB::writeNodeFile(*m_loadedModel->getChild(0), qPrintable(fileName));
+    if (nodes.empty() || nodes.size() > group->getNumChildren())
+        return -1;
+
+    for (unsigned start=0 ; start + nodes.size() <= group->getNumChildren() ; start++) {
+        unsigned i = 0;
+        while (i < nodes.size() && group->getChild(start+i) == nodes[i].get())
+            i++;
+        if (i == nodes.size())
+            return start;
     }
+    return -1;
+}
 
-    osg::Group *writeGroup = new osg::Group(*m_loadedModel);
-    writeGroup->setName(qPrintable(fileName));
-    return osgDB::writeNodeFile(*writeGroup, fileName.toStdString().c_str());
+static bool byRowPath(const QPair<QList<int>, void *> &a, const QPair<QList<int>, void *> &b)
+{
+    return a.first < b.first;
 }
 
-static QString stringFromRole(const int role)
+void OsgItemModel::moveItems(const QList<Item *> &items, osg::Group *destination, unsigned position)
 {
-    switch (role) {
-    case Qt::DisplayRole: return QString("DisplayRole"); break;
-    case Qt::DecorationRole: return QString("DecorationRole"); break;
-    case Qt::EditRole: return QString("EditRole"); break;
-    case Qt::ToolTipRole: return QString("ToolTipRole"); break;
+    aboutToEdit();
+
+    // keep the order they have in the tree
+    QList< QPair<QList<int>, void *> > ordered;
+    foreach (Item *item, items)
+        ordered << qMakePair(rowPath(item), (void *)item);
+    std::sort(ordered.begin(), ordered.end(), byRowPath);
+
+    // Adjacent rows under the same parent move as one run, so a large
+    // selection costs a handful of notifications rather than one each.
+    struct Run {
+        osg::Group *source;
+        std::vector< osg::ref_ptr<osg::Node> > nodes;
+    };
+    std::deque<Run> runs;
+    Item *lastParent = 0;
+    int lastRow = -2;
+    for (int i=0 ; i < ordered.size() ; i++) {
+        Item *item = static_cast<Item *>(ordered[i].second);
+        int row = ordered[i].first.last();
+        if (item->parent != lastParent || row != lastRow+1) {
+            Run run;
+            run.source = dynamic_cast<osg::Group *>(item->parent->object);
+            runs.push_back(run);
+        }
+        runs.back().nodes.push_back(dynamic_cast<osg::Node *>(item->object));
+        lastParent = item->parent;
+        lastRow = row;
+    }
+
+    std::set<osg::Group *> groups;
+    groups.insert(destination);
+
+    beginMacro("Move");
+
+    while (!runs.empty()) {
+        Run run = runs.front();
+        runs.pop_front();
+
+        osg::Group *source = run.source;
+        const unsigned count = run.nodes.size();
+        groups.insert(source);
+
+        // an earlier run may have landed in the middle of this one
+        int first = findRun(source, run.nodes);
+        if (first < 0) {
+            for (int i = count-1 ; i >= 0 ; i--) {
+                Run single;
+                single.source = source;
+                single.nodes.push_back(run.nodes[i]);
+                if (findRun(source, single.nodes) >= 0)
+                    runs.push_front(single);
+            }
+            continue;
+        }
+        const int last = first + count - 1;
+
+        // dropped onto itself
+        if (source == destination && (int)position >= first && (int)position <= last+1) {
+            position = last + 1;
+            continue;
+        }
+
+        unsigned at = moveChildren(source, first, count, destination, position);
+        record(new MoveCommand(this, source, first, count, destination, position, at));
+
+        position = at + count;
+    }
+
+    endMacro();
+
+    for (std::set<osg::Group *>::iterator g = groups.begin() ; g != groups.end() ; ++g)
+        markFilesDirty(*g);
+    emit sceneChanged();
+}
+
+void OsgItemModel::copy(const QModelIndex &index)
+{
+    Item *item = itemFromIndex(index);
+    if (item == m_rootItem)
+        return;
+
+    osg::Node *node = dynamic_cast<osg::Node *>(item->object);
+    if (!node)
+        return;
+
+    m_clipBoard.clear();
+    m_clipBoard.push_back(node);
+}
+
+void OsgItemModel::cut(const QModelIndex &index)
+{
+    if (itemFromIndex(index) == m_rootItem)
+        return;
+
+    beginMacro("Cut");
+
+    // take it out of this place only, not every place the parent shows
+    QModelIndex parentIndex = unshare(index.parent());
+    Item *item = itemFromIndex(this->index(index.row(), 0, parentIndex));
+
+    osg::Group *parent = item == m_rootItem ? 0 :
+            dynamic_cast<osg::Group *>(item->parent->object);
+    int position = parent ? childPosition(parent, item->object) : -1;
+    if (position < 0) {
+        endMacro();
+        return;
+    }
+
+    copy(indexFromItem(item, 0));
+    removeChild(parent, position);
+    record(new ChildCommand(this, ChildCommand::REMOVE, parent, position,
+                            m_clipBoard.front().get(), 0));
+    endMacro();
+}
+
+void OsgItemModel::paste(const QModelIndex &index)
+{
+    Item *item = itemFromIndex(index);
+
+    // onto a group goes at the end, onto anything else goes after it
+    osg::Group *group = dynamic_cast<osg::Group *>(item->object);
+    bool onto = group && (!group->asGeode() || m_clipBoard.empty() ||
+                          dynamic_cast<osg::Drawable *>(m_clipBoard.front().get()));
+    if (!onto && item == m_rootItem)
+        return;
+
+    beginMacro("Paste");
+
+    // add to this place only, not every place the group shows
+    unsigned position = 0;
+    if (onto) {
+        group = dynamic_cast<osg::Group *>(getObjectFromModelIndex(unshare(index)).get());
+        position = group->getNumChildren();
+    } else {
+        group = dynamic_cast<osg::Group *>(getObjectFromModelIndex(unshare(index.parent())).get());
+        position = index.row() + 1;
+    }
+    if (!group) {
+        endMacro();
+        return;
+    }
+
+    position = std::min(position, group->getNumChildren());
+
+    for (unsigned i=0 ; i < m_clipBoard.size() ; i++) {
+        osg::Node *node = m_clipBoard[i].get();
+
+        // a node pasted inside itself would make a cycle
+        if (!canHold(group, node) || isAncestorOf(node, group)) {
+            modelDebug("can't paste %s into %s",
+                       node->getName().c_str(), group->getName().c_str());
+            continue;
+        }
+        insertChild(group, position, node);
+        record(new ChildCommand(this, ChildCommand::INSERT, group, position, 0, node));
+        position++;
+    }
+
+    endMacro();
+}
+
+/// Point persistent indexes at or beneath the old items of replaced at the
+/// matching new items.  Rows do not change, only the path to them does.
+/// Beneath a replaced item the objects are the same ones unless copies
+/// says what each became.
+void OsgItemModel::replacePersistentItems(const QHash<Item *, Item *> &replaced,
+                                          const QHash<osg::Object *, osg::Object *> &copies)
+{
+    foreach (const QModelIndex &persistent, persistentIndexList()) {
+        QList<Item *> chain;
+        for (Item *i = itemFromIndex(persistent) ; i && i != m_rootItem ; i = i->parent)
+            chain.prepend(i);
+
+        int first = 0;
+        while (first < chain.size() && !replaced.contains(chain[first]))
+            first++;
+        if (first == chain.size())
+            continue;
+
+        Item *newItem = replaced.value(chain[first]);
+        for (int i = first+1 ; i < chain.size() ; i++)
+            newItem = replaced.value(chain[i],
+                                     itemFor(newItem, copies.value(chain[i]->object,
+                                                                   chain[i]->object)));
+
+        changePersistentIndex(persistent,
+                              createIndex(persistent.row(), persistent.column(), newItem));
+    }
+}
+
+/// Make the node at index safe to edit on its own.
+///
+/// A node reached through a shared node (one with several parents, as left
+/// by paste()) is really in several places at once.  The nodes on the path
+/// from the first shared one down to index are copied, shallowly, so only
+/// this place changes.  Everything hanging off that path, arrays included,
+/// stays shared.  Returns the index to edit, which is index itself if no
+/// copy was needed.
+QModelIndex OsgItemModel::unshare(const QModelIndex &index)
+{
+    Item *item = itemFromIndex(index);
+
+    QList<Item *> path;
+    for (Item *i = item ; i != m_rootItem ; i = i->parent)
+        path.prepend(i);
+
+    int first = -1;
+    for (int i=0 ; i < path.size() && first < 0 ; i++) {
+        osg::Node *node = dynamic_cast<osg::Node *>(path[i]->object);
+        if (node && node->getNumParents() > 1)
+            first = i;
+    }
+    if (first < 0)
+        return index;
+
+    aboutToEdit();
+
+    std::vector< osg::ref_ptr<osg::Node> > copies(path.size());
+    for (int i = path.size()-1 ; i >= first ; i--) {
+        osg::Node *original = dynamic_cast<osg::Node *>(path[i]->object);
+        copies[i] = dynamic_cast<osg::Node *>(original->clone(osg::CopyOp::SHALLOW_COPY));
+
+        if (i+1 < path.size())
+            copies[i]->asGroup()->setChild(childPosition(original, path[i+1]->object),
+                                           copies[i+1].get());
+    }
+
+    osg::Group *parent = dynamic_cast<osg::Group *>(path[first]->parent->object);
+    int position = childPosition(parent, path[first]->object);
+
+    // The rows stay put, only the objects behind them change
+    emit layoutAboutToBeChanged();
+
+    parent->setChild(position, copies[first].get());
+    record(new ChildCommand(this, ChildCommand::REPLACE, parent, position,
+                            dynamic_cast<osg::Node *>(path[first]->object),
+                            copies[first].get()));
+
+    QHash<Item *, Item *> replaced;
+    Item *newItem = path[first]->parent;
+    for (int i = first ; i < path.size() ; i++) {
+        newItem = itemFor(newItem, copies[i].get());
+        replaced.insert(path[i], newItem);
+    }
+    replacePersistentItems(replaced);
+
+    emit layoutChanged();
+    sceneEdited(copies[first].get());
+
+    return indexFromItem(newItem, index.column());
+}
+
+namespace {
+
+/// A deep copy that copies each node, drawable, array and primitive set
+/// (as far as the flags go) once, so whatever is instanced in several
+/// places inside the subtree is instanced the same way in the copy.
+class SubtreeCopy : public osg::CopyOp
+{
+public:
+    SubtreeCopy(osg::CopyOp::CopyFlags flags) : osg::CopyOp(flags) {}
+
+    virtual osg::Node *operator()(const osg::Node *node) const
+    {
+        if (node && node->asDrawable())
+            return (*this)(node->asDrawable());
+        return once(node, [&]() { return osg::CopyOp::operator()(node); });
+    }
+    virtual osg::Drawable *operator()(const osg::Drawable *drawable) const
+    {
+        return once(drawable, [&]() { return osg::CopyOp::operator()(drawable); });
+    }
+    virtual osg::Array *operator()(const osg::Array *array) const
+    {
+        return once(array, [&]() { return osg::CopyOp::operator()(array); });
+    }
+    virtual osg::PrimitiveSet *operator()(const osg::PrimitiveSet *primitives) const
+    {
+        return once(primitives, [&]() { return osg::CopyOp::operator()(primitives); });
+    }
+
+    /// what each node and drawable copied became
+    const QHash<osg::Object *, osg::Object *> &copies() const { return m_copies; }
+
+private:
+    template <class T, class Copy>
+    T *once(const T *original, Copy copy) const
+    {
+        if (!original)
+            return 0;
+
+        osg::Object *key = const_cast<T *>(original);
+        if (osg::Object *done = m_copies.value(key, 0))
+            return static_cast<T *>(done);
+
+        T *result = copy();
+        m_copies.insert(key, result);
+        return result;
+    }
+
+    mutable QHash<osg::Object *, osg::Object *> m_copies;
+};
+
+}
+
+/// Make the whole subtree at index safe to edit on its own.
+///
+/// unshare() only takes care of the path down to index; nodes beneath it
+/// may still hang under parents elsewhere too (beneath a pasted group,
+/// everything does).  If any do, the subtree is replaced by a SubtreeCopy
+/// of it, as deep as copyFlags say the edit reaches.  Sharing wholly
+/// inside the subtree is left alone, editing every instance there is what
+/// an edit of the subtree means.
+QModelIndex OsgItemModel::unshareSubtree(const QModelIndex &index, unsigned copyFlags)
+{
+    QModelIndex target = unshare(index);
+
+    Item *item = itemFromIndex(target);
+    if (item == m_rootItem)
+        return target;
+
+    // held here, the parent may let go of it before the command has it
+    osg::ref_ptr<osg::Node> top = dynamic_cast<osg::Node *>(item->object);
+    osg::Group *parent = dynamic_cast<osg::Group *>(item->parent->object);
+    if (!top.valid() || !parent)
+        return target;
+
+    // A node unshare() just copied still shares all it holds with the
+    // original.  Otherwise count the links into each node from inside the
+    // subtree; any more parents than that and the node shows somewhere
+    // else as well.
+    bool shared = item->object != itemFromIndex(index)->object;
+    QHash<osg::Node *, unsigned> links;
+    std::vector<osg::Node *> pending(1, top.get());
+    while (!pending.empty()) {
+        osg::Group *group = pending.back()->asGroup();
+        pending.pop_back();
+        if (!group)
+            continue;
+        for (unsigned i=0 ; i < group->getNumChildren() ; i++) {
+            if (links[group->getChild(i)]++ == 0)
+                pending.push_back(group->getChild(i));
+        }
+    }
+
+    for (QHash<osg::Node *, unsigned>::const_iterator i = links.begin() ;
+         i != links.end() && !shared ; ++i)
+        shared = i.key()->getNumParents() > i.value();
+    if (!shared)
+        return target;
+
+    aboutToEdit();
+
+    SubtreeCopy copyOp(copyFlags);
+    osg::ref_ptr<osg::Node> copy = copyOp(top.get());
+    int position = target.row();
+
+    emit layoutAboutToBeChanged();
+
+    parent->setChild(position, copy.get());
+    record(new ChildCommand(this, ChildCommand::REPLACE, parent, position,
+                            top.get(), copy.get()));
+
+    QHash<Item *, Item *> replaced;
+    Item *newItem = itemFor(item->parent, copy.get());
+    replaced.insert(item, newItem);
+    replacePersistentItems(replaced, copyOp.copies());
+
+    emit layoutChanged();
+    sceneEdited(copy.get());
+
+    return indexFromItem(newItem, target.column());
+}
+
+/// for edits that rewrite the arrays or primitive sets of the geometry
+static const unsigned geometryCopy = osg::CopyOp::DEEP_COPY_NODES |
+        osg::CopyOp::DEEP_COPY_DRAWABLES |
+        osg::CopyOp::DEEP_COPY_ARRAYS |
+        osg::CopyOp::DEEP_COPY_PRIMITIVES;
+
+void OsgItemModel::generateLod(const QModelIndex &index)
+{
+    if (!dynamic_cast<osg::Node *>(getObjectFromModelIndex(index).get()))
+        return;
+
+    aboutToEdit();
+
+    beginMacro("Generate LOD");
+
+    // the geodes are swapped for LODs in every parent they have, so those
+    // had better all be beneath index
+    osg::ref_ptr<osg::Node> node = dynamic_cast<osg::Node *>(getObjectFromModelIndex(
+                unshareSubtree(index, osg::CopyOp::DEEP_COPY_NODES)).get());
+
+    LodGenerator generator;
+    std::vector<LodGenerator::Replacement> replacements = generator.generate(node);
+
+    for (unsigned i=0 ; i < replacements.size() ; i++) {
+        const LodGenerator::Replacement &r = replacements[i];
+
+        // the geode is already a child of the new LOD, leave that one alone
+        osg::Node::ParentList parents = r.geode->getParents();
+        for (unsigned p=0 ; p < parents.size() ; p++) {
+            if (parents[p] != r.lod.get())
+                replaceNode(parents[p], r.geode, r.lod);
+        }
+    }
+
+    endMacro();
+}
+
+void OsgItemModel::findDuplicates(const QModelIndex &index)
+{
+    osg::ref_ptr<osg::Node> node =
+            dynamic_cast<osg::Node *>(getObjectFromModelIndex(index).get());
+    if (!node.valid())
+        return;
+
+    DuplicateFinder finder;
+    finder.analyze(node);
+
+    setAnalysis(node, "Geometries", finder.getNumGeometries());
+    setAnalysis(node, "DuplicateGeometries", finder.getNumDuplicates());
+    setAnalysis(node, "DuplicateSavings",
+                QString::asprintf("%llu bytes", finder.getPotentialSavings()));
+}
+
+void OsgItemModel::shareDuplicates(const QModelIndex &index)
+{
+    osg::ref_ptr<osg::Node> node =
+            dynamic_cast<osg::Node *>(getObjectFromModelIndex(index).get());
+    if (!node.valid())
+        return;
+
+    aboutToEdit();
+
+    DuplicateFinder finder;
+    finder.analyze(node);
+
+    if (finder.getReplacements().empty())
+        return;
+
+    // Even a copied subtree keeps the same drawables, which may sit in
+    // geodes outside it too; only the geodes beneath node are changed.
+    beginMacro("Share Duplicates");
+    node = dynamic_cast<osg::Node *>(getObjectFromModelIndex(
+                unshareSubtree(index, osg::CopyOp::DEEP_COPY_NODES)).get());
+
+    std::set<osg::Node *> beneath;
+    std::vector<osg::Node *> pending(1, node.get());
+    while (!pending.empty()) {
+        osg::Node *next = pending.back();
+        pending.pop_back();
+        if (!beneath.insert(next).second || !next->asGroup())
+            continue;
+        for (unsigned i=0 ; i < next->asGroup()->getNumChildren() ; i++)
+            pending.push_back(next->asGroup()->getChild(i));
+    }
+
+    const std::vector<DuplicateFinder::Replacement> &replacements = finder.getReplacements();
+
+    // Rows stay where they are but the objects behind them change, so
+    // this is a layout change rather than a remove/insert per geode.
+    emit layoutAboutToBeChanged();
+
+    QHash<osg::Object *, osg::Object *> replaced;
+    for (unsigned i=0 ; i < replacements.size() ; i++) {
+        osg::Geometry *duplicate = replacements[i].first.get();
+        osg::Geometry *shared = replacements[i].second.get();
+
+        osg::Drawable::ParentList parents = duplicate->getParents();
+        for (unsigned p=0 ; p < parents.size() ; p++) {
+            osg::Geode *geode = parents[p]->asGeode();
+            if (!geode || !beneath.count(geode))
+                continue;
+
+            unsigned position = geode->getDrawableIndex(duplicate);
+            geode->replaceDrawable(duplicate, shared);
+            record(new ChildCommand(this, ChildCommand::REPLACE, geode, position,
+                                    duplicate, shared));
+        }
+        replaced.insert(duplicate, shared);
+    }
+
+    foreach (const QModelIndex &persistent, persistentIndexList()) {
+        Item *item = itemFromIndex(persistent);
+        if (item == m_rootItem || !replaced.contains(item->object) ||
+                !beneath.count(dynamic_cast<osg::Node *>(item->parent->object)))
+            continue;
+
+        Item *newItem = itemFor(item->parent, replaced.value(item->object));
+        changePersistentIndex(persistent,
+                              createIndex(persistent.row(), persistent.column(), newItem));
+    }
+
+    endMacro();
+    emit layoutChanged();
+    sceneEdited(node);
+
+    setAnalysis(node, "Geometries", finder.getNumGeometries() - finder.getNumDuplicates());
+    setAnalysis(node, "DuplicateGeometries", 0);
+    setAnalysis(node, "DuplicateSavings", QString("0 bytes"));
+}
+
+void OsgItemModel::optimizeVertexCache(const QModelIndex &index)
+{
+    osg::ref_ptr<osg::Node> node =
+            dynamic_cast<osg::Node *>(getObjectFromModelIndex(index).get());
+    if (!node.valid())
+        return;
+
+    aboutToEdit();
+
+    // triangles and vertices are reordered in place
+    beginMacro("Optimize Vertex Cache");
+    node = dynamic_cast<osg::Node *>(getObjectFromModelIndex(
+                unshareSubtree(index, geometryCopy)).get());
+
+    VertexCacheOptimizer optimizer;
+    std::vector<VertexCacheOptimizer::Result> results = optimizer.optimize(node);
+    endMacro();
+    if (results.empty())
+        return;
+
+    double missesBefore = 0.0;
+    double missesAfter = 0.0;
+    unsigned triangles = 0;
+    for (unsigned i=0 ; i < results.size() ; i++) {
+        const VertexCacheOptimizer::Result &r = results[i];
+        setAnalysis(r.geometry, "ACMRBefore", QString::asprintf("%.3f", r.acmrBefore));
+        setAnalysis(r.geometry, "ACMRAfter", QString::asprintf("%.3f", r.acmrAfter));
+
+        missesBefore += r.acmrBefore * r.triangles;
+        missesAfter += r.acmrAfter * r.triangles;
+        triangles += r.triangles;
+    }
+
+    // a whole subtree gets the triangle weighted average
+    if (triangles > 0 && !dynamic_cast<osg::Drawable *>(node.get())) {
+        setAnalysis(node, "ACMRBefore", QString::asprintf("%.3f", missesBefore / triangles));
+        setAnalysis(node, "ACMRAfter", QString::asprintf("%.3f", missesAfter / triangles));
+    }
+
+    sceneEdited(node);
+}
+
+void OsgItemModel::compressVertices(const QModelIndex &index)
+{
+    osg::ref_ptr<osg::Node> node =
+            dynamic_cast<osg::Node *>(getObjectFromModelIndex(index).get());
+    if (!node.valid())
+        return;
+
+    aboutToEdit();
+
+    // the arrays of each geometry are swapped for quantized ones
+    beginMacro("Compress Vertex Attributes");
+    node = dynamic_cast<osg::Node *>(getObjectFromModelIndex(
+                unshareSubtree(index, geometryCopy)).get());
+
+    VertexCompressor compressor;
+    std::vector<VertexCompressor::Result> results = compressor.compress(node);
+    endMacro();
+
+    double positionError = 0.0;
+    double normalError = 0.0;
+    double colorError = 0.0;
+    quint64 bytesBefore = 0;
+    quint64 bytesAfter = 0;
+    for (unsigned i=0 ; i < results.size() ; i++) {
+        const VertexCompressor::Result &r = results[i];
+        if (!r.compressed)
+            continue;
+
+        setAnalysis(r.geometry, "PositionError", r.positionError);
+        setAnalysis(r.geometry, "NormalErrorDegrees", r.normalError);
+        setAnalysis(r.geometry, "ColorError", r.colorError);
+        setAnalysis(r.geometry, "AttributeBytes",
+                    QString::asprintf("%u -> %u", r.bytesBefore, r.bytesAfter));
+
+        positionError = std::max(positionError, r.positionError);
+        normalError = std::max(normalError, r.normalError);
+        colorError = std::max(colorError, r.colorError);
+        bytesBefore += r.bytesBefore;
+        bytesAfter += r.bytesAfter;
+    }
+
+    if (bytesBefore == 0)
+        return;
+
+    if (!dynamic_cast<osg::Drawable *>(node.get())) {
+        setAnalysis(node, "PositionError", positionError);
+        setAnalysis(node, "NormalErrorDegrees", normalError);
+        setAnalysis(node, "ColorError", colorError);
+        setAnalysis(node, "AttributeBytes",
+                    QString::asprintf("%llu -> %llu", (unsigned long long)bytesBefore,
+                                      (unsigned long long)bytesAfter));
+    }
+
+    sceneEdited(node);
+}
+
+void OsgItemModel::sceneEdited(osg::Node *node)
+{
+    markFilesDirty(node);
+    forgetBounds(node);
+    clearClashes();
+    m_triangleTrees.clear();
+    m_triangleTreeBytes = 0;
+    emit sceneChanged();
+}
+
+void OsgItemModel::emitColumnChanged(int column)
+{
+    // One notice per parent that is showing, so views and proxies refresh
+    // (and re-sort) every level rather than just the top one.  Only parents
+    // a view has asked for the children of can be showing any.
+    QSet<Item *> parents = m_parentItems;
+    parents << m_rootItem;
+
+    QHash<Item *, bool> known;
+    foreach (Item *parent, parents) {
+        if (parent != m_rootItem && !itemIsLive(parent, &known))
+            continue;
+
+        unsigned kids = numChildrenOf(parent->object);
+        if (kids == 0)
+            continue;
+
+        QModelIndex parentIndex = indexFromItem(parent, 0);
+        emit dataChanged(index(0, column, parentIndex),
+                         index(kids-1, column, parentIndex));
+    }
+}
+
+void OsgItemModel::markFilesDirty(osg::Node *node)
+{
+    // Find every loaded file that node is part of
+    std::vector<osg::Node *> pending(1, node);
+    std::set<osg::Node *> visited;
+    while (!pending.empty()) {
+        osg::Node *n = pending.back();
+        pending.pop_back();
+        if (!n || !visited.insert(n).second)
+            continue;
+
+        for (unsigned p=0 ; p < n->getNumParents() ; p++) {
+            osg::Node *parent = n->getParent(p);
+            if (parent == m_loadedModel.get()) {
+                if (!m_memoryDirty.contains(n))
+                    m_memoryDirty.append(n);
+                if (!m_indexDirty.contains(n))
+                    m_indexDirty.append(n);
+            } else {
+                pending.push_back(parent);
+            }
+        }
+    }
+
+    // the loaded model's own matrix moves every file
+    if (node == m_loadedModel.get()) {
+        for (unsigned i=0 ; i < m_loadedModel->getNumChildren() ; i++) {
+            if (!m_indexDirty.contains(m_loadedModel->getChild(i)))
+                m_indexDirty.append(m_loadedModel->getChild(i));
+        }
+    }
+
+    // even with nothing to recount, removed files have to be dropped
+    m_memoryTimer->start();
+}
+
+void OsgItemModel::waitForMemoryAccounting()
+{
+    // the accounting thread reads the scene graph, so edits wait for it
+    m_memoryWatcher.waitForFinished();
+}
+
+void OsgItemModel::aboutToEdit()
+{
+    waitForMemoryAccounting();
+    waitForIndexing();
+    emit sceneAboutToChange();
+}
+
+QList<OsgItemModel::MemoryResult> OsgItemModel::accountMemory(QList< osg::ref_ptr<osg::Node> > roots)
+{
+    QList<MemoryResult> results;
+    foreach (osg::ref_ptr<osg::Node> root, roots) {
+        MemoryAccountingVisitor visitor;
+        root->accept(visitor);
+
+        MemoryResult result;
+        result.root = root;
+        result.report = visitor.getReport();
+        results << result;
+    }
+    return results;
+}
+
+void OsgItemModel::startMemoryAccounting()
+{
+    // memoryAccountingFinished() starts over if anything is left
+    if (m_memoryPending)
+        return;
+
+    m_memoryPending = true;
+    m_memoryWatcher.setFuture(QtConcurrent::run(&OsgItemModel::accountMemory, m_memoryDirty));
+    m_memoryDirty.clear();
+}
+
+void OsgItemModel::memoryAccountingFinished()
+{
+    m_memoryPending = false;
+
+    foreach (const MemoryResult &result, m_memoryWatcher.result())
+        m_memory.insert(result.root.get(), result);
+
+    // forget files that are no longer loaded
+    QHash<const osg::Node *, MemoryResult>::iterator i = m_memory.begin();
+    while (i != m_memory.end()) {
+        if (m_loadedModel->containsNode(i->root.get()))
+            ++i;
+        else
+            i = m_memory.erase(i);
+    }
+
+    modelDebug("memory accounted for %d files", m_memory.size());
+
+    emitColumnChanged(3);
+    emit memoryUsageChanged();
+
+    if (!m_memoryDirty.isEmpty())
+        m_memoryTimer->start();
+}
+
+bool OsgItemModel::getMemoryUsage(osg::Object *object, MemoryUsage &usage) const
+{
+    foreach (const MemoryResult &result, m_memory) {
+        MemoryReport::const_iterator i = result.report.find(object);
+        if (i != result.report.end()) {
+            usage = i.value();
+            return true;
+        }
+    }
+    return false;
+}
+
+MemoryUsage OsgItemModel::getSceneMemoryUsage() const
+{
+    MemoryUsage usage;
+    foreach (const MemoryResult &result, m_memory)
+        usage += result.report.value(result.root.get());
+    return usage;
+}
+
+QVariantMap OsgItemModel::getAnalysis(osg::Object *object) const
+{
+    QHash<const osg::Object *, Analysis>::const_iterator i = m_analysis.find(object);
+
+    // the address may have been reused by a new object
+    if (i == m_analysis.end() || i->object.get() != object)
+        return QVariantMap();
+
+    return i->values;
+}
+
+void OsgItemModel::setAnalysis(osg::Object *object, const QString key, const QVariant value)
+{
+    Analysis &analysis = m_analysis[object];
+    if (analysis.object.get() != object) {
+        analysis.object = object;
+        analysis.values.clear();
+    }
+    analysis.values.insert(key, value);
+}
+
+QModelIndex OsgItemModel::parent(const QModelIndex &index) const
+{
+    if (! index.isValid())
+        return QModelIndex();
+
+    Item *item = itemFromIndex(index);
+    if (item == m_rootItem || item->parent == m_rootItem)
+        return QModelIndex();
+
+    return indexFromItem(item->parent, 0);
+}
+
+void OsgItemModel::printNode(osg::ref_ptr<osg::Node> n, const int level) const
+{
+    modelDebug("%*s%s  %s\n", level, "", n->getName().c_str(), qPrintable(maskToString(n->getNodeMask())));
+
+    osg::ref_ptr<osg::Group> g = n->asGroup();
+    if (g) {
+        int kids = g->getNumChildren();
+        for (int kid=0 ; kid < kids ; kid++) {
+            osg::ref_ptr<osg::Node> child = g->getChild(kid);
+            printNode(child, level+2);
+        }
+        return;
+    }
+}
+
+QString OsgItemModel::maskToString(const osg::Node::NodeMask mask) const
+{
+    QString maskString = QString::asprintf("%08x", (unsigned)mask);
+    modelDebug("maskToString %s", qPrintable(maskString));
+    return maskString;
+}
+void OsgItemModel::printTree() const
+{
+    printNode(m_loadedModel, 2);
+}
+
+
+int OsgItemModel::rowCount(const QModelIndex &parent) const
+{
+    osg::ref_ptr<osg::Object> object = getObjectFromModelIndex(parent);
+    int kids = 0;
+
+    if (osg::Group *group = dynamic_cast<osg::Group *>(object.get())) {
+        kids = group->getNumChildren();
+    } else if (osg::Geode *geode = dynamic_cast<osg::Geode *>(object.get())) {
+        kids = geode->getNumDrawables();
+    }
+
+    modelDebug("rowCount %d %d %s == %d\n",
+           parent.row(),
+           parent.column(),
+           object->getName().c_str(), kids);
+
+    return kids;
+}
+
+bool OsgItemModel::setObjectName(const QModelIndex & index,
+                   const QVariant & value)
+{
+    getObjectFromModelIndex(index)->setName(qPrintable(value.toString()));
+    return true;
+}
+bool OsgItemModel::setObjectMask(const QModelIndex & index,
+                   const QVariant & value)
+{
+    bool ok = false;
+    osg::ref_ptr<osg::Object> object = getObjectFromModelIndex(index);
+    if (osg::Node *node = dynamic_cast<osg::Node *>(object.get())) {
+
+        int number = value.toString().toUInt(&ok, 16);
+        if (ok) {
+            node->setNodeMask(number);
+        } else {
+            qDebug("set mask: %s %d", qPrintable(value.toString()), number);
+        }
+    }
+    return ok;
+}
+
+bool OsgItemModel::setData(const QModelIndex & index,
+                           const QVariant & value,
+                           int role )
+{
+    qDebug("setData(%d %d %s) = \"%s\"",
+           index.row(), index.column(),
+           qPrintable(stringFromRole(role)),
+           qPrintable(value.toString()));
+
+    if (role == Qt::CheckStateRole && index.column() == 0)
+        return setObjectVisible(index, value.toInt() == Qt::Checked);
+
+    if (role != Qt::EditRole || value.toString().size() <= 0)
+        return false;
+
+    if (index.column() != 0 && index.column() != 2)
+        return false;
+
+    aboutToEdit();
+
+    beginMacro(index.column() == 0 ? "Rename" : "Set Mask");
+
+    // edit only this place in the tree, not everywhere it is shared
+    QModelIndex target = unshare(index);
+
+    osg::ref_ptr<osg::Object> object = getObjectFromModelIndex(target);
+    QVariant before = objectValue(object.get(), target.column());
+
+    bool dataWasSet = false;
+
+    switch (target.column()) {
+    case 0: dataWasSet = setObjectName(target, value); break;
+    case 2: dataWasSet = setObjectMask(target, value); break;
+    default:
+        break;
+    }
+
+    if (dataWasSet) {
+        emit dataChanged(target, target);
+        ValueCommand *command = new ValueCommand(this, target.column());
+        command->addChange(object.get(), before, objectValue(object.get(), target.column()));
+        record(command);
+    }
+
+    endMacro();
+
+    return dataWasSet;
+}
+
+bool OsgItemModel::setObjectVisible(const QModelIndex &index, bool visible)
+{
+    aboutToEdit();
+
+    beginMacro(visible ? "Show" : "Hide");
+
+    QModelIndex target = unshare(index);
+    osg::ref_ptr<osg::Object> object = getObjectFromModelIndex(target);
+    osg::Node *node = dynamic_cast<osg::Node *>(object.get());
+    if (!node) {
+        endMacro();
+        return false;
+    }
+
+    unsigned before = node->getNodeMask();
+    unsigned after = before;
+    if (visible) {
+        // back on the layers it was on, or on every layer showing now
+        unsigned bits = m_cullMask;
+        QHash<const osg::Object *, HiddenBits>::iterator i = m_hiddenBits.find(node);
+        if (i != m_hiddenBits.end() && i->object.get() == node && (i->bits & m_cullMask))
+            bits = i->bits;
+        after = before | bits;
+    } else {
+        HiddenBits &hidden = m_hiddenBits[node];
+        hidden.object = node;
+        hidden.bits = before & m_cullMask;
+        after = before & ~m_cullMask;
+    }
+
+    if (after != before) {
+        QHash<osg::Object *, QVariant> masks;
+        masks.insert(node, after);
+        setObjectValues(2, masks);
+
+        ValueCommand *command = new ValueCommand(this, 2);
+        command->addChange(node, before, after);
+        record(command);
+    }
+
+    endMacro();
+    return true;
+}
+
+void OsgItemModel::setCullMask(unsigned mask)
+{
+    if (mask == m_cullMask)
+        return;
+
+    m_cullMask = mask;
+    m_boundCache.clear();
+
+    emitColumnChanged(0);
+    emit cullMaskChanged(mask);
+}
+
+QVariant OsgItemModel::objectValue(osg::Object *object, int column) const
+{
+    switch (column) {
+    case 0:
+        return QVariant(QString::fromStdString(object->getName()));
+    case 2:
+        if (osg::Node *node = dynamic_cast<osg::Node *>(object))
+            return QVariant((unsigned)node->getNodeMask());
+        break;
+    default:
+        break;
+    }
+    return QVariant();
+}
+
+void OsgItemModel::setObjectValues(int column, const QHash<osg::Object *, QVariant> &values)
+{
+    aboutToEdit();
+
+    for (QHash<osg::Object *, QVariant>::const_iterator i = values.begin() ; i != values.end() ; ++i) {
+        switch (column) {
+        case 0:
+            i.key()->setName(i.value().toString().toStdString());
+            break;
+        case 2:
+            if (osg::Node *node = dynamic_cast<osg::Node *>(i.key())) {
+                node->setNodeMask(i.value().toUInt());
+                forgetBounds(node);
+                markFilesDirty(node); // the spatial index keeps the masks
+            }
+            break;
+        default:
+            return;
+        }
+    }
+
+    // One notice per parent showing any of them, however many changed,
+    // covering just the rows from the first changed to the last
+    QHash<Item *, QPair<int, int> > ranges;
+    QHash<Item *, bool> known;
+    for (QHash<osg::Object *, QVariant>::const_iterator i = values.begin() ; i != values.end() ; ++i) {
+        foreach (Item *item, m_itemsByObject.values(i.key())) {
+            if (!itemIsLive(item, &known))
+                continue;
+
+            const int row = itemRow(item);
+            if (ranges.contains(item->parent)) {
+                QPair<int, int> &range = ranges[item->parent];
+                range.first = std::min(range.first, row);
+                range.second = std::max(range.second, row);
+            } else {
+                ranges.insert(item->parent, qMakePair(row, row));
+            }
+        }
+    }
+
+    for (QHash<Item *, QPair<int, int> >::const_iterator i = ranges.begin() ; i != ranges.end() ; ++i) {
+        // a mask also decides the check state in column 0
+        QModelIndex parentIndex = indexFromItem(i.key(), 0);
+        emit dataChanged(index(i.value().first, column == 2 ? 0 : column, parentIndex),
+                         index(i.value().second, column, parentIndex));
+    }
+
+    emit sceneChanged();
+}
+
+void OsgItemModel::applyMask(const QModelIndexList &indexes,
+                             MaskOperation operation,
+                             unsigned bits,
+                             bool subtree)
+{
+    beginMacro(operation == SET_BITS ? "Set Mask Bits" :
+               operation == CLEAR_BITS ? "Clear Mask Bits" : "Toggle Mask Bits");
+
+    // Edit only these places in the tree, not everywhere they are shared.
+    // Unsharing one may move the others, persistent indexes follow.
+    QList<QPersistentModelIndex> targets;
+    foreach (const QModelIndex &index, indexes)
+        targets << QPersistentModelIndex(index);
+
+    std::vector<osg::Object *> pending;
+    foreach (const QPersistentModelIndex &index, targets) {
+        // drawables have masks of their own
+        Item *item = itemFromIndex(subtree ?
+                                       unshareSubtree(index, osg::CopyOp::DEEP_COPY_NODES |
+                                                             osg::CopyOp::DEEP_COPY_DRAWABLES) :
+                                       unshare(index));
+        if (item != m_rootItem)
+            pending.push_back(item->object);
+    }
+
+    ValueCommand *command = new ValueCommand(this, 2);
+    QHash<osg::Object *, QVariant> masks;
+    QSet<osg::Object *> visited;
+
+    while (!pending.empty()) {
+        osg::Object *object = pending.back();
+        pending.pop_back();
+        if (visited.contains(object))
+            continue;
+        visited.insert(object);
+
+        if (subtree) {
+            unsigned kids = numChildrenOf(object);
+            for (unsigned i=0 ; i < kids ; i++)
+                pending.push_back(childOf(object, i));
+        }
+
+        osg::Node *node = dynamic_cast<osg::Node *>(object);
+        if (!node)
+            continue;
+
+        unsigned before = node->getNodeMask();
+        unsigned after = before;
+        switch (operation) {
+        case SET_BITS:    after = before | bits; break;
+        case CLEAR_BITS:  after = before & ~bits; break;
+        case TOGGLE_BITS: after = before ^ bits; break;
+        }
+
+        if (after != before) {
+            masks.insert(object, after);
+            command->addChange(object, before, after);
+        }
+    }
+
+    if (masks.isEmpty()) {
+        delete command;
+        endMacro();
+        return;
+    }
+
+    setObjectValues(2, masks);
+    record(command);
+    endMacro();
+}
+
+void OsgItemModel::importFileByName(const QString fileName)
+{
+    osg::Node *loaded = osgDB::readNodeFile(fileName.toStdString());
+
+
+    if (!loaded)
+        return;
+
+
+    if (loaded->getName().size() == 0)
+        loaded->setName(basename(qPrintable(fileName)));
+
+    int childNumber = m_loadedModel->getNumChildren();
+    loaded->setUserValue("childIndex", childNumber);
+
+    if (childNumber == 0) {
+        beginInsertColumns(createIndex(-1, -1), 1, 3);
+        insertNode(m_loadedModel, loaded, m_loadedModel->getNumChildren());
+        endInsertColumns();
+    } else {
+        insertNode(m_loadedModel, loaded, m_loadedModel->getNumChildren());
+    }
+}
+
+bool OsgItemModel::saveToFileByName(const QString fileName)
+{
+    if (m_loadedModel->getNumChildren() == 1) {
+        return osgDB::writeNodeFile(*m_loadedModel->getChild(0), qPrintable(fileName));
+    }
+
+    osg::Group *writeGroup = new osg::Group(*m_loadedModel);
+    writeGroup->setName(qPrintable(fileName));
+    return osgDB::writeNodeFile(*writeGroup, fileName.toStdString().c_str());
+}
+
+static QString stringFromRole(const int role)
+{
+    switch (role) {
+    case Qt::DisplayRole: return QString("DisplayRole"); break;
+    case Qt::DecorationRole: return QString("DecorationRole"); break;
+    case Qt::EditRole: return QString("EditRole"); break;
+    case Qt::ToolTipRole: return QString("ToolTipRole"); break;
     case Qt::StatusTipRole: return QString("StatusTipRole"); break;
     case Qt::WhatsThisRole: return QString("WhatsThisRole"); break;
     case Qt::SizeHintRole: return QString("SizeHintRole"); break;
@@ -433,3 +2217,395 @@ static QString stringFromRole(const int role)
 
     return QString("invalidRole");
 }
+
+namespace {
+
+/// One subtree to bound on a worker thread
+struct BoundJob {
+    osg::ref_ptr<osg::Node> node;
+    unsigned mask;
+    osg::BoundingBox box;
+};
+
+void computeBound(BoundJob &job)
+{
+    osg::ComputeBoundsVisitor visitor;
+    visitor.setTraversalMask(job.mask);
+    job.node->accept(visitor);
+    job.box = visitor.getBoundingBox();
+}
+
+}
+
+osg::BoundingBox OsgItemModel::getWorldBound(const QModelIndexList &indexes)
+{
+    // the workers read the scene graph, as the accounting thread does
+    waitForMemoryAccounting();
+
+    QSet<Item *> selected;
+    foreach (const QModelIndex &index, indexes) {
+        if (index.isValid())
+            selected << itemFromIndex(index);
+    }
+
+    QList<Item *> items;
+    std::vector<BoundJob> jobs;
+    QSet<const osg::Node *> queued;
+    foreach (Item *item, selected) {
+        osg::Node *node = dynamic_cast<osg::Node *>(item->object);
+        if (!node)
+            continue;
+
+        // A selected ancestor's box holds this one already, and two jobs
+        // over the same subtree would compute its drawables' bounds at once
+        bool beneath = false;
+        for (Item *i = item->parent ; i && !beneath ; i = i->parent)
+            beneath = selected.contains(i);
+        if (beneath)
+            continue;
+        items.append(item);
+
+        // a node deleted since may have left its address to this one
+        if (m_boundCache.value(node).node.get() == node || queued.contains(node))
+            continue;
+        queued << node;
+
+        BoundJob job;
+        job.node = node;
+        job.mask = m_cullMask;
+        jobs.push_back(job);
+    }
+
+    QtConcurrent::blockingMap(jobs, computeBound);
+    for (unsigned i=0 ; i < jobs.size() ; i++) {
+        CachedBound cached;
+        cached.node = jobs[i].node.get();
+        cached.box = jobs[i].box;
+        m_boundCache.insert(jobs[i].node.get(), cached);
+    }
+
+    osg::BoundingBox world;
+    foreach (Item *item, items) {
+        const osg::BoundingBox box = m_boundCache.value(static_cast<osg::Node *>(item->object)).box;
+        if (!box.valid())
+            continue;
+
+        // the transforms above this place in the tree, down from the
+        // loaded model (whose matrix applies to everything)
+        osg::NodePath path;
+        for (Item *i = item->parent ; i ; i = i->parent) {
+            osg::Node *node = dynamic_cast<osg::Node *>(i->object);
+            if (node)
+                path.insert(path.begin(), node);
+        }
+        osg::Matrix matrix = osg::computeLocalToWorld(path);
+
+        for (unsigned c=0 ; c < 8 ; c++)
+            world.expandBy(box.corner(c) * matrix);
+    }
+
+    return world;
+}
+
+void OsgItemModel::forgetBounds(osg::Node *node)
+{
+    if (m_boundCache.isEmpty())
+        return;
+
+    // the box of every ancestor included this one
+    std::vector<osg::Node *> pending(1, node);
+    std::set<osg::Node *> visited;
+    while (!pending.empty()) {
+        osg::Node *n = pending.back();
+        pending.pop_back();
+        if (!n || !visited.insert(n).second)
+            continue;
+
+        m_boundCache.remove(n);
+        for (unsigned p=0 ; p < n->getNumParents() ; p++)
+            pending.push_back(n->getParent(p));
+    }
+}
+
+SpatialIndex OsgItemModel::updateIndex(SpatialIndex index,
+                                       QList< osg::ref_ptr<osg::Node> > roots,
+                                       QList< osg::ref_ptr<osg::Node> > dirty,
+                                       osg::Matrixd toWorld)
+{
+    index.update(roots, dirty, toWorld);
+    return index;
+}
+
+void OsgItemModel::startIndexing()
+{
+    // indexingFinished() starts over if anything is left
+    if (m_indexPending)
+        return;
+
+    QList< osg::ref_ptr<osg::Node> > roots;
+    for (unsigned i=0 ; i < m_loadedModel->getNumChildren() ; i++)
+        roots << m_loadedModel->getChild(i);
+
+    m_indexPending = true;
+    m_indexWatcher.setFuture(QtConcurrent::run(&OsgItemModel::updateIndex, m_spatialIndex,
+                                               roots, m_indexDirty,
+                                               osg::Matrixd(m_loadedModel->getMatrix())));
+    m_indexDirty.clear();
+}
+
+void OsgItemModel::indexingFinished()
+{
+    // waitForIndexing() may have taken the result already
+    if (!m_indexPending)
+        return;
+
+    m_indexPending = false;
+    m_spatialIndex = m_indexWatcher.result();
+    modelDebug("spatial index of %u parts", m_spatialIndex.getNumParts());
+
+    if (!m_indexDirty.isEmpty())
+        m_memoryTimer->start();
+}
+
+void OsgItemModel::waitForIndexing()
+{
+    // the worker reads the scene graph, so edits wait for it
+    m_indexWatcher.waitForFinished();
+}
+
+const SpatialIndex &OsgItemModel::getSpatialIndex()
+{
+    // Bring it up to date now rather than when the timer would have
+    if (m_memoryTimer->isActive() || !m_indexDirty.isEmpty()) {
+        waitForIndexing();
+        indexingFinished();
+        startIndexing();
+    }
+    waitForIndexing();
+    indexingFinished();
+
+    // hidden parts stay in the index, the queries pass over them
+    m_spatialIndex.setMask(m_cullMask);
+    return m_spatialIndex;
+}
+
+QList<OsgItemModel::Item *> OsgItemModel::partItems(const QModelIndexList &indexes) const
+{
+    QList<Item *> items;
+    foreach (const QModelIndex &index, indexes) {
+        if (index.isValid() && dynamic_cast<osg::Node *>(itemFromIndex(index)->object))
+            items << itemFromIndex(index);
+    }
+    return items;
+}
+
+bool OsgItemModel::partIsUnder(const SpatialIndex::Part &part, const QList<Item *> &items) const
+{
+    // Under the item when the objects from the top of the tree down to it
+    // start the part's path.  Only that one place counts, not every place
+    // the item's node is shared into.
+    foreach (Item *item, items) {
+        std::vector<osg::Object *> chain;
+        for (Item *i = item ; i && i != m_rootItem ; i = i->parent)
+            chain.insert(chain.begin(), i->object);
+
+        if (chain.size() > part.path.size())
+            continue;
+
+        bool under = true;
+        for (unsigned i=0 ; i < chain.size() && under ; i++)
+            under = chain[i] == part.path[i].get();
+        if (under)
+            return true;
+    }
+    return false;
+}
+
+QModelIndexList OsgItemModel::findPartsNear(const QModelIndexList &indexes, double distance)
+{
+    QModelIndexList found;
+
+    const osg::BoundingBox box = getWorldBound(indexes);
+    if (!box.valid())
+        return found;
+
+    const SpatialIndex &spatialIndex = getSpatialIndex();
+    const QList<Item *> items = partItems(indexes);
+
+    // The selection's box is only a first cut, each of its parts is
+    // checked against each candidate
+    std::vector<const SpatialIndex::Part *> selected;
+    foreach (unsigned i, partsUnder(indexes))
+        selected.push_back(&spatialIndex.getPart(i));
+
+    foreach (unsigned i, spatialIndex.findWithin(box, distance)) {
+        const SpatialIndex::Part &part = spatialIndex.getPart(i);
+        if (partIsUnder(part, items))
+            continue;
+
+        for (unsigned s=0 ; s < selected.size() ; s++) {
+            if (SpatialIndex::boxDistance(part.box, selected[s]->box) <= distance) {
+                QModelIndex index = indexFromNodePath(part.path);
+                if (index.isValid())
+                    found << index;
+                break;
+            }
+        }
+    }
+
+    modelDebug("%d parts within %g", found.size(), distance);
+    return found;
+}
+
+QModelIndex OsgItemModel::findNearestPart(const QModelIndexList &indexes)
+{
+    const osg::BoundingBox box = getWorldBound(indexes);
+    if (!box.valid())
+        return QModelIndex();
+
+    const SpatialIndex &spatialIndex = getSpatialIndex();
+    const QList<Item *> items = partItems(indexes);
+
+    int nearest = spatialIndex.findNearest(box.center(),
+                                           [this, &items](const SpatialIndex::Part &part) {
+                                               return !partIsUnder(part, items);
+                                           });
+    if (nearest < 0)
+        return QModelIndex();
+
+    return indexFromNodePath(spatialIndex.getPart(nearest).path);
+}
+
+QModelIndex OsgItemModel::indexFromNodePath(const SpatialIndex::RefNodePath &path) const
+{
+    Item *item = m_rootItem;
+    for (unsigned i=0 ; i < path.size() ; i++) {
+        if (childPosition(item->object, path[i].get()) < 0)
+            return QModelIndex();
+        item = itemFor(item, path[i].get());
+    }
+
+    return indexFromItem(item, 0);
+}
+
+std::vector<unsigned> OsgItemModel::partsUnder(const QModelIndexList &indexes)
+{
+    std::vector<unsigned> parts;
+
+    const osg::BoundingBox box = getWorldBound(indexes);
+    if (!box.valid())
+        return parts;
+
+    const SpatialIndex &spatialIndex = getSpatialIndex();
+    const QList<Item *> items = partItems(indexes);
+    foreach (unsigned i, spatialIndex.findWithin(box, 0.0)) {
+        if (partIsUnder(spatialIndex.getPart(i), items))
+            parts.push_back(i);
+    }
+    return parts;
+}
+
+void OsgItemModel::checkClashes(const QModelIndexList &indexesA,
+                                const QModelIndexList &indexesB,
+                                double tolerance)
+{
+    const std::vector<unsigned> partsA = partsUnder(indexesA);
+    const std::vector<unsigned> partsB = partsUnder(indexesB);
+    const SpatialIndex &spatialIndex = getSpatialIndex();
+
+    ClashDetector detector;
+    detector.setTolerance(tolerance);
+    detector.detect(spatialIndex, partsA, partsB);
+
+    m_clashes.clear();
+    foreach (const ClashDetector::Clash &found, detector.getClashes()) {
+        Clash clash;
+        clash.partA = spatialIndex.getPart(found.partA).path;
+        clash.partB = spatialIndex.getPart(found.partB).path;
+        clash.matrixA = spatialIndex.getPartMatrix(found.partA);
+        clash.matrixB = spatialIndex.getPartMatrix(found.partB);
+        clash.triangles = found.triangles;
+        clash.box = found.box;
+        m_clashes << clash;
+    }
+
+    modelDebug("%u x %u parts, %u pairs to check, %llu triangle tests, %d clashes",
+               (unsigned)partsA.size(), (unsigned)partsB.size(),
+               detector.getNumCandidates(), detector.getNumTriangleTests(), m_clashes.size());
+
+    emit clashesChanged();
+}
+
+void OsgItemModel::clearClashes()
+{
+    if (m_clashes.isEmpty())
+        return;
+
+    m_clashes.clear();
+    emit clashesChanged();
+}
+
+QSharedPointer<const TriangleTree> OsgItemModel::triangleTree(const osg::Geode *geode)
+{
+    QSharedPointer<const TriangleTree> tree = m_triangleTrees.value(geode);
+    if (tree)
+        return tree;
+
+    // A cache, not a copy of the scene: start over rather than grow
+    // without end while the mouse wanders over a huge model
+    if (m_triangleTreeBytes > m_triangleTreeLimit) {
+        modelDebug("pick cache of %u bytes dropped", (unsigned)m_triangleTreeBytes);
+        m_triangleTrees.clear();
+        m_triangleTreeBytes = 0;
+    }
+
+    QSharedPointer<TriangleTree> built(new TriangleTree);
+    built->build(*geode);
+    m_triangleTreeBytes += built->getMemoryUsage();
+    m_triangleTrees.insert(geode, built);
+    return built;
+}
+
+bool OsgItemModel::pickPart(const osg::Vec3d &start, const osg::Vec3d &end, PartHit &hit)
+{
+    const SpatialIndex &spatialIndex = getSpatialIndex();
+    const std::vector< std::pair<double, unsigned> > along =
+            spatialIndex.findAlongSegment(start, end);
+
+    // Parts come in the order the segment reaches their boxes, so once a
+    // box starts beyond the nearest hit so far nothing after it can be
+    // nearer
+    double nearest = DBL_MAX;
+    for (unsigned i=0 ; i < along.size() && along[i].first < nearest ; i++) {
+        const SpatialIndex::Part &part = spatialIndex.getPart(along[i].second);
+        const osg::Geode *geode = dynamic_cast<const osg::Geode *>(part.path.back().get());
+        if (!geode)
+            continue;
+
+        // the ray goes to the part rather than its triangles to the world
+        const osg::Matrixd matrix = spatialIndex.getPartMatrix(along[i].second);
+        const osg::Matrixd inverse = osg::Matrixd::inverse(matrix);
+        const osg::Vec3d localStart = start * inverse;
+        const osg::Vec3d localEnd = end * inverse;
+
+        QSharedPointer<const TriangleTree> tree = triangleTree(geode);
+        double t;
+        const int triangle = tree->intersectRay(localStart, localEnd - localStart, t);
+        if (triangle < 0 || t > 1.0 || t >= nearest)
+            continue;
+
+        nearest = t;
+        const TriangleTree::Triangle &hitTriangle = tree->getTriangles()[triangle];
+        hit.path = part.path;
+        hit.matrix = matrix;
+        hit.triangles = tree;
+        hit.triangle = triangle;
+        hit.point = (localStart + (localEnd - localStart) * t) * matrix;
+        hit.normal = osg::Matrixd::transform3x3(inverse,
+                                                (hitTriangle.v[1] - hitTriangle.v[0]) ^
+                                                (hitTriangle.v[2] - hitTriangle.v[0]));
+        hit.normal.normalize();
+    }
+
+    return nearest <= 1.0;
+}
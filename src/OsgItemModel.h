@@ -2,13 +2,31 @@
 #define OSGITEMMODEL_H
 
 #include <QAbstractItemModel>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QMultiHash>
+#include <QPair>
+#include <QSet>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVariantMap>
 #include <osg/Node>
+#include <osg/BoundingBox>
 #include <osg/MatrixTransform>
+#include <osg/observer_ptr>
+
+#include "MemoryAccounting.h"
+#include "SpatialIndex.h"
+#include "UndoStack.h"
+
+class TriangleTree;
 
 class OsgItemModel : public QAbstractItemModel
 {
+    Q_OBJECT
 public:
     OsgItemModel(QObject * parent = 0);
+    ~OsgItemModel();
 
     //////////////////// Start QAbstractItemModel methods //////////////////////
     int             columnCount(const QModelIndex &parent) const;
@@ -27,6 +45,15 @@ public:
     bool            setData(const QModelIndex &index,
                             const QVariant &value,
                             int role = Qt::EditRole);
+
+    QStringList     mimeTypes() const;
+    QMimeData      *mimeData(const QModelIndexList &indexes) const;
+    bool            dropMimeData(const QMimeData *data,
+                                 Qt::DropAction action,
+                                 int row,
+                                 int column,
+                                 const QModelIndex &parent);
+    Qt::DropActions supportedDropActions() const;
     //////////////////// End QAbstractItemModel methods ////////////////////////
 
     void importFileByName(const QString fileName); ///< load a file into the "root"
@@ -41,26 +68,301 @@ public:
 
     void insertNode(osg::ref_ptr<osg::Group> parent,
                     osg::ref_ptr<osg::Node> newChild,
-                    int childPositionInParent,
-                    int row);
+                    int childPositionInParent);
+
+    void replaceNode(osg::ref_ptr<osg::Group> parent,
+                     osg::ref_ptr<osg::Node> oldChild,
+                     osg::ref_ptr<osg::Node> newChild);
+
+    /// Put the node at index on the clipboard.  Only a reference is kept,
+    /// nothing is copied.
+    void copy(const QModelIndex &index);
+
+    /// copy() the node at index and take it out of its parent
+    void cut(const QModelIndex &index);
+
+    /// Add what is on the clipboard to the group at index, or next to the
+    /// node at index.  The pasted nodes are shared with the originals until
+    /// one of them is edited, see unshare().
+    void paste(const QModelIndex &index);
+
+    enum MaskOperation { SET_BITS, CLEAR_BITS, TOGGLE_BITS };
+
+    /// Set, clear or toggle bits in the node masks of everything at
+    /// indexes (and beneath them, with subtree) in one pass.  Like an edit
+    /// through setData() only these places change, shared nodes are
+    /// unshared first.
+    void applyMask(const QModelIndexList &indexes,
+                   MaskOperation operation,
+                   unsigned bits,
+                   bool subtree);
+
+    /// Replace every heavy geode beneath index with a generated osg::LOD
+    void generateLod(const QModelIndex &index);
+
+    /// Look for identical Geometry beneath index and record how much memory
+    /// sharing them would save (see getAnalysis())
+    void findDuplicates(const QModelIndex &index);
+
+    /// Replace identical Geometry beneath index with shared references
+    void shareDuplicates(const QModelIndex &index);
+
+    /// Reorder triangles and vertices of the Geometry beneath index for the
+    /// vertex cache, recording ACMR before and after (see getAnalysis())
+    void optimizeVertexCache(const QModelIndex &index);
+
+    /// Quantize vertex attributes of the Geometry beneath index, recording
+    /// the error introduced for each drawable (see getAnalysis())
+    void compressVertices(const QModelIndex &index);
+
+    /// Results of analysis passes run on an object, keyed by property name
+    QVariantMap getAnalysis(osg::Object *object) const;
+    void setAnalysis(osg::Object *object, const QString key, const QVariant value);
+
+    /// Memory charged to object and everything beneath it by the last
+    /// accounting pass.  A node shared with an earlier subtree is charged
+    /// there, so it reports its own usage but adds nothing to its parents.
+    /// Returns false if the object has not been accounted for yet.
+    bool getMemoryUsage(osg::Object *object, MemoryUsage &usage) const;
+
+    /// Memory of everything that has been loaded
+    MemoryUsage getSceneMemoryUsage() const;
 
     osg::ref_ptr<osg::Object> getObjectFromModelIndex(const QModelIndex &index) const;
 
+    /// Tight box around everything visible (under the cull mask) at
+    /// indexes, in the coordinates of getRoot().  Each index brings the
+    /// transforms above it in the tree, so a shared node counts where it
+    /// was selected.  Subtree boxes are computed in parallel and cached
+    /// until something beneath them is edited.
+    osg::BoundingBox getWorldBound(const QModelIndexList &indexes);
+
+    /// Every part (geode) of the scene, indexed by its box in the
+    /// coordinates of getRoot().  The index is brought up to date in the
+    /// background after loads and edits; this waits for that to finish.
+    /// Its queries only find parts that show under the cull mask.
+    const SpatialIndex &getSpatialIndex();
+
+    /// Places of the parts within distance of the parts at indexes, not
+    /// counting those
+    QModelIndexList findPartsNear(const QModelIndexList &indexes, double distance);
+
+    /// Place of the part nearest the middle of the parts at indexes, not
+    /// counting those
+    QModelIndex findNearestPart(const QModelIndexList &indexes);
+
+    /// Place in the tree a SpatialIndex part path leads to
+    QModelIndex indexFromNodePath(const SpatialIndex::RefNodePath &path) const;
+
+    /// Two parts whose triangles intersect, see checkClashes()
+    struct Clash {
+        SpatialIndex::RefNodePath partA;
+        SpatialIndex::RefNodePath partB;
+        osg::Matrixd matrixA;   ///< each part's geode to getRoot() coordinates
+        osg::Matrixd matrixB;
+        unsigned triangles;     ///< intersecting triangle pairs
+        osg::BoundingBox box;   ///< around the intersections
+    };
+
+    /// Find the parts at indexesA that interfere with parts at indexesB,
+    /// by more than tolerance.  The results stay until the next check or
+    /// the next edit of the scene.
+    void checkClashes(const QModelIndexList &indexesA,
+                      const QModelIndexList &indexesB,
+                      double tolerance);
+    const QList<Clash> &getClashes() const { return m_clashes; }
+    void clearClashes();
+
+    /// Where a segment first meets a part, see pickPart()
+    struct PartHit {
+        SpatialIndex::RefNodePath path;
+        osg::Matrixd matrix;    ///< the geode to getRoot() coordinates
+        QSharedPointer<const TriangleTree> triangles; ///< of the geode, in its own coordinates
+        unsigned triangle;      ///< the one that was hit
+        osg::Vec3d point;       ///< in getRoot() coordinates
+        osg::Vec3d normal;
+    };
+
+    /// The first part the segment from start to end (in getRoot()
+    /// coordinates) meets.  Only parts the spatial index puts in the way
+    /// are looked at, each through a hierarchy over its triangles that is
+    /// kept until the scene is edited, so this is quick enough to do on
+    /// every move of the mouse.
+    bool pickPart(const osg::Vec3d &start, const osg::Vec3d &end, PartHit &hit);
+
+    /// The mask the views cull with.  A row is checked (visible) when its
+    /// node mask shares a bit with it; changing it touches no nodes.
+    unsigned getCullMask() const { return m_cullMask; }
+    void setCullMask(unsigned mask);
+
+    /// History of the edits made through the model
+    UndoStack *getUndoStack() { return &m_undoStack; }
+
     // The only thing that should call this is OsgView::setScene()
     osg::ref_ptr<osg::Group> getRoot() const { return m_root; }
 
+signals:
+    /// Something in the scene graph changed, whether or not it is showing
+    /// in a view of the model.
+    void sceneChanged();
+
+    /// A memory accounting pass finished and new numbers are available
+    void memoryUsageChanged();
+
+    /// The scene graph is about to be edited.  Whatever reads it on another
+    /// thread (a view's draw thread) has to be done with it on return, so
+    /// connect with Qt::DirectConnection.
+    void sceneAboutToChange();
+
+    void cullMaskChanged(unsigned mask);
+
+    /// checkClashes() found something new, or the clashes were cleared
+    void clashesChanged();
+
+private slots:
+    void startMemoryAccounting();
+    void memoryAccountingFinished();
+    void startIndexing();
+    void indexingFinished();
+
 private:
+    /// One place an osg::Object shows up in the tree.  A shared node has
+    /// a different Item under each parent it is reached through, which is
+    /// what lets parent() answer correctly for multi-parent scene graphs.
+    struct Item {
+        Item *parent;
+        osg::Object *object;
+        int row;        ///< where it was last found under parent, or -1
+    };
+
+    Item *itemFor(Item *parent, osg::Object *object) const;
+    Item *itemFromIndex(const QModelIndex &index) const;
+    QModelIndex indexFromItem(Item *item, int column) const;
+    int itemRow(Item *item) const;
+    bool itemIsLive(Item *item, QHash<Item *, bool> *known = 0) const;
+    QList<Item *> itemsForObject(osg::Object *object) const;
+    QList<int> rowPath(Item *item) const;
+    void clearItems();
+    void replacePersistentItems(const QHash<Item *, Item *> &replaced,
+                                const QHash<osg::Object *, osg::Object *> &copies =
+                                    QHash<osg::Object *, osg::Object *>());
+
+    QList<Item *> itemsFromMimeData(const QMimeData *data) const;
+    void moveItems(const QList<Item *> &items, osg::Group *destination, unsigned position);
+
+    QModelIndex unshare(const QModelIndex &index);
+    QModelIndex unshareSubtree(const QModelIndex &index, unsigned copyFlags);
+
+    void insertChild(osg::Group *parent, unsigned position, osg::Node *child);
+    void removeChild(osg::Group *parent, unsigned position);
+    void replaceChild(osg::Group *parent, unsigned position, osg::Node *child);
+    unsigned moveChildren(osg::Group *source, unsigned first, unsigned count,
+                          osg::Group *destination, unsigned position);
+
+    QVariant objectValue(osg::Object *object, int column) const;
+    void setObjectValues(int column, const QHash<osg::Object *, QVariant> &values);
+
+    // Undo.  Public edits record() a command for what they did; commands
+    // replay through the primitives above, which record nothing.
+    class ChildCommand;
+    class MoveCommand;
+    class ValueCommand;
+    void record(UndoCommand *command);
+    void beginMacro(const QString &text);
+    void endMacro();
+
+    /// Announce an edit at or beneath node
+    void sceneEdited(osg::Node *node);
+    void emitColumnChanged(int column);
 
     QString maskToString(const osg::Node::NodeMask mask) const;
     QModelIndex modelIndexFromNode(osg::ref_ptr<osg::Node> ptr,
                                    int column) const;
-    QModelIndex parentOfNode(osg::Node *childNode) const;
-    QModelIndex parentOfDrawable(osg::Drawable *childDrawable) const;
     osg::ref_ptr<osg::Group> m_root;
     osg::ref_ptr<osg::MatrixTransform> m_loadedModel;
-    osg::ref_ptr<osg::Group> m_clipBoard;
+    std::vector< osg::ref_ptr<osg::Node> > m_clipBoard;
     bool setObjectMask(const QModelIndex &index, const QVariant &value);
     bool setObjectName(const QModelIndex &index, const QVariant &value);
+    bool setObjectVisible(const QModelIndex &index, bool visible);
+
+    Item *m_rootItem;
+    mutable QHash<QPair<Item *, osg::Object *>, Item *> m_items;
+    mutable QMultiHash<osg::Object *, Item *> m_itemsByObject;
+    mutable QSet<Item *> m_parentItems;    ///< ones with an Item for a child
+
+    struct Analysis {
+        osg::observer_ptr<osg::Object> object;
+        QVariantMap values;
+    };
+    QHash<const osg::Object *, Analysis> m_analysis;
+
+    unsigned m_cullMask;
+
+    /// Layer bits a node had when it was unchecked, given back when it is
+    /// checked again
+    struct HiddenBits {
+        osg::observer_ptr<osg::Object> object;
+        unsigned bits;
+    };
+    QHash<const osg::Object *, HiddenBits> m_hiddenBits;
+
+    /// Tight box of each node in its parent's coordinates, see getWorldBound()
+    struct CachedBound {
+        osg::observer_ptr<osg::Node> node;
+        osg::BoundingBox box;
+    };
+    QHash<const osg::Node *, CachedBound> m_boundCache;
+    void forgetBounds(osg::Node *node);
+
+    // Memory is accounted separately for each loaded file (child of
+    // m_loadedModel) so an edit only has to recount the file it touched.
+    struct MemoryResult {
+        osg::ref_ptr<osg::Node> root;
+        MemoryReport report;
+    };
+    static QList<MemoryResult> accountMemory(QList< osg::ref_ptr<osg::Node> > roots);
+
+    /// Have memory accounting and the spatial index go over every loaded
+    /// file node is part of again
+    void markFilesDirty(osg::Node *node);
+    void waitForMemoryAccounting();
+
+    /// Wait for every reader of the scene graph before changing it
+    void aboutToEdit();
+
+    QHash<const osg::Node *, MemoryResult> m_memory;
+    QList< osg::ref_ptr<osg::Node> > m_memoryDirty;
+    QFutureWatcher< QList<MemoryResult> > m_memoryWatcher;
+    QTimer *m_memoryTimer;
+    bool m_memoryPending;
+
+    // The spatial index is updated on a worker thread too, per loaded file
+    // and on the same timer, so it is ready soon after things settle.
+    static SpatialIndex updateIndex(SpatialIndex index,
+                                    QList< osg::ref_ptr<osg::Node> > roots,
+                                    QList< osg::ref_ptr<osg::Node> > dirty,
+                                    osg::Matrixd toWorld);
+    void waitForIndexing();
+    QList<Item *> partItems(const QModelIndexList &indexes) const;
+    bool partIsUnder(const SpatialIndex::Part &part, const QList<Item *> &items) const;
+    std::vector<unsigned> partsUnder(const QModelIndexList &indexes);
+
+    QList<Clash> m_clashes;
+
+    /// The triangles of geode for pickPart(), built the first time it is asked
+    QSharedPointer<const TriangleTree> triangleTree(const osg::Geode *geode);
+    QHash<const osg::Geode *, QSharedPointer<const TriangleTree> > m_triangleTrees;
+    size_t m_triangleTreeBytes;
+    size_t m_triangleTreeLimit;    ///< view/pickCacheMB, in bytes
+
+    SpatialIndex m_spatialIndex;
+    QList< osg::ref_ptr<osg::Node> > m_indexDirty;
+    QFutureWatcher<SpatialIndex> m_indexWatcher;
+    bool m_indexPending;
+
+    UndoStack m_undoStack;
+    UndoCommand *m_macro;
+    int m_macroDepth;
 };
 
 #endif // OSGITEMMODEL_H
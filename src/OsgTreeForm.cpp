@@ -1,14 +1,19 @@
 #include "OsgTreeForm.h"
 #include "ui_OsgTreeForm.h"
+#include <QHeaderView>
+#include <QSortFilterProxyModel>
 #include <osg/Group>
 #include <osg/Geode>
 #include <osg/Geometry>
 
 #include "VariantPtr.h"
+#include "VertexCompressor.h"
 
 OsgTreeForm::OsgTreeForm(QWidget *parent) :
     QWidget(parent),
-    ui(new Ui::OsgTreeForm)
+    ui(new Ui::OsgTreeForm),
+    m_model(0),
+    m_sortModel(new QSortFilterProxyModel(this))
 {
     ui->setupUi(this);
     ui->splitter->setStretchFactor(0, 3);
@@ -19,6 +24,10 @@ OsgTreeForm::OsgTreeForm(QWidget *parent) :
 
     connect(ui->osgTreeView, SIGNAL(osgObjectActivated(osg::ref_ptr<osg::Object>)),
             this, SLOT(osgObjectActivated(osg::ref_ptr<osg::Object>)));
+    connect(ui->osgTreeView, SIGNAL(fitRequested(osg::BoundingBox)),
+            this, SIGNAL(fitRequested(osg::BoundingBox)));
+    connect(ui->osgTreeView, SIGNAL(sectionRequested(osg::BoundingBox)),
+            this, SIGNAL(sectionRequested(osg::BoundingBox)));
 
     connect(ui->osgTableWidget, SIGNAL(itemClicked(QTableWidgetItem*)),
             this, SLOT(itemClicked(QTableWidgetItem *)));
@@ -38,10 +47,28 @@ OsgTreeForm::~OsgTreeForm()
 
 void OsgTreeForm::setModel(OsgItemModel *model)
 {
-    ui->osgTreeView->setModel(model);
+    m_model = model;
+
+    // Sort on the raw values the model gives for UserRole, and start out
+    // in scene graph order until a header is clicked.
+    m_sortModel->setSourceModel(model);
+    m_sortModel->setSortRole(Qt::UserRole);
+    ui->osgTreeView->setModel(m_sortModel);
+    ui->osgTreeView->header()->setSortIndicator(-1, Qt::AscendingOrder);
+    ui->osgTreeView->setSortingEnabled(true);
 
     connect(model, SIGNAL(rowsInserted(QModelIndex,int,int)),
             ui->osgTreeView, SLOT(resizeColumnsToFit()));
+    connect(model, SIGNAL(memoryUsageChanged()),
+            this, SLOT(memoryUsageChanged()));
+}
+
+void OsgTreeForm::memoryUsageChanged()
+{
+    ui->osgTreeView->resizeColumnsToFit();
+
+    if (m_object.valid())
+        osgObjectActivated(m_object);
 }
 
 QTableWidgetItem * OsgTreeForm::getOrCreateWidgetItem(QTableWidget *tw, int row, int col)
@@ -99,7 +126,7 @@ QTableWidgetItem * OsgTreeForm::itemForKey(const QString key)
 void OsgTreeForm::osgObjectActivated(osg::ref_ptr<osg::Object> object)
 {
     qDebug("activated(%s)", object->getName().c_str());
-
+    m_object = object;
 
     for (int i=0 ; i < ui->osgTableWidget->rowCount() ; i++) {
         ui->osgTableWidget->hideRow(i);
@@ -108,6 +135,8 @@ void OsgTreeForm::osgObjectActivated(osg::ref_ptr<osg::Object> object)
     setTableValuesObject(object);
     setTableValuesNode(dynamic_cast<osg::Node *>(object.get()));
     setTableValuesDrawable(dynamic_cast<osg::Drawable *>(object.get()));
+    setTableValuesAnalysis(object.get());
+    setTableValuesMemory(object.get());
 
     ui->osgTableWidget->resizeColumnsToContents();
     ui->osgTableWidget->horizontalHeader()->setStretchLastSection(true);
@@ -166,6 +195,7 @@ void OsgTreeForm::setTableValuesNode(osg::Node *node)
 
     setTableValuesGroup(node->asGroup());
     setTableValuesGeode(node->asGeode());
+    setTableValuesLod(dynamic_cast<osg::LOD *>(node));
 }
 void OsgTreeForm::setTableValuesGroup(osg::Group *group)
 {
@@ -188,6 +218,21 @@ void OsgTreeForm::setTableValuesGeode(osg::Geode *geode)
                                                            ));
 }
 
+void OsgTreeForm::setTableValuesLod(osg::LOD *lod)
+{
+    if (!lod) return;
+
+    setTextForKey("LodRangeMode",
+                  lod->getRangeMode() == osg::LOD::PIXEL_SIZE_ON_SCREEN ?
+                      "PIXEL_SIZE_ON_SCREEN" : "DISTANCE_FROM_EYE_POINT");
+
+    QStringList ranges;
+    for (unsigned i=0 ; i < lod->getNumRanges() ; i++)
+        ranges << QString::asprintf("[%g %g)", lod->getMinRange(i), lod->getMaxRange(i));
+
+    setTextForKey("LodRanges", ranges.join(" "));
+}
+
 void OsgTreeForm::setTableValuesDrawable(osg::Drawable *drawable)
 {
     if (!drawable) return;
@@ -206,20 +251,54 @@ void OsgTreeForm::setTableValuesGeometry(osg::Geometry *geometry)
     setTextForKey("PrimitiveSets",
                   QString::asprintf("%d", geometry->getNumPrimitiveSets() ));
 
+    if (!array)
+        array = geometry->getVertexAttribArray(VertexCompressor::POSITION_ATTRIBUTE);
     if (array)
-        setTextForKey("VertexCount", QString::asprintf("%d", array->getNumElements()));
+        setTextForKey("VertexCount", QString::asprintf("%d %s", array->getNumElements(),
+                                                       array->className()));
 
 
     array = geometry->getNormalArray();
+    if (!array)
+        array = geometry->getVertexAttribArray(VertexCompressor::NORMAL_ATTRIBUTE);
     if (array)
-        setTextForKey("NormalCount", QString::asprintf("%d", array->getNumElements()));
+        setTextForKey("NormalCount", QString::asprintf("%d %s", array->getNumElements(),
+                                                       array->className()));
 
 
     array = geometry->getColorArray();
     if (array)
-        setTextForKey("ColorCount", QString::asprintf("%d", array->getNumElements()));
+        setTextForKey("ColorCount", QString::asprintf("%d %s", array->getNumElements(),
+                                                      array->className()));
 
     setTextForKey("TextCoordArrayCount",
                   QString::asprintf("%d", geometry->getNumTexCoordArrays()));
 
 }
+
+void OsgTreeForm::setTableValuesAnalysis(osg::Object *object)
+{
+    if (!m_model) return;
+
+    QVariantMap analysis = m_model->getAnalysis(object);
+    for (QVariantMap::const_iterator i = analysis.begin() ; i != analysis.end() ; ++i)
+        setTextForKey(i.key(), i.value().toString());
+}
+
+void OsgTreeForm::setTableValuesMemory(osg::Object *object)
+{
+    if (!m_model) return;
+
+    MemoryUsage usage;
+    if (m_model->getMemoryUsage(object, usage)) {
+        setTextForKey("MemoryTotal", MemoryAccountingVisitor::formatBytes(usage.total()));
+        setTextForKey("MemoryArrays", MemoryAccountingVisitor::formatBytes(usage.arrays));
+        setTextForKey("MemoryPrimitiveSets", MemoryAccountingVisitor::formatBytes(usage.primitives));
+        setTextForKey("MemoryImages", MemoryAccountingVisitor::formatBytes(usage.images));
+        setTextForKey("MemoryStateSets", MemoryAccountingVisitor::formatBytes(usage.stateSets));
+        setTextForKey("MemoryNodes", MemoryAccountingVisitor::formatBytes(usage.nodes));
+    }
+
+    setTextForKey("MemoryScene",
+                  MemoryAccountingVisitor::formatBytes(m_model->getSceneMemoryUsage().total()));
+}
@@ -8,8 +8,10 @@
 
 class QTableWidgetItem;
 class QTableWidget;
+class QSortFilterProxyModel;
 #include <osg/Drawable>
 #include <osg/Geometry>
+#include <osg/LOD>
 
 namespace Ui {
 class OsgTreeForm;
@@ -24,24 +26,39 @@ public:
     ~OsgTreeForm();
 
     void setModel(OsgItemModel *model);
+
+signals:
+    /// See OsgTreeView::fitRequested()
+    void fitRequested(osg::BoundingBox box);
+
+    /// See OsgTreeView::sectionRequested()
+    void sectionRequested(osg::BoundingBox box);
+
 private slots:
     void osgObjectActivated(osg::ref_ptr<osg::Object> object);
     void itemClicked(QTableWidgetItem * item);
+    void memoryUsageChanged();
 
 private:
     void setTableValuesObject(osg::ref_ptr<osg::Object> object);
     void setTableValuesNode(osg::Node * node);
     void setTableValuesGroup(osg::Group *group);
     void setTableValuesGeode(osg::Geode *geode);
+    void setTableValuesLod(osg::LOD *lod);
     void setTableValuesDrawable(osg::Drawable *drawable);
 
     void setTableValuesGeometry(osg::Geometry *geometry);
+    void setTableValuesAnalysis(osg::Object *object);
+    void setTableValuesMemory(osg::Object *object);
 
     QTableWidgetItem *getOrCreateWidgetItem(QTableWidget *tw, int row, int col);
     QTableWidgetItem *itemForKey(const QString key);
     void setTextForKey(const QString key, const QString value = QString(""));
 
     Ui::OsgTreeForm *ui;
+    OsgItemModel *m_model;
+    QSortFilterProxyModel *m_sortModel;
+    osg::ref_ptr<osg::Object> m_object; ///< what the table is showing
     QTableWidgetItem *setKeyChecked(const QString key, const bool value);
 };
 
@@ -1,11 +1,21 @@
 #include "OsgTreeView.h"
 #include <QMenu>
+#include <QApplication>
+#include <QAbstractProxyModel>
+#include <QInputDialog>
+#include <QSettings>
 #include "OsgItemModel.h"
 
 OsgTreeView::OsgTreeView(QWidget *parent) : QTreeView(parent)
 {
     setContextMenuPolicy(Qt::CustomContextMenu);
 
+    // drag nodes to another group, holding Ctrl to share rather than move
+    setSelectionMode(QAbstractItemView::ExtendedSelection);
+    setDragDropMode(QAbstractItemView::DragDrop);
+    setDefaultDropAction(Qt::MoveAction);
+    setDropIndicatorShown(true);
+
     connect(this, SIGNAL(customContextMenuRequested(QPoint)),
             this, SLOT(customMenuRequested(QPoint)));
 
@@ -19,10 +29,46 @@ OsgTreeView::OsgTreeView(QWidget *parent) : QTreeView(parent)
     connect(this, SIGNAL(clicked(QModelIndex)),
             this, SLOT(announceObject(QModelIndex)));
 
-    popupMenu.addAction(new QAction("Copy", this));
-    popupMenu.addAction(new QAction("Cut", this));
-    popupMenu.addAction(new QAction("Paste", this));
+    QAction *action = popupMenu.addAction("Copy", this, SLOT(copy()), QKeySequence::Copy);
+    action->setShortcutContext(Qt::WidgetShortcut);
+    addAction(action);
+    action = popupMenu.addAction("Cut", this, SLOT(cut()), QKeySequence::Cut);
+    action->setShortcutContext(Qt::WidgetShortcut);
+    addAction(action);
+    action = popupMenu.addAction("Paste", this, SLOT(paste()), QKeySequence::Paste);
+    action->setShortcutContext(Qt::WidgetShortcut);
+    addAction(action);
+    popupMenu.addSeparator();
+    action = popupMenu.addAction("Zoom To Selection", this, SLOT(zoomToSelection()),
+                                 QKeySequence(Qt::Key_F));
+    action->setShortcutContext(Qt::WidgetShortcut);
+    addAction(action);
+    popupMenu.addAction("Section To Selection", this, SLOT(sectionToSelection()));
+    popupMenu.addAction("Select Parts Nearby...", this, SLOT(selectPartsNear()));
+    popupMenu.addAction("Select Nearest Part", this, SLOT(selectNearestPart()));
+    popupMenu.addAction("Mark For Clash Check", this, SLOT(markForClashCheck()));
+    popupMenu.addAction("Check Clashes With Marked...", this, SLOT(checkClashes()));
+    popupMenu.addSeparator();
+    popupMenu.addAction("Generate LOD", this, SLOT(generateLod()));
+    popupMenu.addAction("Find Duplicates", this, SLOT(findDuplicates()));
+    popupMenu.addAction("Share Duplicates", this, SLOT(shareDuplicates()));
+    popupMenu.addAction("Optimize Vertex Cache", this, SLOT(optimizeVertexCache()));
+    popupMenu.addAction("Compress Vertex Attributes", this, SLOT(compressVertices()));
+    popupMenu.addSeparator();
+
+    QMenu *maskMenu = popupMenu.addMenu("Node Mask");
+    maskMenu->addAction("Set Bits...", this, SLOT(setMaskBits()));
+    maskMenu->addAction("Clear Bits...", this, SLOT(clearMaskBits()));
+    maskMenu->addAction("Toggle Bits...", this, SLOT(toggleMaskBits()));
+    maskMenu->addSeparator();
+    m_maskSubtree = maskMenu->addAction("Include Subtrees");
+    m_maskSubtree->setCheckable(true);
 
+    m_layerMenu = popupMenu.addMenu("Layers");
+    connect(m_layerMenu, SIGNAL(aboutToShow()),
+            this, SLOT(buildLayerMenu()));
+    connect(m_layerMenu, SIGNAL(triggered(QAction*)),
+            this, SLOT(toggleLayer(QAction*)));
 }
 
 
@@ -30,6 +76,24 @@ void OsgTreeView::resizeColumnsToFit()
 {
     this->resizeColumnToContents(0);
     this->resizeColumnToContents(1);
+    this->resizeColumnToContents(3);
+}
+
+OsgItemModel *OsgTreeView::itemModel() const
+{
+    QAbstractItemModel *model = this->model();
+    if (QAbstractProxyModel *proxy = dynamic_cast<QAbstractProxyModel *>(model))
+        model = proxy->sourceModel();
+
+    return dynamic_cast<OsgItemModel *>(model);
+}
+
+QModelIndex OsgTreeView::sourceIndex(const QModelIndex &index) const
+{
+    if (QAbstractProxyModel *proxy = dynamic_cast<QAbstractProxyModel *>(this->model()))
+        return proxy->mapToSource(index);
+
+    return index;
 }
 
 void OsgTreeView::customMenuRequested(QPoint pos)
@@ -39,10 +103,372 @@ void OsgTreeView::customMenuRequested(QPoint pos)
 
 void OsgTreeView::announceObject(const QModelIndex &index)
 {
-    OsgItemModel *model = dynamic_cast<OsgItemModel *>(this->model());
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    emit osgObjectActivated(model->getObjectFromModelIndex(sourceIndex(index)));
+}
+
+void OsgTreeView::copy()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    model->copy(sourceIndex(currentIndex()));
+}
+
+void OsgTreeView::cut()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    model->cut(sourceIndex(currentIndex()));
+}
+
+void OsgTreeView::paste()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    model->paste(sourceIndex(currentIndex()));
+}
+
+void OsgTreeView::generateLod()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->generateLod(sourceIndex(currentIndex()));
+    QApplication::restoreOverrideCursor();
+}
+
+void OsgTreeView::findDuplicates()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->findDuplicates(sourceIndex(currentIndex()));
+    QApplication::restoreOverrideCursor();
+
+    announceObject(currentIndex());
+}
+
+void OsgTreeView::shareDuplicates()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->shareDuplicates(sourceIndex(currentIndex()));
+    QApplication::restoreOverrideCursor();
+
+    announceObject(currentIndex());
+}
+
+void OsgTreeView::optimizeVertexCache()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->optimizeVertexCache(sourceIndex(currentIndex()));
+    QApplication::restoreOverrideCursor();
+
+    announceObject(currentIndex());
+}
+
+void OsgTreeView::compressVertices()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->compressVertices(sourceIndex(currentIndex()));
+    QApplication::restoreOverrideCursor();
+
+    announceObject(currentIndex());
+}
+
+void OsgTreeView::applyMask(int operation, const QString title)
+{
+    OsgItemModel *model = itemModel();
 
     if (!model)
         return;
 
-    emit osgObjectActivated(model->getObjectFromModelIndex(index));
+    bool ok = false;
+    QString text = QInputDialog::getText(this, title, "Bits (hex)",
+                                         QLineEdit::Normal, "00000001", &ok);
+    if (!ok)
+        return;
+
+    unsigned bits = text.toUInt(&ok, 16);
+    if (!ok || bits == 0)
+        return;
+
+    QModelIndexList indexes;
+    foreach (const QModelIndex &index, selectionModel()->selectedRows(0))
+        indexes << sourceIndex(index);
+    if (indexes.isEmpty())
+        indexes << sourceIndex(currentIndex());
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->applyMask(indexes, (OsgItemModel::MaskOperation)operation, bits,
+                     m_maskSubtree->isChecked());
+    QApplication::restoreOverrideCursor();
+
+    announceObject(currentIndex());
+}
+
+void OsgTreeView::setMaskBits()
+{
+    applyMask(OsgItemModel::SET_BITS, "Set Mask Bits");
+}
+
+void OsgTreeView::clearMaskBits()
+{
+    applyMask(OsgItemModel::CLEAR_BITS, "Clear Mask Bits");
+}
+
+void OsgTreeView::toggleMaskBits()
+{
+    applyMask(OsgItemModel::TOGGLE_BITS, "Toggle Mask Bits");
+}
+
+/// Layers are node mask bits with a name.  The names are kept in the
+/// settings so they carry over between models.
+static QString layerKey(int bit)
+{
+    return QString("layers/bit%1").arg(bit);
+}
+
+void OsgTreeView::buildLayerMenu()
+{
+    OsgItemModel *model = itemModel();
+
+    m_layerMenu->clear();
+    if (!model)
+        return;
+
+    QSettings settings;
+    for (int bit=0 ; bit < 32 ; bit++) {
+        QString name = settings.value(layerKey(bit)).toString();
+        if (name.isEmpty())
+            continue;
+
+        QAction *action = m_layerMenu->addAction(QString("%1 (bit %2)").arg(name).arg(bit));
+        action->setCheckable(true);
+        action->setChecked(model->getCullMask() & (1u << bit));
+        action->setData(bit);
+    }
+
+    m_layerMenu->addSeparator();
+    m_layerMenu->addAction("Show All Layers", this, SLOT(showAllLayers()));
+    m_layerMenu->addAction("Name Layer...", this, SLOT(nameLayer()));
+}
+
+void OsgTreeView::toggleLayer(QAction *action)
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model || !action->data().isValid())
+        return;
+
+    model->setCullMask(model->getCullMask() ^ (1u << action->data().toInt()));
+}
+
+void OsgTreeView::showAllLayers()
+{
+    OsgItemModel *model = itemModel();
+
+    if (!model)
+        return;
+
+    model->setCullMask(~0u);
+}
+
+void OsgTreeView::nameLayer()
+{
+    bool ok = false;
+    int bit = QInputDialog::getInt(this, "Name Layer", "Mask bit", 0, 0, 31, 1, &ok);
+    if (!ok)
+        return;
+
+    QSettings settings;
+    QString name = QInputDialog::getText(this, "Name Layer",
+                                         QString("Name for bit %1 (empty to forget it)").arg(bit),
+                                         QLineEdit::Normal,
+                                         settings.value(layerKey(bit)).toString(), &ok);
+    if (!ok)
+        return;
+
+    if (name.isEmpty())
+        settings.remove(layerKey(bit));
+    else
+        settings.setValue(layerKey(bit), name);
+}
+
+void OsgTreeView::zoomToSelection()
+{
+    OsgItemModel *model = itemModel();
+    if (!model)
+        return;
+
+    QModelIndexList indexes = selectedSourceRows();
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    osg::BoundingBox box = model->getWorldBound(indexes);
+    QApplication::restoreOverrideCursor();
+
+    if (box.valid())
+        emit fitRequested(box);
+}
+
+QModelIndexList OsgTreeView::selectedSourceRows() const
+{
+    QModelIndexList indexes;
+    foreach (const QModelIndex &index, selectionModel()->selectedRows(0))
+        indexes.append(sourceIndex(index));
+    if (indexes.isEmpty() && currentIndex().isValid())
+        indexes.append(sourceIndex(currentIndex()));
+    return indexes;
+}
+
+void OsgTreeView::selectSourceRows(const QModelIndexList &indexes)
+{
+    QAbstractProxyModel *proxy = dynamic_cast<QAbstractProxyModel *>(this->model());
+
+    QItemSelection selection;
+    foreach (const QModelIndex &index, indexes) {
+        QModelIndex viewIndex = proxy ? proxy->mapFromSource(index) : index;
+        if (!viewIndex.isValid())
+            continue;
+
+        selection.select(viewIndex, viewIndex);
+        for (QModelIndex p = viewIndex.parent() ; p.isValid() ; p = p.parent())
+            expand(p);
+    }
+
+    selectionModel()->select(selection, QItemSelectionModel::ClearAndSelect |
+                                        QItemSelectionModel::Rows);
+    if (!selection.isEmpty())
+        scrollTo(selection.indexes().first());
+}
+
+void OsgTreeView::selectPartsNear()
+{
+    OsgItemModel *model = itemModel();
+    QModelIndexList indexes = selectedSourceRows();
+    if (!model || indexes.isEmpty())
+        return;
+
+    QSettings settings;
+    bool ok = false;
+    double distance = QInputDialog::getDouble(this, "Select Parts Nearby",
+                                              "Within distance of the selection:",
+                                              settings.value("tree/nearbyDistance", 2.0).toDouble(),
+                                              0.0, 1e12, 3, &ok);
+    if (!ok)
+        return;
+    settings.setValue("tree/nearbyDistance", distance);
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QModelIndexList found = model->findPartsNear(indexes, distance);
+    QApplication::restoreOverrideCursor();
+
+    selectSourceRows(found);
+}
+
+void OsgTreeView::selectNearestPart()
+{
+    OsgItemModel *model = itemModel();
+    QModelIndexList indexes = selectedSourceRows();
+    if (!model || indexes.isEmpty())
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QModelIndex nearest = model->findNearestPart(indexes);
+    QApplication::restoreOverrideCursor();
+
+    if (nearest.isValid())
+        selectSourceRows(QModelIndexList() << nearest);
+}
+
+void OsgTreeView::markForClashCheck()
+{
+    m_clashMarked.clear();
+    foreach (const QModelIndex &index, selectedSourceRows())
+        m_clashMarked << QPersistentModelIndex(index);
+}
+
+void OsgTreeView::checkClashes()
+{
+    OsgItemModel *model = itemModel();
+    QModelIndexList indexes = selectedSourceRows();
+    if (!model || indexes.isEmpty())
+        return;
+
+    // marked places may have been deleted since
+    QModelIndexList marked;
+    foreach (const QPersistentModelIndex &index, m_clashMarked) {
+        if (index.isValid())
+            marked << index;
+    }
+    if (marked.isEmpty())
+        return;
+
+    QSettings settings;
+    bool ok = false;
+    double tolerance = QInputDialog::getDouble(this, "Check Clashes",
+                                               "Ignore interference up to:",
+                                               settings.value("clash/tolerance", 1e-4).toDouble(),
+                                               0.0, 1e12, 6, &ok);
+    if (!ok)
+        return;
+    settings.setValue("clash/tolerance", tolerance);
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    model->checkClashes(marked, indexes, tolerance);
+    QApplication::restoreOverrideCursor();
+}
+
+void OsgTreeView::sectionToSelection()
+{
+    OsgItemModel *model = itemModel();
+    QModelIndexList indexes = selectedSourceRows();
+    if (!model || indexes.isEmpty())
+        return;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    osg::BoundingBox box = model->getWorldBound(indexes);
+    QApplication::restoreOverrideCursor();
+
+    if (!box.valid())
+        return;
+
+    // a little room, so the faces of the selection are not cut themselves
+    const float margin = box.radius() * 0.01f;
+    box.expandBy(box._min - osg::Vec3(margin, margin, margin));
+    box.expandBy(box._max + osg::Vec3(margin, margin, margin));
+    emit sectionRequested(box);
 }
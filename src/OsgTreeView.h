@@ -3,9 +3,13 @@
 
 #include <QTreeView>
 #include <QMenu>
+#include <QPersistentModelIndex>
 
 #include <osg/ref_ptr>
 #include <osg/Object>
+#include <osg/BoundingBox>
+
+class OsgItemModel;
 
 class OsgTreeView : public QTreeView
 {
@@ -16,14 +20,55 @@ public:
 signals:
     void osgObjectActivated(osg::ref_ptr<osg::Object> object);
 
+    /// Show box (in the coordinates of the model's root) in the 3D view
+    void fitRequested(osg::BoundingBox box);
+
+    /// Clip the 3D view to box (in the coordinates of the model's root)
+    void sectionRequested(osg::BoundingBox box);
+
 public slots:
     void resizeColumnsToFit();
     void customMenuRequested(QPoint pos);
 private slots:
     void announceObject(const QModelIndex & index);
+    void copy();
+    void cut();
+    void paste();
+    void generateLod();
+    void findDuplicates();
+    void shareDuplicates();
+    void optimizeVertexCache();
+    void compressVertices();
+    void setMaskBits();
+    void clearMaskBits();
+    void toggleMaskBits();
+    void buildLayerMenu();
+    void toggleLayer(QAction *action);
+    void showAllLayers();
+    void nameLayer();
+    void zoomToSelection();
+    void sectionToSelection();
+    void selectPartsNear();
+    void selectNearestPart();
+    void markForClashCheck();
+    void checkClashes();
 
 private:
+    /// The OsgItemModel behind any sorting/filtering proxy
+    OsgItemModel *itemModel() const;
+    QModelIndex sourceIndex(const QModelIndex &index) const;
+    void applyMask(int operation, const QString title);
+    QModelIndexList selectedSourceRows() const;
+
+    /// Select (and show) the places at indexes of the OsgItemModel
+    void selectSourceRows(const QModelIndexList &indexes);
+
     QMenu popupMenu;
+    QAction *m_maskSubtree;
+    QMenu *m_layerMenu;
+
+    /// One side of the next clash check, as OsgItemModel places
+    QList<QPersistentModelIndex> m_clashMarked;
 };
 
 #endif // OSGTREEVIEW_H
@@ -0,0 +1,176 @@
+#include "ProxyCullVisitor.h"
+
+#include <osg/ClipNode>
+#include <osg/FrameStamp>
+#include <osg/Geode>
+#include <osg/LOD>
+#include <osg/Transform>
+#include <OpenThreads/ScopedLock>
+
+#include <cmath>
+
+/// The box all proxies share, two units on a side around the origin
+static osg::ShapeDrawable *proxyBox()
+{
+    static osg::ref_ptr<osg::ShapeDrawable> box;
+    if (!box.valid()) {
+        box = new osg::ShapeDrawable(new osg::Box(osg::Vec3(), 2.0f));
+        box->setColor(osg::Vec4(0.6f, 0.6f, 0.6f, 1.0f));
+        box->setDataVariance(osg::Object::STATIC);
+    }
+    return box.get();
+}
+
+ProxyCullVisitor::ProxyCullVisitor()
+    : m_proxyPixels(0.0f)
+    , m_belowClipNode(false)
+    , m_box(proxyBox())
+    , m_keepNearFar(false)
+    , m_culledNear(0.0)
+    , m_culledFar(0.0)
+    , m_culledFrame(0)
+    , m_culled(false)
+{
+}
+
+ProxyCullVisitor::ProxyCullVisitor(const ProxyCullVisitor &rhs)
+    : osgUtil::CullVisitor(rhs)
+    , m_proxyPixels(rhs.m_proxyPixels)
+    , m_clipPlanes(rhs.m_clipPlanes)
+    , m_belowClipNode(false)
+    , m_box(rhs.m_box)
+    , m_keepNearFar(rhs.m_keepNearFar)
+    , m_culledNear(0.0)
+    , m_culledFar(0.0)
+    , m_culledFrame(0)
+    , m_culled(false)
+{
+}
+
+void ProxyCullVisitor::apply(osg::ClipNode &clipNode)
+{
+    const bool below = m_belowClipNode;
+    m_belowClipNode = true;
+    osgUtil::CullVisitor::apply(clipNode);
+    m_belowClipNode = below;
+}
+
+void ProxyCullVisitor::apply(osg::Group &group)
+{
+    if (!isClippedAway(group) && !drawProxy(group, osg::BoundingBox()))
+        osgUtil::CullVisitor::apply(group);
+}
+
+void ProxyCullVisitor::apply(osg::Transform &transform)
+{
+    if (!isClippedAway(transform) && !drawProxy(transform, osg::BoundingBox()))
+        osgUtil::CullVisitor::apply(transform);
+}
+
+void ProxyCullVisitor::apply(osg::LOD &lod)
+{
+    if (!isClippedAway(lod) && !drawProxy(lod, osg::BoundingBox()))
+        osgUtil::CullVisitor::apply(lod);
+}
+
+void ProxyCullVisitor::apply(osg::Geode &geode)
+{
+    if (!isClippedAway(geode) && !drawProxy(geode, geode.getBoundingBox()))
+        osgUtil::CullVisitor::apply(geode);
+}
+
+bool ProxyCullVisitor::isClippedAway(osg::Node &node)
+{
+    if (!m_belowClipNode || m_clipPlanes.empty())
+        return false;
+
+    const osg::BoundingSphere &bs = node.getBound();
+    if (!bs.valid())
+        return false;
+
+    // Bring the planes to the node rather than the node to the planes.
+    // The bound is in the coordinates the model view matrix starts from.
+    const osg::Matrix &modelView = *getModelViewMatrix();
+    for (unsigned i=0 ; i < m_clipPlanes.size() ; i++) {
+        osg::Plane plane = m_clipPlanes[i];
+        plane.transformProvidingInverse(modelView);
+        if (plane.intersect(bs) < 0)
+            return true;
+    }
+    return false;
+}
+
+bool ProxyCullVisitor::drawProxy(osg::Node &node, const osg::BoundingBox &box)
+{
+    if (m_proxyPixels <= 0.0f)
+        return false;
+
+    const osg::BoundingSphere &bs = node.getBound();
+    if (!bs.valid())
+        return false;
+
+    // the regular traversal would give up on it too
+    if (isCulled(node))
+        return true;
+
+    if (clampedPixelSize(bs) >= m_proxyPixels)
+        return false;
+
+    // Geodes keep a bounding box, anything else only has a sphere.  The
+    // cube that fits inside the sphere is close enough at this size.
+    osg::Vec3 center = bs.center();
+    osg::Vec3 halfSize(bs.radius(), bs.radius(), bs.radius());
+    halfSize /= sqrtf(3.0f);
+    if (box.valid()) {
+        center = box.center();
+        halfSize = (box._max - box._min) * 0.5f;
+    }
+
+    osg::RefMatrix *matrix = createOrReuseMatrix(osg::Matrix::scale(halfSize) *
+                                                 osg::Matrix::translate(center) *
+                                                 *getModelViewMatrix());
+
+    if (getComputeNearFarMode() != osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR)
+        updateCalculatedNearFar(*matrix, m_box->getBoundingBox());
+
+    addDrawableAndDepth(m_box.get(), matrix, getDistanceFromEyePoint(bs.center(), false));
+    return true;
+}
+
+bool ProxyCullVisitor::getCulledDepthRange(double &zNear, double &zFar, unsigned &frameNumber) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_depthMutex);
+    zNear = m_culledNear;
+    zFar = m_culledFar;
+    frameNumber = m_culledFrame;
+    return m_culled;
+}
+
+bool ProxyCullVisitor::clampProjectionMatrixImplementation(osg::Matrixf &projection,
+                                                           double &znear, double &zfar) const
+{
+    if (!m_keepNearFar)
+        return osgUtil::CullVisitor::clampProjectionMatrixImplementation(projection, znear, zfar);
+    recordDepthRange(znear, zfar);
+    return true;
+}
+
+bool ProxyCullVisitor::clampProjectionMatrixImplementation(osg::Matrixd &projection,
+                                                           double &znear, double &zfar) const
+{
+    if (!m_keepNearFar)
+        return osgUtil::CullVisitor::clampProjectionMatrixImplementation(projection, znear, zfar);
+    recordDepthRange(znear, zfar);
+    return true;
+}
+
+void ProxyCullVisitor::recordDepthRange(double znear, double zfar) const
+{
+    // The cull only asks for clamping when it kept something, a stale
+    // frame number tells the reader that it did not.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_depthMutex);
+    m_culledNear = znear;
+    m_culledFar = zfar;
+    m_culledFrame = getFrameStamp() ? getFrameStamp()->getFrameNumber() : 0;
+    m_culled = true;
+}
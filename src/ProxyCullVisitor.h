@@ -0,0 +1,86 @@
+#ifndef PROXYCULLVISITOR_H
+#define PROXYCULLVISITOR_H
+
+#include <osgUtil/CullVisitor>
+#include <osg/Plane>
+#include <osg/ShapeDrawable>
+#include <OpenThreads/Mutex>
+
+#include <vector>
+
+/// A CullVisitor that can stand a box in for whole subtrees.
+///
+/// While the camera is moving, a group, transform or geode that covers
+/// fewer than getProxyPixelSize() pixels on screen is not traversed at
+/// all.  A shaded box the size of its bound is drawn instead, so the
+/// overall shape stays on screen for the cost of one drawable.
+///
+/// Below a ClipNode it can also leave out subtrees that lie wholly on the
+/// clipped side of a clip plane, which the clip planes would only throw
+/// away after drawing them.
+///
+/// While near/far is computed it can leave the projection's planes alone
+/// and keep the depth range it found for the next frame's projection.
+class ProxyCullVisitor : public osgUtil::CullVisitor
+{
+public:
+    ProxyCullVisitor();
+    ProxyCullVisitor(const ProxyCullVisitor &rhs);
+
+    virtual osgUtil::CullVisitor *clone() const { return new ProxyCullVisitor(*this); }
+
+    /// Subtrees smaller than this on screen are drawn as boxes, 0 (the
+    /// default) draws everything as it is
+    void setProxyPixelSize(float pixels) { m_proxyPixels = pixels; }
+    float getProxyPixelSize() const { return m_proxyPixels; }
+
+    /// Planes (in eye coordinates) that subtrees below a ClipNode are
+    /// culled against, what is below any of them is left out.  Empty (the
+    /// default) culls nothing for clipping.
+    void setClipPlanes(const std::vector<osg::Plane> &planes) { m_clipPlanes = planes; }
+    const std::vector<osg::Plane> &getClipPlanes() const { return m_clipPlanes; }
+
+    /// With near/far computed, record the range instead of clamping the
+    /// projection to it (see getCulledDepthRange()).  Off by default.
+    void setKeepNearFar(bool keep) { m_keepNearFar = keep; }
+    bool getKeepNearFar() const { return m_keepNearFar; }
+
+    /// Eye distances of the nearest and farthest things the last cull with
+    /// kept near/far found, and the number of the frame it culled.  False
+    /// when no cull has found anything yet.
+    bool getCulledDepthRange(double &zNear, double &zFar, unsigned &frameNumber) const;
+
+    virtual bool clampProjectionMatrixImplementation(osg::Matrixf &projection, double &znear, double &zfar) const;
+    virtual bool clampProjectionMatrixImplementation(osg::Matrixd &projection, double &znear, double &zfar) const;
+
+    using osgUtil::CullVisitor::apply;
+    virtual void apply(osg::ClipNode &clipNode);
+    virtual void apply(osg::Group &group);
+    virtual void apply(osg::Transform &transform);
+    virtual void apply(osg::LOD &lod);
+    virtual void apply(osg::Geode &geode);
+
+private:
+    /// True when node was drawn as a box (or culled) and must not be traversed
+    bool drawProxy(osg::Node &node, const osg::BoundingBox &box);
+
+    /// True when node is wholly clipped away
+    bool isClippedAway(osg::Node &node);
+
+    /// Keeps znear and zfar for getCulledDepthRange()
+    void recordDepthRange(double znear, double zfar) const;
+
+    float m_proxyPixels;
+    std::vector<osg::Plane> m_clipPlanes;
+    bool m_belowClipNode;
+    osg::ref_ptr<osg::ShapeDrawable> m_box;
+
+    bool m_keepNearFar;
+    // written by the cull, read from the GUI thread
+    mutable OpenThreads::Mutex m_depthMutex;
+    mutable double m_culledNear, m_culledFar;
+    mutable unsigned m_culledFrame;
+    mutable bool m_culled;
+};
+
+#endif // PROXYCULLVISITOR_H
@@ -0,0 +1,429 @@
+#include "SpatialIndex.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QThread>
+
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+
+#include <algorithm>
+#include <cfloat>
+#include <queue>
+
+static bool debugIndex = false;
+#define indexDebug if (debugIndex) qDebug
+
+namespace {
+
+/// Parts per leaf of the hierarchy
+const unsigned leafSize = 4;
+
+/// Subtrees smaller than this are built by whichever thread gets to them
+const unsigned parallelSize = 4096;
+
+/// A part found by the PartCollector, not yet in world coordinates
+struct PartJob {
+    std::vector<SpatialIndex::Part> *parts;
+    size_t part;
+    osg::BoundingBox local;
+    osg::Matrixd matrix;
+};
+
+void transformPart(PartJob &job)
+{
+    osg::BoundingBox &box = (*job.parts)[job.part].box;
+    box.init();
+    if (!job.local.valid())
+        return;
+    for (unsigned c=0 ; c < 8 ; c++)
+        box.expandBy(job.local.corner(c) * job.matrix);
+}
+
+class PartCollector : public osg::NodeVisitor
+{
+public:
+    PartCollector(std::vector<SpatialIndex::Part> &parts,
+                  std::vector<PartJob> &jobs,
+                  const osg::Matrixd &toWorld)
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ACTIVE_CHILDREN)
+        , m_parts(parts)
+        , m_jobs(jobs)
+        , m_toWorld(toWorld) {}
+
+    void apply(osg::Geode &geode) {
+        const osg::NodePath &path = getNodePath();
+
+        SpatialIndex::Part part;
+        part.path.assign(path.begin(), path.end());
+        for (unsigned i=0 ; i < path.size() ; i++) {
+            const unsigned mask = path[i]->getNodeMask();
+            if (mask != ~0u && std::find(part.masks.begin(), part.masks.end(), mask) == part.masks.end())
+                part.masks.push_back(mask);
+        }
+        m_parts.push_back(part);
+
+        // the parts vector still grows, so keep the position, not the address
+        PartJob job;
+        job.parts = &m_parts;
+        job.part = m_parts.size() - 1;
+        job.local = geode.getBoundingBox();
+        job.matrix = osg::computeLocalToWorld(path) * m_toWorld;
+        m_jobs.push_back(job);
+    }
+
+private:
+    std::vector<SpatialIndex::Part> &m_parts;
+    std::vector<PartJob> &m_jobs;
+    osg::Matrixd m_toWorld;
+};
+
+double distanceToBox(const osg::Vec3d &point, const osg::BoundingBox &box)
+{
+    osg::Vec3d d;
+    for (int a=0 ; a < 3 ; a++) {
+        if (point[a] < box._min[a])
+            d[a] = box._min[a] - point[a];
+        else if (point[a] > box._max[a])
+            d[a] = point[a] - box._max[a];
+    }
+    return d.length();
+}
+
+/// Whether the segment start + t * (1/inverse), 0 <= t <= 1, passes
+/// through box, and from which t
+bool segmentEnters(const osg::Vec3d &start, const osg::Vec3d &inverse,
+                   const osg::BoundingBox &box, double &enter)
+{
+    double tNear = 0.0;
+    double tFar = 1.0;
+    for (int a=0 ; a < 3 ; a++) {
+        double t0 = (box._min[a] - start[a]) * inverse[a];
+        double t1 = (box._max[a] - start[a]) * inverse[a];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        // along a face the segment runs parallel to, 0 * inf gives nan
+        if (t0 == t0)
+            tNear = std::max(tNear, t0);
+        if (t1 == t1)
+            tFar = std::min(tFar, t1);
+        if (tNear > tFar)
+            return false;
+    }
+    enter = tNear;
+    return true;
+}
+
+}
+
+/// A subtree of the hierarchy for one thread to build
+struct SpatialIndex::BuildJob {
+    SpatialIndex *index;
+    unsigned node;
+    unsigned first;
+    unsigned count;
+};
+
+bool SpatialIndex::Part::showsUnder(unsigned mask) const
+{
+    if (mask == 0)
+        return false;
+
+    for (unsigned i=0 ; i < masks.size() ; i++) {
+        if (!(masks[i] & mask))
+            return false;
+    }
+    return true;
+}
+
+SpatialIndex::SpatialIndex()
+    : m_mask(~0u)
+{
+}
+
+void SpatialIndex::update(const QList< osg::ref_ptr<osg::Node> > &roots,
+                          const QList< osg::ref_ptr<osg::Node> > &dirty,
+                          const osg::Matrixd &toWorld)
+{
+    const bool everything = toWorld != m_toWorld;
+    m_toWorld = toWorld;
+
+    QHash<const osg::Node *, File> files;
+    std::vector<PartJob> jobs;
+    int gathered = 0;
+
+    foreach (const osg::ref_ptr<osg::Node> &root, roots) {
+        QHash<const osg::Node *, File>::const_iterator old = m_files.find(root.get());
+        if (!everything && !dirty.contains(root) &&
+                old != m_files.end() && old->root == root) {
+            files.insert(root.get(), *old);
+            continue;
+        }
+
+        QSharedPointer< std::vector<Part> > parts(new std::vector<Part>);
+        PartCollector collector(*parts, jobs, toWorld);
+        root->accept(collector);
+
+        File file;
+        file.root = root;
+        file.parts = parts;
+        files.insert(root.get(), file);
+        gathered++;
+    }
+
+    QtConcurrent::blockingMap(jobs, transformPart);
+    m_files = files;
+
+    indexDebug("%d files, %d gathered again, %u parts transformed",
+               m_files.size(), gathered, (unsigned)jobs.size());
+
+    rebuild();
+}
+
+void SpatialIndex::clear()
+{
+    m_files.clear();
+    m_parts.clear();
+    m_order.clear();
+    m_nodes.clear();
+}
+
+void SpatialIndex::rebuild()
+{
+    m_parts.clear();
+    foreach (const File &file, m_files) {
+        for (unsigned i=0 ; i < file.parts->size() ; i++) {
+            if ((*file.parts)[i].box.valid())
+                m_parts.push_back(&(*file.parts)[i]);
+        }
+    }
+
+    m_order.resize(m_parts.size());
+    for (unsigned i=0 ; i < m_order.size() ; i++)
+        m_order[i] = i;
+
+    m_nodes.clear();
+    if (m_parts.empty())
+        return;
+
+    // Every subtree's place in m_nodes follows from its size alone, so
+    // subtrees can be built side by side without sharing anything.
+    m_nodes.resize(nodeCount(m_parts.size()));
+
+    std::vector<BuildJob> jobs;
+    unsigned depth = 0;
+    while ((1u << depth) < 4 * (unsigned)QThread::idealThreadCount())
+        depth++;
+    buildTop(0, 0, m_parts.size(), depth, jobs);
+    QtConcurrent::blockingMap(jobs, runBuildJob);
+
+    indexDebug("%u parts, %u nodes, %u jobs",
+               (unsigned)m_parts.size(), (unsigned)m_nodes.size(), (unsigned)jobs.size());
+}
+
+void SpatialIndex::runBuildJob(BuildJob &job)
+{
+    job.index->build(job.node, job.first, job.count);
+}
+
+void SpatialIndex::buildTop(unsigned node, unsigned first, unsigned count, unsigned depth,
+                            std::vector<BuildJob> &jobs)
+{
+    if (depth == 0 || count <= parallelSize) {
+        BuildJob job;
+        job.index = this;
+        job.node = node;
+        job.first = first;
+        job.count = count;
+        jobs.push_back(job);
+        return;
+    }
+
+    const unsigned half = split(node, first, count);
+    buildTop(node + 1, first, half, depth - 1, jobs);
+    buildTop(m_nodes[node].right, first + half, count - half, depth - 1, jobs);
+}
+
+void SpatialIndex::build(unsigned node, unsigned first, unsigned count)
+{
+    const unsigned half = split(node, first, count);
+    if (half == 0)
+        return;
+
+    build(node + 1, first, half);
+    build(m_nodes[node].right, first + half, count - half);
+}
+
+unsigned SpatialIndex::split(unsigned node, unsigned first, unsigned count)
+{
+    BvhNode &b = m_nodes[node];
+    b.box.init();
+    osg::BoundingBox centers;
+    for (unsigned i = first ; i < first + count ; i++) {
+        const osg::BoundingBox &box = m_parts[m_order[i]]->box;
+        b.box.expandBy(box);
+        centers.expandBy(box.center());
+    }
+
+    if (count <= leafSize) {
+        b.first = first;
+        b.count = count;
+        b.right = 0;
+        return 0;
+    }
+
+    // Halve at the median along the longest spread of centers
+    const osg::Vec3 spread = centers._max - centers._min;
+    int axis = 0;
+    if (spread[1] > spread[axis])
+        axis = 1;
+    if (spread[2] > spread[axis])
+        axis = 2;
+
+    const unsigned half = count / 2;
+    const std::vector<const Part *> &parts = m_parts;
+    std::nth_element(m_order.begin() + first,
+                     m_order.begin() + first + half,
+                     m_order.begin() + first + count,
+                     [&parts, axis](unsigned a, unsigned c) {
+                         return parts[a]->box.center()[axis] < parts[c]->box.center()[axis];
+                     });
+
+    b.first = 0;
+    b.count = 0;
+    b.right = node + 1 + nodeCount(half);
+    return half;
+}
+
+unsigned SpatialIndex::nodeCount(unsigned count)
+{
+    if (count <= leafSize)
+        return 1;
+    return 1 + nodeCount(count / 2) + nodeCount(count - count / 2);
+}
+
+osg::Matrixd SpatialIndex::getPartMatrix(unsigned i) const
+{
+    const RefNodePath &refPath = m_parts[i]->path;
+    osg::NodePath path;
+    for (unsigned n=0 ; n < refPath.size() ; n++)
+        path.push_back(refPath[n].get());
+    return osg::computeLocalToWorld(path) * m_toWorld;
+}
+
+double SpatialIndex::boxDistance(const osg::BoundingBox &a, const osg::BoundingBox &b)
+{
+    osg::Vec3d d;
+    for (int axis=0 ; axis < 3 ; axis++) {
+        if (a._max[axis] < b._min[axis])
+            d[axis] = b._min[axis] - a._max[axis];
+        else if (b._max[axis] < a._min[axis])
+            d[axis] = a._min[axis] - b._max[axis];
+    }
+    return d.length();
+}
+
+std::vector<unsigned> SpatialIndex::findWithin(const osg::BoundingBox &box, double distance) const
+{
+    std::vector<unsigned> found;
+    if (m_nodes.empty() || !box.valid())
+        return found;
+
+    std::vector<unsigned> pending(1, 0);
+    while (!pending.empty()) {
+        const BvhNode &node = m_nodes[pending.back()];
+        const unsigned index = pending.back();
+        pending.pop_back();
+
+        if (boxDistance(node.box, box) > distance)
+            continue;
+
+        if (node.count > 0) {
+            for (unsigned i = node.first ; i < node.first + node.count ; i++) {
+                const Part &part = *m_parts[m_order[i]];
+                if (boxDistance(part.box, box) <= distance && part.showsUnder(m_mask))
+                    found.push_back(m_order[i]);
+            }
+        } else {
+            pending.push_back(index + 1);
+            pending.push_back(node.right);
+        }
+    }
+
+    return found;
+}
+
+int SpatialIndex::findNearest(const osg::Vec3d &point,
+                              const std::function<bool (const Part &)> &accept,
+                              double *distance) const
+{
+    int best = -1;
+    double bestDistance = DBL_MAX;
+
+    // Nodes in order of how near their boxes are; nothing in a node can be
+    // nearer than its box, so the search stops at the first node farther
+    // than the best part found.
+    typedef std::pair<double, unsigned> Entry;
+    std::priority_queue< Entry, std::vector<Entry>, std::greater<Entry> > pending;
+    if (!m_nodes.empty())
+        pending.push(Entry(distanceToBox(point, m_nodes[0].box), 0));
+
+    while (!pending.empty() && pending.top().first < bestDistance) {
+        const unsigned index = pending.top().second;
+        pending.pop();
+        const BvhNode &node = m_nodes[index];
+
+        if (node.count > 0) {
+            for (unsigned i = node.first ; i < node.first + node.count ; i++) {
+                const Part &part = *m_parts[m_order[i]];
+                const double d = distanceToBox(point, part.box);
+                if (d < bestDistance && part.showsUnder(m_mask) && accept(part)) {
+                    best = m_order[i];
+                    bestDistance = d;
+                }
+            }
+        } else {
+            pending.push(Entry(distanceToBox(point, m_nodes[index + 1].box), index + 1));
+            pending.push(Entry(distanceToBox(point, m_nodes[node.right].box), node.right));
+        }
+    }
+
+    if (distance)
+        *distance = bestDistance;
+    return best;
+}
+
+std::vector< std::pair<double, unsigned> > SpatialIndex::findAlongSegment(const osg::Vec3d &start,
+                                                                        const osg::Vec3d &end) const
+{
+    std::vector< std::pair<double, unsigned> > found;
+    if (m_nodes.empty())
+        return found;
+
+    const osg::Vec3d d = end - start;
+    const osg::Vec3d inverse(1.0 / d[0], 1.0 / d[1], 1.0 / d[2]);
+
+    std::vector<unsigned> pending(1, 0);
+    while (!pending.empty()) {
+        const unsigned index = pending.back();
+        pending.pop_back();
+
+        const BvhNode &node = m_nodes[index];
+        double enter;
+        if (!segmentEnters(start, inverse, node.box, enter))
+            continue;
+
+        if (node.count > 0) {
+            for (unsigned i = node.first ; i < node.first + node.count ; i++) {
+                const Part &part = *m_parts[m_order[i]];
+                if (segmentEnters(start, inverse, part.box, enter) && part.showsUnder(m_mask))
+                    found.push_back(std::make_pair(enter, m_order[i]));
+            }
+        } else {
+            pending.push_back(index + 1);
+            pending.push_back(node.right);
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+    return found;
+}
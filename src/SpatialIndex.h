@@ -0,0 +1,113 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QSharedPointer>
+
+#include <functional>
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Matrixd>
+#include <osg/Node>
+#include <osg/ref_ptr>
+
+/// A bounding volume hierarchy over the parts (geodes) of a scene, for
+/// "what is near this" and "what is nearest to here" questions.
+///
+/// A part is one place a geode shows up, so an instanced part is indexed
+/// once for each instance, each with its own box.  Parts are gathered per
+/// root (a loaded file) so an edit only has to gather the file it touched
+/// again; the hierarchy over all of them is rebuilt in parallel, which
+/// takes a fraction of the time the gathering does.
+class SpatialIndex
+{
+public:
+    typedef std::vector< osg::ref_ptr<osg::Node> > RefNodePath;
+
+    struct Part {
+        RefNodePath path;     ///< from the root it was found under to the geode
+        osg::BoundingBox box; ///< in world coordinates
+        std::vector<unsigned> masks; ///< node masks on the path, but for ~0
+
+        /// Whether every node on the path shows under mask
+        bool showsUnder(unsigned mask) const;
+    };
+
+    SpatialIndex();
+
+    /// Index the geodes beneath each of roots, whatever their node masks
+    /// (other than 0), with boxes transformed by toWorld.  Only roots that
+    /// are new or listed in dirty are traversed again (all of them if
+    /// toWorld changed), and roots no longer given are dropped.
+    void update(const QList< osg::ref_ptr<osg::Node> > &roots,
+                const QList< osg::ref_ptr<osg::Node> > &dirty,
+                const osg::Matrixd &toWorld);
+
+    /// The queries only find parts that show under mask.  Changing it is
+    /// free; nothing is gathered or built again.
+    void setMask(unsigned mask) { m_mask = mask; }
+    unsigned getMask() const { return m_mask; }
+
+    void clear();
+
+    unsigned getNumParts() const { return m_parts.size(); }
+    const Part &getPart(unsigned i) const { return *m_parts[i]; }
+
+    /// Takes the geode of part i to world coordinates
+    osg::Matrixd getPartMatrix(unsigned i) const;
+
+    /// Parts whose boxes come within distance of box (0 for touching)
+    std::vector<unsigned> findWithin(const osg::BoundingBox &box, double distance) const;
+
+    /// Part with the box nearest to point among those accept() takes, -1
+    /// if there is none.  distance is set to how far away its box is.
+    int findNearest(const osg::Vec3d &point,
+                    const std::function<bool (const Part &)> &accept,
+                    double *distance=0) const;
+
+    /// Parts whose boxes the segment from start to end passes through,
+    /// nearest first, each with where the segment enters its box (0 at
+    /// start, 1 at end)
+    std::vector< std::pair<double, unsigned> > findAlongSegment(const osg::Vec3d &start,
+                                                                const osg::Vec3d &end) const;
+
+    /// Distance between two boxes, 0 if they overlap
+    static double boxDistance(const osg::BoundingBox &a, const osg::BoundingBox &b);
+
+private:
+    struct File {
+        osg::ref_ptr<osg::Node> root;
+        QSharedPointer< const std::vector<Part> > parts;
+    };
+    QHash<const osg::Node *, File> m_files;
+    osg::Matrixd m_toWorld;
+    unsigned m_mask;
+
+    /// Node i of the hierarchy.  A leaf (count > 0) holds parts
+    /// m_order[first, first+count); otherwise its children are i+1 and
+    /// right.
+    struct BvhNode {
+        osg::BoundingBox box;
+        unsigned first;
+        unsigned count;
+        unsigned right;
+    };
+
+    struct BuildJob;
+    static void runBuildJob(BuildJob &job);
+
+    void rebuild();
+    void buildTop(unsigned node, unsigned first, unsigned count, unsigned depth,
+                  std::vector<BuildJob> &jobs);
+    void build(unsigned node, unsigned first, unsigned count);
+    unsigned split(unsigned node, unsigned first, unsigned count);
+    static unsigned nodeCount(unsigned count);
+
+    std::vector<const Part *> m_parts;
+    std::vector<unsigned> m_order;
+    std::vector<BvhNode> m_nodes;
+};
+
+#endif // SPATIALINDEX_H
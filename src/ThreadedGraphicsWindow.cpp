@@ -0,0 +1,197 @@
+#include "ThreadedGraphicsWindow.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QThread>
+
+#include <osg/GraphicsThread>
+#include <osg/Viewport>
+
+#include <algorithm>
+
+static bool debugThreaded = false;
+#define twDebug if (debugThreaded) qDebug
+
+/// Runs destroyContext() on the graphics thread and lets the GUI thread
+/// wait for it
+class ThreadedGraphicsWindow::DestroyContextOperation
+        : public osg::GraphicsOperation, public OpenThreads::Block
+{
+public:
+    DestroyContextOperation()
+        : osg::GraphicsOperation("DestroyContext", false) {}
+
+    void operator()(osg::GraphicsContext *context) {
+        ThreadedGraphicsWindow *window = dynamic_cast<ThreadedGraphicsWindow *>(context);
+        if (window)
+            window->destroyContext();
+        release();
+    }
+};
+
+ThreadedGraphicsWindow::ThreadedGraphicsWindow(int x, int y, int width, int height)
+    : osgViewer::GraphicsWindowEmbedded(x, y, width, height)
+    , m_shareContext(0)
+    , m_frameReceiver(0)
+    , m_surface(0)
+    , m_context(0)
+    , m_fresh(false)
+{
+}
+
+ThreadedGraphicsWindow::~ThreadedGraphicsWindow()
+{
+    delete m_surface;
+}
+
+void ThreadedGraphicsWindow::setShareContext(QOpenGLContext *context, QObject *frameReceiver)
+{
+    m_shareContext = context;
+    m_frameReceiver = frameReceiver;
+
+    // an off screen surface can only be made on the GUI thread
+    delete m_surface;
+    m_surface = 0;
+    if (context) {
+        m_surface = new QOffscreenSurface;
+        m_surface->setFormat(context->format());
+        m_surface->create();
+    }
+}
+
+void ThreadedGraphicsWindow::destroyDrawContext()
+{
+    osg::GraphicsThread *thread = getGraphicsThread();
+    if (!m_surface || !thread || !thread->isRunning())
+        return;
+
+    osg::ref_ptr<DestroyContextOperation> operation = new DestroyContextOperation;
+    operation->reset();
+    thread->add(operation.get());
+    operation->block();
+}
+
+unsigned ThreadedGraphicsWindow::takeFrame(QSize &size, QRect &viewport)
+{
+    QMutexLocker lock(&m_mutex);
+
+    if (m_fresh) {
+        std::swap(m_ready, m_display);
+        m_fresh = false;
+    }
+
+    if (!m_display.buffer)
+        return 0;
+
+    size = m_display.buffer->size();
+    viewport = m_display.viewport;
+    return m_display.buffer->texture();
+}
+
+bool ThreadedGraphicsWindow::makeCurrentImplementation()
+{
+    // Drawing into the widget: Qt has made its context current already.
+    // The GUI thread never takes the draw thread's context either.
+    if (!m_surface || QThread::currentThread() == QCoreApplication::instance()->thread())
+        return true;
+
+    if (!m_context) {
+        // Made here so it belongs to the graphics thread from the start
+        m_context = new QOpenGLContext;
+        m_context->setFormat(m_shareContext->format());
+        m_context->setShareContext(m_shareContext);
+        if (!m_context->create()) {
+            qWarning("could not create a context for the draw thread");
+            delete m_context;
+            m_context = 0;
+            return false;
+        }
+        twDebug("draw context created");
+    }
+
+    if (!m_context->makeCurrent(m_surface))
+        return false;
+
+    bindBackBuffer();
+    return true;
+}
+
+bool ThreadedGraphicsWindow::releaseContextImplementation()
+{
+    if (m_context && QOpenGLContext::currentContext() == m_context)
+        m_context->doneCurrent();
+    return true;
+}
+
+void ThreadedGraphicsWindow::swapBuffersImplementation()
+{
+    // Drawing into the widget, Qt composes and swaps it
+    if (!m_context || QOpenGLContext::currentContext() != m_context)
+        return;
+
+    // The frame has to be complete before another context may read it
+    m_context->functions()->glFinish();
+
+    // The camera viewport may be smaller than the buffer
+    const osg::Viewport *viewport = dynamic_cast<const osg::Viewport *>(
+                getState()->getLastAppliedAttribute(osg::StateAttribute::VIEWPORT));
+    if (viewport)
+        m_back.viewport = QRect(viewport->x(), viewport->y(),
+                                viewport->width(), viewport->height());
+    else
+        m_back.viewport = QRect(QPoint(0, 0), m_back.buffer->size());
+
+    {
+        QMutexLocker lock(&m_mutex);
+        std::swap(m_back, m_ready);
+        m_fresh = true;
+    }
+
+    bindBackBuffer();
+
+    if (m_frameReceiver)
+        QMetaObject::invokeMethod(m_frameReceiver, "update", Qt::QueuedConnection);
+}
+
+void ThreadedGraphicsWindow::bindBackBuffer()
+{
+    // The buffers follow the window size lazily, one at a time as each
+    // comes round to be drawn into.  The GUI stretches an old size until then.
+    QSize size(std::max(_traits->width, 1), std::max(_traits->height, 1));
+
+    if (m_back.buffer && m_back.buffer->size() != size) {
+        delete m_back.buffer;
+        m_back.buffer = 0;
+    }
+    if (!m_back.buffer)
+        m_back.buffer = new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::CombinedDepthStencil);
+
+    m_back.buffer->bind();
+    setDefaultFboId(m_back.buffer->handle());
+}
+
+void ThreadedGraphicsWindow::destroyContext()
+{
+    if (!m_context)
+        return;
+
+    m_context->makeCurrent(m_surface);
+    {
+        QMutexLocker lock(&m_mutex);
+        delete m_back.buffer;
+        delete m_ready.buffer;
+        delete m_display.buffer;
+        m_back = m_ready = m_display = Frame();
+        m_fresh = false;
+    }
+    setDefaultFboId(0);
+    m_context->doneCurrent();
+
+    delete m_context;
+    m_context = 0;
+    twDebug("draw context destroyed");
+}
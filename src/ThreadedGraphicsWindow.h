@@ -0,0 +1,78 @@
+#ifndef THREADEDGRAPHICSWINDOW_H
+#define THREADEDGRAPHICSWINDOW_H
+
+#include <QMutex>
+#include <QRect>
+#include <osgViewer/GraphicsWindow>
+
+class QObject;
+class QOffscreenSurface;
+class QOpenGLContext;
+class QOpenGLFramebufferObject;
+
+/// The graphics window of an Osg3dView.
+///
+/// Without a share context it behaves as the GraphicsWindowEmbedded it is:
+/// Qt makes the widget's context current and OSG draws into it from the GUI
+/// thread.
+///
+/// With a share context OSG can draw from a graphics thread of its own.
+/// That thread gets a context of its own (sharing textures and buffers
+/// with the widget) and draws into off screen framebuffers.  There are
+/// three of them: the draw thread renders into the back one, the newest
+/// finished frame waits in the ready one, and the widget shows the display
+/// one.  The draw thread never has to wait for the GUI to show a frame, and
+/// the GUI never sees a frame that is half drawn.
+class ThreadedGraphicsWindow : public osgViewer::GraphicsWindowEmbedded
+{
+public:
+    ThreadedGraphicsWindow(int x, int y, int width, int height);
+    ~ThreadedGraphicsWindow();
+
+    /// Draw from a graphics thread with a context shared with context, or
+    /// into the widget again with 0.  frameReceiver gets update() called
+    /// (queued) every time a frame is finished.  GUI thread only, and only
+    /// while no graphics thread is running.
+    void setShareContext(QOpenGLContext *context, QObject *frameReceiver);
+    bool hasShareContext() const { return m_surface != 0; }
+
+    /// Have the graphics thread delete its context and wait for it.  This
+    /// has to happen before the thread is stopped.  GUI thread only.
+    void destroyDrawContext();
+
+    /// Texture of the newest finished frame, 0 if there is none yet.  It
+    /// stays valid until the next call.  The frame covers viewport, which
+    /// can be less than size when it was drawn at reduced resolution.
+    /// GUI thread only.
+    unsigned takeFrame(QSize &size, QRect &viewport);
+
+    bool makeCurrentImplementation();
+    bool releaseContextImplementation();
+    void swapBuffersImplementation();
+
+private:
+    class DestroyContextOperation;
+    void destroyContext();
+    void bindBackBuffer();
+
+    QOpenGLContext *m_shareContext;
+    QObject *m_frameReceiver;
+    QOffscreenSurface *m_surface;
+
+    /// Lives on (and is only touched by) the graphics thread
+    QOpenGLContext *m_context;
+
+    struct Frame {
+        Frame() : buffer(0) {}
+        QOpenGLFramebufferObject *buffer;
+        QRect viewport; ///< the part of buffer drawn into
+    };
+
+    QMutex m_mutex; ///< guards m_ready, m_display and m_fresh
+    Frame m_back;
+    Frame m_ready;
+    Frame m_display;
+    bool m_fresh; ///< m_ready holds a frame the GUI has not taken yet
+};
+
+#endif // THREADEDGRAPHICSWINDOW_H
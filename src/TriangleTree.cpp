@@ -0,0 +1,214 @@
+#include "TriangleTree.h"
+#include "VertexCompressor.h"
+
+#include <osg/TriangleFunctor>
+
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+
+/// Triangles per leaf of the hierarchy
+const unsigned leafSize = 8;
+
+struct CollectTriangles {
+    std::vector<TriangleTree::Triangle> *triangles;
+    osg::Matrixd matrix;
+
+    void operator()(const osg::Vec3 &v1, const osg::Vec3 &v2, const osg::Vec3 &v3) {
+        TriangleTree::Triangle t;
+        t.v[0] = osg::Vec3d(v1) * matrix;
+        t.v[1] = osg::Vec3d(v2) * matrix;
+        t.v[2] = osg::Vec3d(v3) * matrix;
+        for (int i=0 ; i < 3 ; i++)
+            t.box.expandBy(t.v[i]);
+        triangles->push_back(t);
+    }
+
+    void operator()(const osg::Vec3 &v1, const osg::Vec3 &v2, const osg::Vec3 &v3, bool) {
+        operator()(v1, v2, v3);
+    }
+};
+
+/// Where the ray enters and leaves box, if it does at all before tFar
+bool rayHitsBox(const osg::Vec3d &origin, const osg::Vec3d &inverse,
+                const osg::BoundingBoxd &box, double tFar)
+{
+    double tNear = 0.0;
+    for (int a=0 ; a < 3 ; a++) {
+        double t0 = (box._min[a] - origin[a]) * inverse[a];
+        double t1 = (box._max[a] - origin[a]) * inverse[a];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        // an axis the ray runs along gives nan when the origin is on a face
+        if (t0 == t0)
+            tNear = std::max(tNear, t0);
+        if (t1 == t1)
+            tFar = std::min(tFar, t1);
+        if (tNear > tFar)
+            return false;
+    }
+    return true;
+}
+
+/// Moller-Trumbore, the distance along the ray or -1
+double rayHitsTriangle(const osg::Vec3d &origin, const osg::Vec3d &direction,
+                       const TriangleTree::Triangle &triangle)
+{
+    const osg::Vec3d e1 = triangle.v[1] - triangle.v[0];
+    const osg::Vec3d e2 = triangle.v[2] - triangle.v[0];
+    const osg::Vec3d p = direction ^ e2;
+    const double det = e1 * p;
+    if (fabs(det) < DBL_MIN)
+        return -1.0;
+
+    const double inverse = 1.0 / det;
+    const osg::Vec3d s = origin - triangle.v[0];
+    const double u = (s * p) * inverse;
+    if (u < 0.0 || u > 1.0)
+        return -1.0;
+
+    const osg::Vec3d q = s ^ e1;
+    const double v = (direction * q) * inverse;
+    if (v < 0.0 || u + v > 1.0)
+        return -1.0;
+
+    return (e2 * q) * inverse;
+}
+
+}
+
+TriangleTree::TriangleTree()
+{
+}
+
+void TriangleTree::build(const osg::Geode &geode, const osg::Matrixd &matrix)
+{
+    m_triangles.clear();
+    m_nodes.clear();
+
+    osg::TriangleFunctor<CollectTriangles> collect;
+    collect.triangles = &m_triangles;
+    collect.matrix = matrix;
+    for (unsigned i=0 ; i < geode.getNumDrawables() ; i++)
+        VertexCompressor::accept(geode.getDrawable(i), collect);
+
+    if (!m_triangles.empty())
+        buildNode(0, m_triangles.size());
+}
+
+unsigned TriangleTree::buildNode(unsigned first, unsigned count)
+{
+    const unsigned node = m_nodes.size();
+    m_nodes.push_back(Node());
+
+    osg::BoundingBoxd box, centers;
+    for (unsigned i = first ; i < first + count ; i++) {
+        box.expandBy(m_triangles[i].box);
+        centers.expandBy(m_triangles[i].box.center());
+    }
+    m_nodes[node].box = box;
+
+    if (count <= leafSize) {
+        m_nodes[node].first = first;
+        m_nodes[node].count = count;
+        m_nodes[node].right = 0;
+        return node;
+    }
+
+    // Halve at the median along the longest spread of centers
+    const osg::Vec3d spread = centers._max - centers._min;
+    int axis = 0;
+    if (spread[1] > spread[axis])
+        axis = 1;
+    if (spread[2] > spread[axis])
+        axis = 2;
+
+    const unsigned half = count / 2;
+    std::nth_element(m_triangles.begin() + first,
+                     m_triangles.begin() + first + half,
+                     m_triangles.begin() + first + count,
+                     [axis](const Triangle &a, const Triangle &b) {
+                         return a.box.center()[axis] < b.box.center()[axis];
+                     });
+
+    buildNode(first, half);
+    const unsigned right = buildNode(first + half, count - half);
+
+    // the vector may have moved while the children were added
+    m_nodes[node].first = 0;
+    m_nodes[node].count = 0;
+    m_nodes[node].right = right;
+    return node;
+}
+
+int TriangleTree::intersectRay(const osg::Vec3d &origin, const osg::Vec3d &direction, double &t) const
+{
+    int hit = -1;
+    t = DBL_MAX;
+    if (m_nodes.empty())
+        return hit;
+
+    const osg::Vec3d inverse(1.0 / direction[0], 1.0 / direction[1], 1.0 / direction[2]);
+
+    std::vector<unsigned> pending(1, 0);
+    while (!pending.empty()) {
+        const unsigned index = pending.back();
+        pending.pop_back();
+
+        const Node &node = m_nodes[index];
+        if (!rayHitsBox(origin, inverse, node.box, t))
+            continue;
+
+        if (node.count > 0) {
+            for (unsigned i = node.first ; i < node.first + node.count ; i++) {
+                const double d = rayHitsTriangle(origin, direction, m_triangles[i]);
+                if (d >= 0.0 && d < t) {
+                    t = d;
+                    hit = i;
+                }
+            }
+        } else {
+            pending.push_back(node.right);
+            pending.push_back(index + 1);
+        }
+    }
+
+    return hit;
+}
+
+std::vector<unsigned> TriangleTree::findWithin(const osg::BoundingBoxd &box) const
+{
+    std::vector<unsigned> found;
+    if (m_nodes.empty() || !box.valid())
+        return found;
+
+    std::vector<unsigned> pending(1, 0);
+    while (!pending.empty()) {
+        const unsigned index = pending.back();
+        pending.pop_back();
+
+        const Node &node = m_nodes[index];
+        if (!node.box.intersects(box))
+            continue;
+
+        if (node.count > 0) {
+            for (unsigned i = node.first ; i < node.first + node.count ; i++) {
+                if (m_triangles[i].box.intersects(box))
+                    found.push_back(i);
+            }
+        } else {
+            pending.push_back(index + 1);
+            pending.push_back(node.right);
+        }
+    }
+
+    return found;
+}
+
+size_t TriangleTree::getMemoryUsage() const
+{
+    return sizeof(*this) +
+            m_triangles.capacity() * sizeof(Triangle) +
+            m_nodes.capacity() * sizeof(Node);
+}
@@ -0,0 +1,59 @@
+#ifndef TRIANGLETREE_H
+#define TRIANGLETREE_H
+
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Geode>
+#include <osg/Matrixd>
+
+/// A bounding volume hierarchy over the triangles of one geode, for exact
+/// questions about a part once the SpatialIndex has found it: does a ray
+/// hit it, which of its triangles are near a point, which triangles of two
+/// parts intersect.
+class TriangleTree
+{
+public:
+    struct Triangle {
+        osg::Vec3d v[3];
+        osg::BoundingBoxd box;
+    };
+
+    /// Node i of the hierarchy.  A leaf (count > 0) holds triangles
+    /// [first, first+count); otherwise its children are i+1 and right.
+    struct Node {
+        osg::BoundingBoxd box;
+        unsigned first;
+        unsigned count;
+        unsigned right;
+    };
+
+    TriangleTree();
+
+    /// Gather the triangles of geode, transformed by matrix, and build
+    /// the hierarchy over them
+    void build(const osg::Geode &geode, const osg::Matrixd &matrix=osg::Matrixd());
+
+    bool empty() const { return m_nodes.empty(); }
+    const std::vector<Triangle> &getTriangles() const { return m_triangles; }
+    const std::vector<Node> &getNodes() const { return m_nodes; }
+    bool isLeaf(unsigned node) const { return m_nodes[node].count > 0; }
+
+    /// The first triangle hit by the ray from origin along direction, -1
+    /// if none.  t is set to where along the ray (in lengths of direction).
+    int intersectRay(const osg::Vec3d &origin, const osg::Vec3d &direction, double &t) const;
+
+    /// Triangles whose boxes touch box
+    std::vector<unsigned> findWithin(const osg::BoundingBoxd &box) const;
+
+    /// Approximate bytes used
+    size_t getMemoryUsage() const;
+
+private:
+    unsigned buildNode(unsigned first, unsigned count);
+
+    std::vector<Triangle> m_triangles;
+    std::vector<Node> m_nodes;
+};
+
+#endif // TRIANGLETREE_H
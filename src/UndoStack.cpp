@@ -0,0 +1,161 @@
+#include "UndoStack.h"
+
+static bool debugUndo = false;
+#define undoDebug if (debugUndo) qDebug
+
+UndoCommand::~UndoCommand()
+{
+    for (unsigned i=0 ; i < m_children.size() ; i++)
+        delete m_children[i];
+}
+
+void UndoCommand::undo()
+{
+    for (int i = m_children.size()-1 ; i >= 0 ; i--)
+        m_children[i]->undo();
+}
+
+void UndoCommand::redo()
+{
+    for (unsigned i=0 ; i < m_children.size() ; i++)
+        m_children[i]->redo();
+}
+
+size_t UndoCommand::memoryCost() const
+{
+    size_t cost = sizeof(*this);
+    for (unsigned i=0 ; i < m_children.size() ; i++)
+        cost += m_children[i]->memoryCost();
+    return cost;
+}
+
+UndoCommand *UndoCommand::takeChild(int i)
+{
+    UndoCommand *child = m_children[i];
+    m_children.erase(m_children.begin() + i);
+    return child;
+}
+
+UndoStack::UndoStack(QObject *parent)
+    : QObject(parent)
+    , m_index(0)
+    , m_memoryUsed(0)
+    , m_memoryLimit(256 * 1024 * 1024)
+    , m_mergeInterval(1000)
+{
+}
+
+UndoStack::~UndoStack()
+{
+    for (unsigned i=0 ; i < m_commands.size() ; i++)
+        delete m_commands[i];
+}
+
+void UndoStack::push(UndoCommand *command)
+{
+    // anything that was undone can no longer be redone
+    while (m_commands.size() > m_index) {
+        m_memoryUsed -= m_costs.back();
+        delete m_commands.back();
+        m_commands.pop_back();
+        m_costs.pop_back();
+    }
+
+    UndoCommand *previous = m_index > 0 ? m_commands[m_index-1] : 0;
+    if (previous && command->id() >= 0 && previous->id() == command->id() &&
+            m_lastPush.isValid() && m_lastPush.elapsed() < m_mergeInterval &&
+            previous->mergeWith(command)) {
+        delete command;
+        m_memoryUsed -= m_costs.back();
+        m_costs.back() = previous->memoryCost();
+        m_memoryUsed += m_costs.back();
+    } else {
+        m_commands.push_back(command);
+        m_costs.push_back(command->memoryCost());
+        m_memoryUsed += m_costs.back();
+        m_index = m_commands.size();
+    }
+    m_lastPush.start();
+
+    trim();
+
+    undoDebug("push \"%s\": %d commands %llu bytes",
+              qPrintable(m_commands.back()->text()), (int)m_commands.size(),
+              (unsigned long long)m_memoryUsed);
+
+    emit changed();
+}
+
+void UndoStack::trim()
+{
+    // The newest command always stays, however big it is
+    while (m_memoryUsed > m_memoryLimit && m_commands.size() > 1) {
+        if (m_index > 0) {
+            m_memoryUsed -= m_costs.front();
+            delete m_commands.front();
+            m_commands.erase(m_commands.begin());
+            m_costs.erase(m_costs.begin());
+            m_index--;
+        } else {
+            m_memoryUsed -= m_costs.back();
+            delete m_commands.back();
+            m_commands.pop_back();
+            m_costs.pop_back();
+        }
+    }
+}
+
+void UndoStack::setMemoryLimit(size_t bytes)
+{
+    m_memoryLimit = bytes;
+    trim();
+    emit changed();
+}
+
+QString UndoStack::undoText() const
+{
+    return canUndo() ? m_commands[m_index-1]->text() : QString();
+}
+
+QString UndoStack::redoText() const
+{
+    return canRedo() ? m_commands[m_index]->text() : QString();
+}
+
+void UndoStack::undo()
+{
+    if (!canUndo())
+        return;
+
+    m_index--;
+    m_commands[m_index]->undo();
+
+    // nothing merges into a command that has been undone and redone
+    m_lastPush.invalidate();
+
+    emit changed();
+}
+
+void UndoStack::redo()
+{
+    if (!canRedo())
+        return;
+
+    m_commands[m_index]->redo();
+    m_index++;
+    m_lastPush.invalidate();
+
+    emit changed();
+}
+
+void UndoStack::clear()
+{
+    for (unsigned i=0 ; i < m_commands.size() ; i++)
+        delete m_commands[i];
+    m_commands.clear();
+    m_costs.clear();
+    m_index = 0;
+    m_memoryUsed = 0;
+
+    emit changed();
+}
@@ -0,0 +1,90 @@
+#ifndef UNDOSTACK_H
+#define UNDOSTACK_H
+
+#include <QObject>
+#include <QString>
+#include <QElapsedTimer>
+
+#include <vector>
+
+/// One reversible edit.  Commands are pushed after their edit has been
+/// made, so the first thing asked of one is undo().  A command may hold
+/// children, which are undone in reverse order and redone in order.
+class UndoCommand
+{
+public:
+    UndoCommand(const QString &text = QString()) : m_text(text) {}
+    virtual ~UndoCommand();
+
+    virtual void undo();
+    virtual void redo();
+
+    /// Bytes kept alive by this command (and its children) that would be
+    /// freed if it were dropped from the history
+    virtual size_t memoryCost() const;
+
+    /// Commands pushed in quick succession with the same id (>= 0) are
+    /// offered to mergeWith() so a burst of edits undoes in one step
+    virtual int id() const { return -1; }
+    virtual bool mergeWith(const UndoCommand *) { return false; }
+
+    const QString &text() const { return m_text; }
+    void setText(const QString &text) { m_text = text; }
+
+    void addChild(UndoCommand *child) { m_children.push_back(child); }
+    int childCount() const { return m_children.size(); }
+    UndoCommand *takeChild(int i);
+
+private:
+    QString m_text;
+    std::vector<UndoCommand *> m_children;
+};
+
+/// Undo history with a bound on memory rather than on the number of
+/// commands.  Commands hold references to what they change instead of
+/// copies, but a removed subtree still lives on in the history; once the
+/// history holds more than the limit the oldest commands are dropped.
+class UndoStack : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UndoStack(QObject *parent = 0);
+    ~UndoStack();
+
+    /// Take ownership of an already executed command
+    void push(UndoCommand *command);
+
+    bool canUndo() const { return m_index > 0; }
+    bool canRedo() const { return m_index < m_commands.size(); }
+    QString undoText() const;
+    QString redoText() const;
+
+    void setMemoryLimit(size_t bytes);
+    size_t getMemoryLimit() const { return m_memoryLimit; }
+    size_t getMemoryUsed() const { return m_memoryUsed; }
+
+    /// How close together (in milliseconds) commands must be to merge
+    void setMergeInterval(int msec) { m_mergeInterval = msec; }
+
+public slots:
+    void undo();
+    void redo();
+    void clear();
+
+signals:
+    /// What can be undone or redone changed
+    void changed();
+
+private:
+    void trim();
+
+    std::vector<UndoCommand *> m_commands;
+    std::vector<size_t> m_costs;
+    size_t m_index;         ///< commands below this have been done
+    size_t m_memoryUsed;
+    size_t m_memoryLimit;
+    int m_mergeInterval;
+    QElapsedTimer m_lastPush;
+};
+
+#endif // UNDOSTACK_H
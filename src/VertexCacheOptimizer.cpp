@@ -0,0 +1,174 @@
+#include "VertexCacheOptimizer.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osgUtil/MeshOptimizers>
+
+#include <map>
+#include <set>
+
+static bool debugVertexCache = false;
+#define vcDebug if (debugVertexCache) qDebug
+
+namespace {
+
+class GeometryCollector : public osg::NodeVisitor
+{
+public:
+    GeometryCollector()
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Geode &geode) {
+        for (unsigned i=0 ; i < geode.getNumDrawables() ; i++)
+            add(geode.getDrawable(i)->asGeometry());
+    }
+
+    void add(osg::Geometry *geometry) {
+        if (geometry && m_seen.insert(geometry).second)
+            geometries.push_back(geometry);
+    }
+
+    std::vector< osg::ref_ptr<osg::Geometry> > geometries;
+
+private:
+    std::set<osg::Geometry *> m_seen;
+};
+
+typedef std::map<osg::BufferData *, unsigned> UserCounts;
+
+/// A copy of data when another geometry still uses it, otherwise 0.  The
+/// last user is left with the original.
+template<class T>
+T *ownCopy(T *data, UserCounts &users)
+{
+    if (!data || users[data] < 2)
+        return 0;
+
+    --users[data];
+    return osg::clone(data, osg::CopyOp::DEEP_COPY_ALL);
+}
+
+/// Give each geometry arrays and primitive sets of its own.  They are
+/// rewritten in place, so data shared by two geometries would be reordered
+/// for one and broken for the other, by two workers at once.
+void unshareData(const std::vector< osg::ref_ptr<osg::Geometry> > &geometries)
+{
+    UserCounts users;
+    for (unsigned i=0 ; i < geometries.size() ; i++) {
+        osg::Geometry::ArrayList arrays;
+        geometries[i]->getArrayList(arrays);
+        for (unsigned j=0 ; j < arrays.size() ; j++)
+            ++users[arrays[j].get()];
+        for (unsigned j=0 ; j < geometries[i]->getNumPrimitiveSets() ; j++)
+            ++users[geometries[i]->getPrimitiveSet(j)];
+    }
+
+    for (unsigned i=0 ; i < geometries.size() ; i++) {
+        osg::Geometry &geometry = *geometries[i];
+
+        if (osg::Array *copy = ownCopy(geometry.getVertexArray(), users))
+            geometry.setVertexArray(copy);
+        if (osg::Array *copy = ownCopy(geometry.getNormalArray(), users))
+            geometry.setNormalArray(copy);
+        if (osg::Array *copy = ownCopy(geometry.getColorArray(), users))
+            geometry.setColorArray(copy);
+        if (osg::Array *copy = ownCopy(geometry.getSecondaryColorArray(), users))
+            geometry.setSecondaryColorArray(copy);
+        if (osg::Array *copy = ownCopy(geometry.getFogCoordArray(), users))
+            geometry.setFogCoordArray(copy);
+        for (unsigned j=0 ; j < geometry.getNumTexCoordArrays() ; j++) {
+            if (osg::Array *copy = ownCopy(geometry.getTexCoordArray(j), users))
+                geometry.setTexCoordArray(j, copy);
+        }
+        for (unsigned j=0 ; j < geometry.getNumVertexAttribArrays() ; j++) {
+            if (osg::Array *copy = ownCopy(geometry.getVertexAttribArray(j), users))
+                geometry.setVertexAttribArray(j, copy);
+        }
+        for (unsigned j=0 ; j < geometry.getNumPrimitiveSets() ; j++) {
+            if (osg::PrimitiveSet *copy = ownCopy(geometry.getPrimitiveSet(j), users))
+                geometry.setPrimitiveSet(j, copy);
+        }
+    }
+}
+
+void dirtyArrays(osg::Geometry &geometry)
+{
+    osg::Geometry::ArrayList arrays;
+    geometry.getArrayList(arrays);
+    for (unsigned i=0 ; i < arrays.size() ; i++)
+        arrays[i]->dirty();
+
+    for (unsigned i=0 ; i < geometry.getNumPrimitiveSets() ; i++)
+        geometry.getPrimitiveSet(i)->dirty();
+
+    geometry.dirtyDisplayList();
+}
+
+}
+
+VertexCacheOptimizer::VertexCacheOptimizer()
+    : m_cacheSize(16)
+{
+}
+
+double VertexCacheOptimizer::computeAcmr(osg::Geometry &geometry,
+                                         unsigned cacheSize,
+                                         unsigned *triangles)
+{
+    osgUtil::VertexCacheMissVisitor missVisitor(cacheSize);
+    missVisitor.doGeometry(geometry);
+
+    if (triangles)
+        *triangles = missVisitor.triangles;
+
+    if (missVisitor.triangles == 0)
+        return 0.0;
+
+    return (double)missVisitor.misses / (double)missVisitor.triangles;
+}
+
+std::vector<VertexCacheOptimizer::Result> VertexCacheOptimizer::optimize(osg::Node *node) const
+{
+    GeometryCollector collector;
+    if (node) {
+        if (osg::Drawable *drawable = dynamic_cast<osg::Drawable *>(node))
+            collector.add(drawable->asGeometry());
+        else
+            node->accept(collector);
+    }
+
+    unshareData(collector.geometries);
+
+    std::vector<Result> results(collector.geometries.size());
+    for (unsigned i=0 ; i < results.size() ; i++)
+        results[i].geometry = collector.geometries[i];
+
+    const unsigned cacheSize = m_cacheSize;
+    QtConcurrent::blockingMap(results, [cacheSize](Result &result) {
+        osg::Geometry &geometry = *result.geometry;
+
+        result.acmrBefore = computeAcmr(geometry, cacheSize, &result.triangles);
+
+        // The cache optimizers want indexed triangles with per vertex data
+        osgUtil::IndexMeshVisitor indexer;
+        indexer.makeMesh(geometry);
+
+        osgUtil::VertexCacheVisitor cacheOrder;
+        cacheOrder.optimizeVertices(geometry);
+
+        osgUtil::VertexAccessOrderVisitor fetchOrder;
+        fetchOrder.optimizeOrder(geometry);
+
+        dirtyArrays(geometry);
+
+        result.acmrAfter = computeAcmr(geometry, cacheSize);
+    });
+
+    for (unsigned i=0 ; i < results.size() ; i++)
+        vcDebug("%s ACMR %.3f -> %.3f", results[i].geometry->getName().c_str(),
+                results[i].acmrBefore, results[i].acmrAfter);
+
+    return results;
+}
@@ -0,0 +1,45 @@
+#ifndef VERTEXCACHEOPTIMIZER_H
+#define VERTEXCACHEOPTIMIZER_H
+
+#include <vector>
+
+#include <osg/ref_ptr>
+#include <osg/Node>
+#include <osg/Geometry>
+
+/// Reorders triangles for the post-transform vertex cache and then
+/// reorders vertices in the order the triangles fetch them.
+///
+/// This is a thin wrapper around the osgUtil mesh optimizers (which use
+/// Forsyth's algorithm) that runs them on every Geometry of a subtree in
+/// parallel and measures the average cache miss ratio (ACMR, vertex
+/// transforms per triangle) before and after.
+class VertexCacheOptimizer
+{
+public:
+    VertexCacheOptimizer();
+
+    struct Result {
+        osg::ref_ptr<osg::Geometry> geometry;
+        unsigned triangles;
+        double acmrBefore;
+        double acmrAfter;
+    };
+
+    /// Size of the simulated FIFO cache used for ACMR
+    void setCacheSize(unsigned size) { m_cacheSize = size; }
+    unsigned getCacheSize() const { return m_cacheSize; }
+
+    /// Optimize every Geometry at or beneath node.  Geometries there that
+    /// share arrays or primitive sets get copies of their own first.
+    std::vector<Result> optimize(osg::Node *node) const;
+
+    /// Vertex cache misses per triangle for geometry as it is now
+    static double computeAcmr(osg::Geometry &geometry, unsigned cacheSize,
+                              unsigned *triangles = 0);
+
+private:
+    unsigned m_cacheSize;
+};
+
+#endif // VERTEXCACHEOPTIMIZER_H
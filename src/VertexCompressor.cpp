@@ -0,0 +1,407 @@
+#include "VertexCompressor.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osg/Shader>
+#include <osg/Uniform>
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+static bool debugCompress = false;
+#define compressDebug if (debugCompress) qDebug
+
+namespace {
+
+// Lit like the fixed function pipeline with one light: the material, or
+// the color array standing in for it as with glColorMaterial, and the
+// texture on unit 0 modulating the result.  A highlightColor with an
+// alpha other than 0 stands in for both, untextured.
+const char *vertexShaderSource =
+        "#version 120\n"
+        "attribute vec3 quantizedPosition;\n"
+        "#ifdef WITH_NORMALS\n"
+        "attribute vec2 octNormal;\n"
+        "#endif\n"
+        "uniform vec3 quantizedOffset;\n"
+        "uniform vec3 quantizedExtent;\n"
+        "uniform vec4 highlightColor;\n"
+        "varying vec4 color;\n"
+        "\n"
+        "vec3 octDecode(vec2 e)\n"
+        "{\n"
+        "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+        "    if (n.z < 0.0)\n"
+        "        n.xy = (1.0 - abs(n.yx)) * (step(0.0, n.xy) * 2.0 - 1.0);\n"
+        "    return normalize(n);\n"
+        "}\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    vec4 position = vec4(quantizedOffset + quantizedPosition * quantizedExtent, 1.0);\n"
+        "#ifdef WITH_COLORS\n"
+        "    vec4 ambient = gl_Color;\n"
+        "    vec4 diffuse = gl_Color;\n"
+        "#else\n"
+        "    vec4 ambient = gl_FrontMaterial.ambient;\n"
+        "    vec4 diffuse = gl_FrontMaterial.diffuse;\n"
+        "#endif\n"
+        "    if (highlightColor.a > 0.0) {\n"
+        "        ambient = highlightColor;\n"
+        "        diffuse = highlightColor;\n"
+        "    }\n"
+        "#ifdef WITH_NORMALS\n"
+        "    vec3 normal = normalize(gl_NormalMatrix * octDecode(octNormal));\n"
+        "    vec3 light = normalize(gl_LightSource[0].position.xyz);\n"
+        "    float lambert = abs(dot(normal, light));\n" // lit two sided like the view
+        "    color = gl_FrontMaterial.emission +\n"
+        "            ambient * (gl_LightModel.ambient + gl_LightSource[0].ambient) +\n"
+        "            diffuse * gl_LightSource[0].diffuse * lambert;\n"
+        "    color.a = diffuse.a;\n"
+        "#else\n"
+        "    color = diffuse;\n"
+        "#endif\n"
+        "#ifdef WITH_TEXTURE\n"
+        "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+        "#endif\n"
+        "    gl_ClipVertex = gl_ModelViewMatrix * position;\n" // for the clip planes
+        "    gl_Position = gl_ModelViewProjectionMatrix * position;\n"
+        "}\n";
+
+const char *fragmentShaderSource =
+        "#version 120\n"
+        "varying vec4 color;\n"
+        "#ifdef WITH_TEXTURE\n"
+        "uniform sampler2D texture0;\n"
+        "uniform vec4 highlightColor;\n"
+        "#endif\n"
+        "void main()\n"
+        "{\n"
+        "#ifdef WITH_TEXTURE\n"
+        "    gl_FragColor = highlightColor.a > 0.0 ? color :\n"
+        "                   color * texture2D(texture0, gl_TexCoord[0].st);\n"
+        "#else\n"
+        "    gl_FragColor = color;\n"
+        "#endif\n"
+        "}\n";
+
+/// source with a #define for each of features after its #version line
+std::string withFeatures(const char *source, unsigned features)
+{
+    std::string defines;
+    if (features & VertexCompressor::WITH_NORMALS)
+        defines += "#define WITH_NORMALS\n";
+    if (features & VertexCompressor::WITH_COLORS)
+        defines += "#define WITH_COLORS\n";
+    if (features & VertexCompressor::WITH_TEXTURE)
+        defines += "#define WITH_TEXTURE\n";
+
+    std::string result(source);
+    result.insert(result.find('\n') + 1, defines);
+    return result;
+}
+
+osg::Program *createProgram(unsigned features)
+{
+    std::string name("dequantize");
+    if (features & VertexCompressor::WITH_NORMALS)
+        name += "Normals";
+    if (features & VertexCompressor::WITH_COLORS)
+        name += "Colors";
+    if (features & VertexCompressor::WITH_TEXTURE)
+        name += "Texture";
+
+    osg::Program *program = new osg::Program;
+    program->setName(name);
+    program->addShader(new osg::Shader(osg::Shader::VERTEX,
+                                       withFeatures(vertexShaderSource, features)));
+    program->addShader(new osg::Shader(osg::Shader::FRAGMENT,
+                                       withFeatures(fragmentShaderSource, features)));
+    program->addBindAttribLocation("quantizedPosition", VertexCompressor::POSITION_ATTRIBUTE);
+    if (features & VertexCompressor::WITH_NORMALS)
+        program->addBindAttribLocation("octNormal", VertexCompressor::NORMAL_ATTRIBUTE);
+    return program;
+}
+
+class GeometryCollector : public osg::NodeVisitor
+{
+public:
+    GeometryCollector()
+        : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Geode &geode) {
+        // the texture may be bound anywhere above the geode
+        bool textured = false;
+        const osg::NodePath &path = getNodePath();
+        for (unsigned i=0 ; i < path.size() && !textured ; i++)
+            textured = hasTexture(path[i]->getStateSet());
+
+        for (unsigned i=0 ; i < geode.getNumDrawables() ; i++)
+            add(geode.getDrawable(i)->asGeometry(), textured);
+    }
+
+    void add(osg::Geometry *geometry, bool textured=false) {
+        if (!geometry)
+            return;
+        if (m_seen.insert(geometry).second)
+            geometries.push_back(geometry);
+        if (textured || hasTexture(geometry->getStateSet()))
+            texturedGeometries.insert(geometry);
+    }
+
+    std::vector< osg::ref_ptr<osg::Geometry> > geometries;
+    std::set<osg::Geometry *> texturedGeometries; ///< in any place they show
+
+    static bool hasTexture(const osg::StateSet *stateSet) {
+        return stateSet && stateSet->getTextureAttribute(0, osg::StateAttribute::TEXTURE);
+    }
+
+private:
+    std::set<osg::Geometry *> m_seen;
+};
+
+inline float signNotZero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+inline short toSnorm16(float v)
+{
+    return (short)floor(osg::clampBetween(v, -1.0f, 1.0f) * 32767.0f + 0.5f);
+}
+
+inline float fromSnorm16(short v)
+{
+    return std::max((float)v / 32767.0f, -1.0f);
+}
+
+osg::Vec2s octEncode(osg::Vec3 n)
+{
+    n /= (fabs(n.x()) + fabs(n.y()) + fabs(n.z()));
+    osg::Vec2 e(n.x(), n.y());
+    if (n.z() < 0.0f)
+        e.set((1.0f - fabs(n.y())) * signNotZero(n.x()),
+              (1.0f - fabs(n.x())) * signNotZero(n.y()));
+    return osg::Vec2s(toSnorm16(e.x()), toSnorm16(e.y()));
+}
+
+osg::Vec3 octDecode(const osg::Vec2s &s)
+{
+    osg::Vec2 e(fromSnorm16(s.x()), fromSnorm16(s.y()));
+    osg::Vec3 n(e.x(), e.y(), 1.0f - fabs(e.x()) - fabs(e.y()));
+    if (n.z() < 0.0f)
+        n.set((1.0f - fabs(e.y())) * signNotZero(e.x()),
+              (1.0f - fabs(e.x())) * signNotZero(e.y()),
+              n.z());
+    n.normalize();
+    return n;
+}
+
+unsigned arrayBytes(const osg::Array *array)
+{
+    return array ? array->getTotalDataSize() : 0;
+}
+
+}
+
+VertexCompressor::VertexCompressor()
+{
+    for (unsigned features=0 ; features < PROGRAM_VARIANTS ; features++)
+        m_programs[features] = createProgram(features);
+}
+
+osg::ref_ptr<osg::Vec3Array> VertexCompressor::decodePositions(const osg::Geometry *geometry)
+{
+    if (!geometry || !geometry->getStateSet())
+        return 0;
+
+    const osg::Vec3usArray *quantized =
+            dynamic_cast<const osg::Vec3usArray *>(geometry->getVertexAttribArray(POSITION_ATTRIBUTE));
+    const osg::Uniform *offsetUniform = geometry->getStateSet()->getUniform("quantizedOffset");
+    const osg::Uniform *extentUniform = geometry->getStateSet()->getUniform("quantizedExtent");
+    osg::Vec3 offset, extent;
+    if (!quantized || !offsetUniform || !offsetUniform->get(offset) ||
+            !extentUniform || !extentUniform->get(extent))
+        return 0;
+
+    // as the vertex shader does it
+    osg::ref_ptr<osg::Vec3Array> positions = new osg::Vec3Array(quantized->size());
+    for (unsigned i=0 ; i < quantized->size() ; i++) {
+        for (int axis=0 ; axis < 3 ; axis++)
+            (*positions)[i][axis] = offset[axis] + ((*quantized)[i][axis] / 65535.0f) * extent[axis];
+    }
+    return positions;
+}
+
+void VertexCompressor::accept(const osg::Drawable *drawable, osg::PrimitiveFunctor &functor)
+{
+    const osg::Geometry *geometry = drawable->asGeometry();
+    osg::ref_ptr<osg::Vec3Array> positions = decodePositions(geometry);
+    if (!positions.valid()) {
+        drawable->accept(functor);
+        return;
+    }
+    if (positions->empty())
+        return;
+
+    functor.setVertexArray(positions->size(), &positions->front());
+    for (unsigned i=0 ; i < geometry->getNumPrimitiveSets() ; i++)
+        geometry->getPrimitiveSet(i)->accept(functor);
+}
+
+void VertexCompressor::compressGeometry(Result &result) const
+{
+    osg::Geometry *geometry = result.geometry.get();
+
+    result.compressed = false;
+    result.positionError = 0.0;
+    result.normalError = 0.0;
+    result.colorError = 0.0;
+
+    osg::Vec3Array *vertices = dynamic_cast<osg::Vec3Array *>(geometry->getVertexArray());
+    if (!vertices || vertices->empty())
+        return;
+
+    // Generic attributes of our own would collide with ones already there
+    if (geometry->getVertexAttribArray(POSITION_ATTRIBUTE) ||
+            geometry->getVertexAttribArray(NORMAL_ATTRIBUTE))
+        return;
+
+    const unsigned count = vertices->size();
+
+    osg::Vec3Array *normals = dynamic_cast<osg::Vec3Array *>(geometry->getNormalArray());
+    if (normals && (normals->getBinding() != osg::Array::BIND_PER_VERTEX || normals->size() != count))
+        normals = 0;
+
+    osg::Vec4Array *colors = dynamic_cast<osg::Vec4Array *>(geometry->getColorArray());
+    if (colors && (colors->getBinding() != osg::Array::BIND_PER_VERTEX || colors->size() != count))
+        colors = 0;
+
+    result.bytesBefore = arrayBytes(vertices) + arrayBytes(normals) + arrayBytes(colors);
+
+    // Positions relative to the box, 0..65535 on each axis
+    osg::BoundingBox bb;
+    for (unsigned i=0 ; i < count ; i++)
+        bb.expandBy((*vertices)[i]);
+
+    osg::Vec3 extent = bb._max - bb._min;
+    osg::ref_ptr<osg::Vec3usArray> quantizedVertices = new osg::Vec3usArray(count);
+    for (unsigned i=0 ; i < count ; i++) {
+        osg::Vec3 decoded;
+        for (int axis=0 ; axis < 3 ; axis++) {
+            double t = extent[axis] > 0.0f ? ((*vertices)[i][axis] - bb._min[axis]) / extent[axis] : 0.0;
+            unsigned short q = (unsigned short)floor(osg::clampBetween(t, 0.0, 1.0) * 65535.0 + 0.5);
+            (*quantizedVertices)[i][axis] = q;
+            decoded[axis] = bb._min[axis] + (q / 65535.0f) * extent[axis];
+        }
+        result.positionError = std::max(result.positionError,
+                                        (double)(decoded - (*vertices)[i]).length());
+    }
+    quantizedVertices->setNormalize(true);
+    quantizedVertices->setBinding(osg::Array::BIND_PER_VERTEX);
+
+    osg::ref_ptr<osg::Vec2sArray> octNormals;
+    if (normals) {
+        octNormals = new osg::Vec2sArray(count);
+        for (unsigned i=0 ; i < count ; i++) {
+            osg::Vec3 n = (*normals)[i];
+            if (n.normalize() == 0.0f)
+                n.set(0.0f, 0.0f, 1.0f);
+
+            (*octNormals)[i] = octEncode(n);
+
+            double cosine = osg::clampBetween((double)(octDecode((*octNormals)[i]) * n), -1.0, 1.0);
+            result.normalError = std::max(result.normalError,
+                                          osg::RadiansToDegrees(acos(cosine)));
+        }
+        octNormals->setNormalize(true);
+        octNormals->setBinding(osg::Array::BIND_PER_VERTEX);
+    }
+
+    // glColorPointer takes normalized bytes as is, no shader needed
+    osg::ref_ptr<osg::Vec4ubArray> byteColors;
+    if (colors) {
+        byteColors = new osg::Vec4ubArray(count);
+        for (unsigned i=0 ; i < count ; i++) {
+            for (int c=0 ; c < 4 ; c++) {
+                float v = osg::clampBetween((*colors)[i][c], 0.0f, 1.0f);
+                unsigned char b = (unsigned char)floor(v * 255.0f + 0.5f);
+                (*byteColors)[i][c] = b;
+                result.colorError = std::max(result.colorError, (double)fabs(b / 255.0f - v));
+            }
+        }
+        byteColors->setNormalize(true);
+        byteColors->setBinding(osg::Array::BIND_PER_VERTEX);
+    }
+
+    // The bound can no longer be computed from a vertex array
+    geometry->setInitialBound(bb);
+
+    geometry->setVertexArray(0);
+    geometry->setVertexAttribArray(POSITION_ATTRIBUTE, quantizedVertices.get(), osg::Array::BIND_PER_VERTEX);
+    if (octNormals.valid()) {
+        geometry->setNormalArray(0);
+        geometry->setVertexAttribArray(NORMAL_ATTRIBUTE, octNormals.get(), osg::Array::BIND_PER_VERTEX);
+    }
+    if (byteColors.valid())
+        geometry->setColorArray(byteColors.get(), osg::Array::BIND_PER_VERTEX);
+
+    // The StateSet may be shared with uncompressed drawables (or ones with
+    // a different box) so the uniforms go on a copy of it.
+    osg::ref_ptr<osg::StateSet> stateSet = geometry->getStateSet() ?
+                new osg::StateSet(*geometry->getStateSet(), osg::CopyOp::SHALLOW_COPY) :
+                new osg::StateSet;
+    unsigned features = 0;
+    if (octNormals.valid())
+        features |= WITH_NORMALS;
+    if (geometry->getColorArray())
+        features |= WITH_COLORS;
+    if (result.textured && geometry->getTexCoordArray(0))
+        features |= WITH_TEXTURE;
+    stateSet->setAttributeAndModes(m_programs[features].get());
+    stateSet->addUniform(new osg::Uniform("quantizedOffset", bb._min));
+    stateSet->addUniform(new osg::Uniform("quantizedExtent", extent));
+    if (features & WITH_TEXTURE)
+        stateSet->addUniform(new osg::Uniform("texture0", 0));
+    geometry->setStateSet(stateSet.get());
+
+    geometry->dirtyDisplayList();
+    geometry->dirtyBound();
+
+    result.bytesAfter = arrayBytes(quantizedVertices.get()) +
+            arrayBytes(octNormals.get()) +
+            arrayBytes(byteColors.get());
+    result.compressed = true;
+}
+
+std::vector<VertexCompressor::Result> VertexCompressor::compress(osg::Node *node) const
+{
+    GeometryCollector collector;
+    if (node) {
+        if (osg::Drawable *drawable = dynamic_cast<osg::Drawable *>(node))
+            collector.add(drawable->asGeometry());
+        else
+            node->accept(collector);
+    }
+
+    std::vector<Result> results(collector.geometries.size());
+    for (unsigned i=0 ; i < results.size() ; i++) {
+        results[i].geometry = collector.geometries[i];
+        results[i].textured = collector.texturedGeometries.count(collector.geometries[i].get()) > 0;
+        results[i].bytesBefore = 0;
+        results[i].bytesAfter = 0;
+    }
+
+    QtConcurrent::blockingMap(results, [this](Result &result) {
+        compressGeometry(result);
+    });
+
+    for (unsigned i=0 ; i < results.size() ; i++)
+        compressDebug("%s position %g normal %g color %g  %u -> %u bytes",
+                      results[i].geometry->getName().c_str(),
+                      results[i].positionError, results[i].normalError,
+                      results[i].colorError,
+                      results[i].bytesBefore, results[i].bytesAfter);
+
+    return results;
+}
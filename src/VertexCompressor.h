@@ -0,0 +1,74 @@
+#ifndef VERTEXCOMPRESSOR_H
+#define VERTEXCOMPRESSOR_H
+
+#include <vector>
+
+#include <osg/ref_ptr>
+#include <osg/Node>
+#include <osg/Geometry>
+#include <osg/Program>
+
+/// Quantizes vertex attributes of Geometry to cut GPU and file memory.
+///
+/// Positions become 16 bit unsigned values relative to the drawable's
+/// bounding box, normals become 16 bit octahedral encodings and colors
+/// become 8 bit.  Positions and normals are passed as generic vertex
+/// attributes and decoded by a shared shader program, which also passes
+/// on texture coordinates and lights with the material; the per drawable
+/// box goes in uniforms on a copy of the drawable's StateSet.  A vec4
+/// uniform "highlightColor" with an alpha other than 0 replaces material,
+/// colors and texture, for highlights a Material cannot make.
+///
+/// The fixed vertex array is gone, so a TriangleFunctor or an intersection
+/// visitor no longer sees a compressed drawable; go through accept()
+/// instead, as TriangleTree (and so OsgItemModel::pickPart()) does.  No
+/// float copy of the positions is kept.
+class VertexCompressor
+{
+public:
+    VertexCompressor();
+
+    /// Generic attribute locations used by the decoding shader
+    enum AttributeLocation {
+        POSITION_ATTRIBUTE = 0,
+        NORMAL_ATTRIBUTE = 6
+    };
+
+    /// What a decoding program is built to decode and pass on, or'ed
+    /// together; each combination is a program of its own
+    enum ProgramFeature {
+        WITH_NORMALS = 1,
+        WITH_COLORS = 2,
+        WITH_TEXTURE = 4,
+        PROGRAM_VARIANTS = 8
+    };
+
+    struct Result {
+        osg::ref_ptr<osg::Geometry> geometry;
+        bool compressed;
+        bool textured;          ///< shows beneath a texture on unit 0
+        double positionError;   ///< largest position error, model units
+        double normalError;     ///< largest normal error, degrees
+        double colorError;      ///< largest color component error, 0..1
+        unsigned bytesBefore;
+        unsigned bytesAfter;
+    };
+
+    /// Compress every suitable Geometry at or beneath node
+    std::vector<Result> compress(osg::Node *node) const;
+
+    /// Positions of a compressed geometry decoded as the shader does, or
+    /// null if geometry is not compressed
+    static osg::ref_ptr<osg::Vec3Array> decodePositions(const osg::Geometry *geometry);
+
+    /// drawable->accept(functor), decoding the positions of a compressed
+    /// geometry for it
+    static void accept(const osg::Drawable *drawable, osg::PrimitiveFunctor &functor);
+
+private:
+    void compressGeometry(Result &result) const;
+
+    osg::ref_ptr<osg::Program> m_programs[PROGRAM_VARIANTS]; ///< by the features each decodes
+};
+
+#endif // VERTEXCOMPRESSOR_H
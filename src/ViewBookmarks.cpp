@@ -0,0 +1,191 @@
+#include "ViewBookmarks.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+#include <cmath>
+
+static bool debugBookmarks = false;
+#define bmDebug if (debugBookmarks) qDebug
+
+namespace {
+
+const quint32 magic = 0x4F54424B; // "OTBK"
+const quint16 version = 2;
+
+/// Version 1 had no keys, the first nine bookmarks were on 1-9
+const quint16 positionalKeysVersion = 1;
+
+const int maxKey = 9;
+
+/// More than anyone keeps by hand; a larger count means a damaged file
+const quint32 maxBookmarks = 10000;
+
+bool isFinite(double v) { return std::isfinite(v); }
+
+}
+
+QDataStream &operator<<(QDataStream &stream, const ViewingCore::ViewState &state)
+{
+    const osg::Vec4d q = state.orientation.asVec4();
+    stream << state.center.x() << state.center.y() << state.center.z()
+           << q.x() << q.y() << q.z() << q.w()
+           << state.distance << state.fovy << state.orthoBottom << state.orthoTop;
+    return stream;
+}
+
+QDataStream &operator>>(QDataStream &stream, ViewingCore::ViewState &state)
+{
+    double x, y, z, w;
+    stream >> state.center.x() >> state.center.y() >> state.center.z();
+    stream >> x >> y >> z >> w;
+    stream >> state.distance >> state.fovy >> state.orthoBottom >> state.orthoTop;
+    state.orientation.set(x, y, z, w);
+    return stream;
+}
+
+bool ViewBookmarks::isValid(const ViewingCore::ViewState &state)
+{
+    const osg::Vec4d q = state.orientation.asVec4();
+    return isFinite(state.center.x()) && isFinite(state.center.y()) && isFinite(state.center.z()) &&
+            isFinite(q.x()) && isFinite(q.y()) && isFinite(q.z()) && isFinite(q.w()) &&
+            std::fabs(q.length() - 1.0) < 1e-3 &&
+            isFinite(state.distance) && state.distance > 0.0 &&
+            isFinite(state.fovy) && state.fovy > 0.0 && state.fovy < 180.0 &&
+            isFinite(state.orthoBottom) && isFinite(state.orthoTop) &&
+            state.orthoTop >= state.orthoBottom;
+}
+
+QString ViewBookmarks::sidecarFor(const QString &modelFile)
+{
+    return modelFile + ".views";
+}
+
+bool ViewBookmarks::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.exists()) {
+        m_bookmarks.clear();
+        return true;
+    }
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("could not read bookmarks from %s", qPrintable(fileName));
+        return false;
+    }
+
+    if (!fromByteArray(file.readAll())) {
+        qWarning("%s does not hold bookmarks this version can read", qPrintable(fileName));
+        return false;
+    }
+
+    bmDebug("%d bookmarks from %s", count(), qPrintable(fileName));
+    return true;
+}
+
+bool ViewBookmarks::save(const QString &fileName) const
+{
+    // written aside and renamed, so a failed save leaves the old file
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning("could not write bookmarks to %s", qPrintable(fileName));
+        return false;
+    }
+
+    file.write(toByteArray());
+    return file.commit();
+}
+
+QByteArray ViewBookmarks::toByteArray() const
+{
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    stream << magic << version << quint32(m_bookmarks.size());
+    foreach (const Bookmark &bookmark, m_bookmarks)
+        stream << bookmark.name << quint8(bookmark.ortho ? 1 : 0) << bookmark.state
+               << quint8(bookmark.key);
+
+    return bytes;
+}
+
+bool ViewBookmarks::fromByteArray(const QByteArray &bytes)
+{
+    QDataStream stream(bytes);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 fileMagic = 0, size = 0;
+    quint16 fileVersion = 0;
+    stream >> fileMagic >> fileVersion >> size;
+    if (stream.status() != QDataStream::Ok || fileMagic != magic ||
+            (fileVersion != version && fileVersion != positionalKeysVersion) ||
+            size > maxBookmarks)
+        return false;
+
+    QList<Bookmark> bookmarks;
+    quint16 keysTaken = 0;
+    for (quint32 i=0 ; i < size ; i++) {
+        Bookmark bookmark;
+        quint8 ortho = 0, key = 0;
+        stream >> bookmark.name >> ortho >> bookmark.state;
+        if (fileVersion == positionalKeysVersion)
+            key = i < quint32(maxKey) ? i + 1 : 0;
+        else
+            stream >> key;
+        bookmark.ortho = ortho != 0;
+        bookmark.key = key;
+
+        // a key is on one bookmark at most
+        if (stream.status() != QDataStream::Ok || ortho > 1 || !isValid(bookmark.state) ||
+                key > maxKey || (key && (keysTaken & (1 << key))))
+            return false;
+        if (key)
+            keysTaken |= 1 << key;
+        bookmarks.append(bookmark);
+    }
+
+    if (!stream.atEnd())
+        return false;
+
+    m_bookmarks = bookmarks;
+    return true;
+}
+
+int ViewBookmarks::find(int key) const
+{
+    if (key <= 0)
+        return -1;
+
+    for (int i=0 ; i < m_bookmarks.size() ; i++)
+        if (m_bookmarks[i].key == key)
+            return i;
+    return -1;
+}
+
+int ViewBookmarks::freeKey() const
+{
+    for (int key=1 ; key <= maxKey ; key++)
+        if (find(key) < 0)
+            return key;
+    return 0;
+}
+
+void ViewBookmarks::set(int i, const Bookmark &bookmark)
+{
+    const int other = find(bookmark.key);
+    if (other >= 0 && other != i)
+        m_bookmarks[other].key = 0;
+
+    if (i == m_bookmarks.size())
+        m_bookmarks.append(bookmark);
+    else if (i >= 0 && i < m_bookmarks.size())
+        m_bookmarks[i] = bookmark;
+}
+
+void ViewBookmarks::remove(int i)
+{
+    if (i >= 0 && i < m_bookmarks.size())
+        m_bookmarks.removeAt(i);
+}
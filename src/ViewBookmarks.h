@@ -0,0 +1,63 @@
+#ifndef VIEWBOOKMARKS_H
+#define VIEWBOOKMARKS_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QList>
+#include <QString>
+
+#include "ViewingCore.h"
+
+/// View states as written to bookmark and camera path files
+QDataStream &operator<<(QDataStream &stream, const ViewingCore::ViewState &state);
+QDataStream &operator>>(QDataStream &stream, ViewingCore::ViewState &state);
+
+/// Named views of a model.  They are kept in a small binary file next to
+/// the model (see sidecarFor()), so every model has its own set.
+///
+/// The file starts with a magic number and a format version, and every
+/// value read back is checked before it is used, so a truncated, foreign
+/// or newer file is refused as a whole rather than half loaded.
+class ViewBookmarks
+{
+public:
+    struct Bookmark {
+        QString name;
+        ViewingCore::ViewState state;
+        bool ortho;
+        int key;        ///< number key 1-9 it is on, 0 for none
+    };
+
+    /// Where the bookmarks of the model in modelFile are kept
+    static QString sidecarFor(const QString &modelFile);
+
+    /// Whether a view state read from a file can be used
+    static bool isValid(const ViewingCore::ViewState &state);
+
+    /// Replace the bookmarks with those in fileName.  A file that does not
+    /// exist leaves no bookmarks and is not an error.
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    QByteArray toByteArray() const;
+    bool fromByteArray(const QByteArray &bytes);
+
+    int count() const { return m_bookmarks.size(); }
+    const Bookmark &at(int i) const { return m_bookmarks.at(i); }
+
+    /// The bookmark on number key, or -1 when there is none
+    int find(int key) const;
+    /// The lowest number key no bookmark is on, 0 when all are taken
+    int freeKey() const;
+
+    /// Replace bookmark i, or add one at the end when i is count().  The
+    /// number key moves to it from any other bookmark.
+    void set(int i, const Bookmark &bookmark);
+    void remove(int i);
+    void clear() { m_bookmarks.clear(); }
+
+private:
+    QList<Bookmark> m_bookmarks;
+};
+
+#endif // VIEWBOOKMARKS_H
@@ -34,7 +34,20 @@ ViewingCore::ViewingCore()
       _clampFovyScale( true ),
       _clampFovyRange( osg::Vec2d( 5.0, 160.0 ) ),
       _orthoBottom( 0.0 ),
-      _orthoTop( 0.0 )
+      _orthoTop( 0.0 ),
+      _tightNearFar( false ),
+      _visibleNear( 0.0 ),
+      _visibleFar( -1.0 ),
+      _transitionDuration( 0.5 ),
+      _animating( false ),
+      _animStart( -1.0 ),
+      _animDuration( 0.0 ),
+      _recording( false ),
+      _recordStart( 0.0 ),
+      _playing( false ),
+      _playStep( 0.0 ),
+      _playTime( 0.0 ),
+      _playKey( 0 )
 {
 }
 
@@ -58,7 +71,24 @@ ViewingCore::ViewingCore( const ViewingCore& rhs, const osg::CopyOp& copyop )
       _clampFovyScale( rhs._clampFovyScale ),
       _clampFovyRange( rhs._clampFovyRange ),
       _orthoBottom( rhs._orthoBottom ),
-      _orthoTop( rhs._orthoTop )
+      _orthoTop( rhs._orthoTop ),
+      _tightNearFar( rhs._tightNearFar ),
+      _visibleNear( rhs._visibleNear ),
+      _visibleFar( rhs._visibleFar ),
+      _transitionDuration( rhs._transitionDuration ),
+      _animating( rhs._animating ),
+      _animFrom( rhs._animFrom ),
+      _animTo( rhs._animTo ),
+      _animStart( rhs._animStart ),
+      _animDuration( rhs._animDuration ),
+      _recording( rhs._recording ),
+      _recordStart( rhs._recordStart ),
+      _recordedPath( rhs._recordedPath ),
+      _playing( rhs._playing ),
+      _playPath( rhs._playPath ),
+      _playStep( rhs._playStep ),
+      _playTime( rhs._playTime ),
+      _playKey( rhs._playKey )
 {
 }
 
@@ -96,6 +126,8 @@ void ViewingCore::computeInitialView()
 
 void ViewingCore::fitToScreen()
 {
+    const ViewState from = beginViewChange();
+
     _viewCenter = _scene->getBound().center();
 
     // tan( fovy/2. ) = bs.radius / distance
@@ -109,6 +141,33 @@ void ViewingCore::fitToScreen()
 
     _orthoTop = tan( getFovyRadians() * 0.5 ) * _viewDistance;
     _orthoBottom = -_orthoTop;
+
+    endViewChange( from );
+}
+
+void ViewingCore::fitToBound( const osg::BoundingBox& box )
+{
+    if( !box.valid() )
+        return;
+
+    const ViewState from = beginViewChange();
+
+    _viewCenter = box.center();
+
+    // The sphere around the box fits when it fits the narrower of the two
+    // view angles: sin( halfAngle ) = radius / distance
+    const double radius = osg::maximum< double >( box.radius(), 1e-6 );
+    double halfAngle = getFovyRadians() * 0.5;
+    if( _aspect < 1. )
+        halfAngle = atan( tan( halfAngle ) * _aspect );
+    _viewDistance = radius / sin( halfAngle );
+
+    _orthoTop = radius;
+    if( _aspect < 1. )
+        _orthoTop /= _aspect;
+    _orthoBottom = -_orthoTop;
+
+    endViewChange( from );
 }
 
 
@@ -415,6 +474,13 @@ void ViewingCore::pickCenter( const double ndcX, const double ndcY )
     _viewDistance = ( lastPosition - _viewCenter ).length();
 }
 
+void ViewingCore::pickCenter( const osg::Vec3d& center )
+{
+    const osg::Vec3d lastPosition = getEyePosition();
+    _viewCenter = center;
+    _viewDistance = ( lastPosition - _viewCenter ).length();
+}
+
 
 void ViewingCore::setTrackballRollSensitivity( double sollSensitivity )
 {
@@ -552,6 +618,18 @@ osg::Matrixd ViewingCore::computeProjection() const
     // to the *bound* center, or to the *view* center?
     const osg::BoundingSphere& bs = _scene->getBound();
     const osg::Vec3d eyeToCenter( bs._center - getEyePosition() );
+
+    if( _tightNearFar && _visibleFar > 0. ) {
+        double zFar = _visibleFar;
+        double zNear = osg::maximum< double >( _visibleNear, zFar / 2000. );
+        if( _ortho ) {
+            const double xRange = _aspect * ( _orthoTop - _orthoBottom );
+            const double right = xRange * .5;
+            return( osg::Matrixd::ortho( -right, right, _orthoBottom, _orthoTop, _visibleNear, zFar ) );
+        }
+        return( osg::Matrixd::perspective( _fovy, _aspect, zNear, zFar ) );
+    }
+
     if( _ortho ) {
         double zNear = eyeToCenter.length() - bs._radius;
         double zFar = eyeToCenter.length() + bs._radius;
@@ -659,44 +737,247 @@ bool ViewingCore::intersectPlaneRay( osg::Vec3d& result, const osg::Vec4d& plane
 
 void ViewingCore::viewTop()
 {
+    const ViewState from = beginViewChange();
     computeInitialView();
     _viewUp = osg::Vec3d(0., 1., 0.);
     _viewDir = osg::Vec3d(0., 0., -1.);
+    endViewChange( from );
 }
 
 void ViewingCore::viewBottom()
 {
+    const ViewState from = beginViewChange();
     computeInitialView();
     _viewUp = osg::Vec3d(0., -1., 0.);
     _viewDir = osg::Vec3d(0., 0., 1.);
+    endViewChange( from );
 }
 
 void ViewingCore::viewRight()
 {
+    const ViewState from = beginViewChange();
     computeInitialView();
     _viewUp = osg::Vec3d(0., 0., 1.);
     _viewDir = osg::Vec3d(0., 1., 0.);
+    endViewChange( from );
 }
 
 void ViewingCore::viewLeft()
 {
+    const ViewState from = beginViewChange();
     computeInitialView();
     _viewUp = osg::Vec3d(0., 0., 1.);
     _viewDir = osg::Vec3d(0., -1., 0.);
+    endViewChange( from );
 }
 
 void ViewingCore::viewFront()
 {
+    const ViewState from = beginViewChange();
     computeInitialView();
     _viewUp = osg::Vec3d(0., 0., 1.);
     _viewDir = osg::Vec3d(-1., 0., 0.);
+    endViewChange( from );
 }
 
 void ViewingCore::viewBack()
 {
+    const ViewState from = beginViewChange();
     computeInitialView();
     _viewUp = osg::Vec3d(0., 0., 1.);
     _viewDir = osg::Vec3d(1., 0., 0.);
+    endViewChange( from );
+}
+
+
+//
+// Transition support
+//
+
+ViewingCore::ViewState ViewingCore::getViewState() const
+{
+    ViewState state;
+    state.center = _viewCenter;
+    state.orientation = getOrientationMatrix().getRotate();
+    state.distance = _viewDistance;
+    state.fovy = _fovy;
+    state.orthoBottom = _orthoBottom;
+    state.orthoTop = _orthoTop;
+    return( state );
+}
+
+void ViewingCore::setViewState( const ViewState& state )
+{
+    // Rows of the orientation matrix are right, up and back
+    osg::Matrixd m;
+    m.makeRotate( state.orientation );
+    _viewUp = osg::Vec3d( m( 1, 0 ), m( 1, 1 ), m( 1, 2 ) );
+    _viewDir = -osg::Vec3d( m( 2, 0 ), m( 2, 1 ), m( 2, 2 ) );
+    _viewUp.normalize();
+    _viewDir.normalize();
+
+    _viewCenter = state.center;
+    _viewDistance = state.distance;
+    _fovy = state.fovy;
+    _orthoBottom = state.orthoBottom;
+    _orthoTop = state.orthoTop;
+}
+
+void ViewingCore::startTransition( const ViewState& target, double duration )
+{
+    if( duration <= 0. ) {
+        _animating = false;
+        setViewState( target );
+        return;
+    }
+
+    _animFrom = getViewState();
+    _animTo = target;
+    _animDuration = duration;
+    _animStart = -1.;
+    _animating = true;
+}
+
+bool ViewingCore::updateAnimation( double time )
+{
+    if( !_animating )
+        return( false );
+
+    if( _animStart < 0. )
+        _animStart = time;
+
+    double t = ( time - _animStart ) / _animDuration;
+    if( t >= 1. ) {
+        setViewState( _animTo );
+        _animating = false;
+        return( false );
+    }
+
+    // Ease in and out (smoothstep)
+    t = osg::clampBetween< double >( t, 0., 1. );
+    const double s = t * t * ( 3. - 2. * t );
+
+    setViewState( blendViewStates( _animFrom, _animTo, s ) );
+
+    return( true );
+}
+
+ViewingCore::ViewState ViewingCore::blendViewStates( const ViewState& a, const ViewState& b, double s )
+{
+    ViewState state;
+    state.orientation.slerp( s, a.orientation, b.orientation );
+    state.center = a.center + ( b.center - a.center ) * s;
+
+    // Distance changes by orders of magnitude when zooming to a small part,
+    // so interpolate it geometrically for an even apparent speed
+    if( a.distance > 0. && b.distance > 0. )
+        state.distance = a.distance * pow( b.distance / a.distance, s );
+    else
+        state.distance = a.distance + ( b.distance - a.distance ) * s;
+
+    state.fovy = a.fovy + ( b.fovy - a.fovy ) * s;
+    state.orthoBottom = a.orthoBottom + ( b.orthoBottom - a.orthoBottom ) * s;
+    state.orthoTop = a.orthoTop + ( b.orthoTop - a.orthoTop ) * s;
+    return( state );
+}
+
+void ViewingCore::startRecording( double time )
+{
+    _recordedPath.clear();
+    _recordStart = time;
+    _recording = true;
+    recordPathKey( time );
+}
+
+void ViewingCore::recordPathKey( double time )
+{
+    if( !_recording )
+        return;
+
+    PathKey key;
+    key.time = time - _recordStart;
+    key.state = getViewState();
+
+    if( !_recordedPath.empty() ) {
+        const ViewState& last = _recordedPath.back().state;
+        if( last.center == key.state.center &&
+                last.orientation == key.state.orientation &&
+                last.distance == key.state.distance &&
+                last.fovy == key.state.fovy &&
+                last.orthoBottom == key.state.orthoBottom &&
+                last.orthoTop == key.state.orthoTop )
+            return;
+
+        // A pause: hold the last view until now, rather than drifting
+        // from it all through the pause
+        if( key.time - _recordedPath.back().time > .1 ) {
+            PathKey hold = _recordedPath.back();
+            hold.time = key.time;
+            _recordedPath.push_back( hold );
+        }
+    }
+    _recordedPath.push_back( key );
+}
+
+ViewingCore::CameraPath ViewingCore::stopRecording()
+{
+    _recording = false;
+    CameraPath path;
+    path.swap( _recordedPath );
+    return( path );
+}
+
+void ViewingCore::startPlayback( const CameraPath& path, double step )
+{
+    _animating = false;
+    _playPath = path;
+    _playStep = step;
+    _playTime = path.empty() ? 0. : path.front().time;
+    _playKey = 0;
+    _playing = !path.empty() && step > 0.;
+}
+
+bool ViewingCore::updatePlayback()
+{
+    if( !_playing )
+        return( false );
+
+    if( _playTime > _playPath.back().time ) {
+        setViewState( _playPath.back().state );
+        _playing = false;
+        return( false );
+    }
+
+    while( _playKey + 1 < _playPath.size() && _playPath[ _playKey + 1 ].time <= _playTime )
+        _playKey++;
+
+    const PathKey& a = _playPath[ _playKey ];
+    if( _playKey + 1 < _playPath.size() ) {
+        const PathKey& b = _playPath[ _playKey + 1 ];
+        const double span = b.time - a.time;
+        const double s = span > 0. ? ( _playTime - a.time ) / span : 1.;
+        setViewState( blendViewStates( a.state, b.state, s ) );
+    } else {
+        setViewState( a.state );
+    }
+
+    _playTime += _playStep;
+    return( true );
+}
+
+ViewingCore::ViewState ViewingCore::beginViewChange()
+{
+    const ViewState from = getViewState();
+    if( _animating )
+        setViewState( _animTo );
+    return( from );
+}
+
+void ViewingCore::endViewChange( const ViewState& from )
+{
+    const ViewState target = getViewState();
+    setViewState( from );
+    startTransition( target, _transitionDuration );
 }
 
 void ViewingCore::saveView(std::stringstream &stream)
@@ -755,3 +1036,27 @@ void ViewingCore::loadView(std::stringstream &stream)
 
     stream >> _clampFovyRange.x() >> _clampFovyRange.y();
 }
+
+
+bool ViewingCore::setVisibleDepthRange( double zNear, double zFar )
+{
+    if( zFar <= zNear ) {
+        clearVisibleDepthRange();
+        return( false );
+    }
+
+    // Outside what the last frame was drawn with, or that frame was drawn
+    // with the whole scene's bound.
+    const bool wider = ( _visibleFar <= 0. ) || ( zNear < _visibleNear ) || ( zFar > _visibleFar );
+
+    // a little slack so nothing at the very ends gets clipped
+    const double slack = ( zFar - zNear ) * .01;
+    _visibleNear = zNear - slack;
+    _visibleFar = zFar + slack;
+    return( wider );
+}
+
+void ViewingCore::clearVisibleDepthRange()
+{
+    _visibleFar = -1.;
+}
@@ -6,12 +6,15 @@
 
 #include <osg/Object>
 #include <osg/Node>
+#include <osg/BoundingBox>
 #include <osg/Matrixd>
+#include <osg/Quat>
 #include <cmath>
 
 //#include <QTextStream> // this should get replaced by a C++11
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 /** \brief A GUI-independent class for maintaining view and projection matrix parameters.
  *
@@ -99,6 +102,9 @@ public:
     into world space and uses them to create a LineSegmentIntersector to pick a new
     \c _center for the view matrix. */
     void pickCenter( const double ndcX, const double ndcY );
+    /** Make \c center, found by a pick of the caller's own, the new view
+    center. As with the pick above, the eye stays where it is. */
+    void pickCenter( const osg::Vec3d& center );
 
     /** Get the current eye position. */
     inline osg::Vec3d getEyePosition() const {
@@ -161,6 +167,26 @@ public:
     the proximity of view position to scene data. */
     osg::Matrixd computeProjection() const;
 
+    /** By default zNear and zFar enclose the bound of the whole scene.
+    With tight near/far they only enclose what the cull found inside the
+    view's side planes, as passed to the last setVisibleDepthRange().
+    That gives far better depth precision when looking at a small part of
+    a large model. */
+    void setTightNearFar( bool tight ) {
+        _tightNearFar = tight;
+    }
+    bool getTightNearFar() const {
+        return( _tightNearFar );
+    }
+
+    /** Set the eye distances of the nearest and farthest things the last
+    cull kept, for computeProjection() to use with tight near/far. Returns
+    true when the range reaches outside the one set before, so a frame drawn
+    with that one may have clipped something away. clearVisibleDepthRange()
+    (or zFar <= zNear) goes back to the scene's bound. */
+    bool setVisibleDepthRange( double zNear, double zFar );
+    void clearVisibleDepthRange();
+
     /** Set the field of view in y (fovy) in degrees. Default is 30 degrees. */
     void setFovy( double fovy );
     double getFovy() const {
@@ -209,18 +235,106 @@ public:
 
     void fitToScreen();
 
+    /** Move the view center to the center of \c box and back off until it
+    fits in the window whatever the view direction, keeping the view
+    direction and field of view. Animated like fitToScreen(). */
+    void fitToBound( const osg::BoundingBox& box );
+
     void saveView(std::stringstream &stream);
     void loadView(std::stringstream &stream);
 
     osg::Vec3d getViewCenter() const {
         return _viewCenter;
     }
+
+    /** Everything a camera transition interpolates. \c orientation takes
+    the view's right/up/back axes to world space, as getOrientationMatrix()
+    does. */
+    struct ViewState {
+        osg::Vec3d center;
+        osg::Quat orientation;
+        double distance;
+        double fovy;
+        double orthoBottom, orthoTop;
+    };
+    ViewState getViewState() const;
+    void setViewState( const ViewState& state );
+
+    /** Move from the current view to \c target over \c duration seconds.
+    Nothing moves until updateAnimation() is called, once per frame. The
+    orientation is slerped; center, distance and field of view are eased
+    in and out. */
+    void startTransition( const ViewState& target, double duration );
+
+    /** Set the view for the frame at \c time (seconds, from any clock that
+    does not go backwards). The first call after startTransition() starts
+    the clock. Returns true while the transition is still going, in which
+    case another frame should be drawn. */
+    bool updateAnimation( double time );
+    bool isAnimating() const {
+        return( _animating );
+    }
+    /** Leave the view where the transition has got to. */
+    void stopAnimation() {
+        _animating = false;
+    }
+
+    /** Duration of the transitions made by viewTop() and the like, and by
+    fitToScreen(). 0 makes them snap. Default is 0.5 seconds. */
+    void setTransitionDuration( double seconds ) {
+        _transitionDuration = seconds;
+    }
+    double getTransitionDuration() const {
+        return( _transitionDuration );
+    }
+
+    /** \c a blended into \c b by \c s, from 0 (all \c a) to 1 (all \c b). */
+    static ViewState blendViewStates( const ViewState& a, const ViewState& b, double s );
+
+    /** The view at \c time seconds into a recorded camera path. */
+    struct PathKey {
+        double time;
+        ViewState state;
+    };
+    typedef std::vector< PathKey > CameraPath;
+
+    /** Start recording a camera path at \c time (seconds). Each
+    recordPathKey() after that adds the current view, unless it has not
+    changed since the last key. */
+    void startRecording( double time );
+    void recordPathKey( double time );
+    /** Returns what has been recorded. */
+    CameraPath stopRecording();
+    bool isRecording() const {
+        return( _recording );
+    }
+
+    /** Play \c path back, \c step seconds of path time for every call to
+    updatePlayback(). Steps do not depend on how long frames take, so every
+    playback of a path draws exactly the same views. */
+    void startPlayback( const CameraPath& path, double step );
+    /** Set the view for the next step. Returns false, leaving the view at
+    the end of the path, once every step has been taken. */
+    bool updatePlayback();
+    bool isPlaying() const {
+        return( _playing );
+    }
+    void stopPlayback() {
+        _playing = false;
+    }
 protected:
     ~ViewingCore();
 
 
     bool intersect( osg::Vec3d& result, const osg::Vec3d& farPoint );
 
+    /** Called by the functions that set a whole new view. Returns the view
+    to start from; the view is left at where the new view should start from
+    (the end of a transition already going, so they chain). */
+    ViewState beginViewChange();
+    /** Animate from \c from to the view the caller has just set up. */
+    void endViewChange( const ViewState& from );
+
     /** OSG doesn't appear to have a utility function to intersect a plane and a ray.
     TBD This should probably go in osgWorks. */
     bool intersectPlaneRay( osg::Vec3d& result, const osg::Vec4d& plane, const osg::Vec3d& p0, const osg::Vec3d& p1 );
@@ -246,6 +360,24 @@ protected:
     bool _clampFovyScale;
     osg::Vec2d _clampFovyRange;
     double _orthoBottom, _orthoTop;
+
+    bool _tightNearFar;
+    double _visibleNear, _visibleFar; ///< _visibleFar < 0 when nothing is visible
+
+    // Transition support.
+    double _transitionDuration;
+    bool _animating;
+    ViewState _animFrom, _animTo;
+    double _animStart, _animDuration;
+
+    // Camera path support.
+    bool _recording;
+    double _recordStart;
+    CameraPath _recordedPath;
+    bool _playing;
+    CameraPath _playPath;
+    double _playStep, _playTime;
+    unsigned _playKey; ///< key at or before _playTime
 };
 
 
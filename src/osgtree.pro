@@ -4,12 +4,13 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = osgtree
 TEMPLATE = app
+CONFIG += c++11
 LIBS += -losg -losgDB -losgUtil -losgViewer -losgGA
 
 SOURCES += main.cpp\
@@ -19,7 +20,21 @@ SOURCES += main.cpp\
     OsgTreeForm.cpp \
     ViewingCore.cpp \
     Osg3dView.cpp \
-    OsgCameraForm.cpp
+    OsgCameraForm.cpp \
+    LodGenerator.cpp \
+    DuplicateFinder.cpp \
+    VertexCacheOptimizer.cpp \
+    VertexCompressor.cpp \
+    MemoryAccounting.cpp \
+    UndoStack.cpp \
+    ThreadedGraphicsWindow.cpp \
+    ProxyCullVisitor.cpp \
+    ViewBookmarks.cpp \
+    CameraPathFile.cpp \
+    SpatialIndex.cpp \
+    ClashDetector.cpp \
+    ClashForm.cpp \
+    TriangleTree.cpp
 
 HEADERS  += MainWindow.h \
     OsgItemModel.h \
@@ -28,8 +43,23 @@ HEADERS  += MainWindow.h \
     OsgTreeForm.h \
     ViewingCore.h \
     Osg3dView.h \
-    OsgCameraForm.h
+    OsgCameraForm.h \
+    LodGenerator.h \
+    DuplicateFinder.h \
+    VertexCacheOptimizer.h \
+    VertexCompressor.h \
+    MemoryAccounting.h \
+    UndoStack.h \
+    ThreadedGraphicsWindow.h \
+    ProxyCullVisitor.h \
+    ViewBookmarks.h \
+    CameraPathFile.h \
+    SpatialIndex.h \
+    ClashDetector.h \
+    ClashForm.h \
+    TriangleTree.h
 
 FORMS    += MainWindow.ui \
     OsgTreeForm.ui \
-    OsgCameraForm.ui
+    OsgCameraForm.ui \
+    ClashForm.ui
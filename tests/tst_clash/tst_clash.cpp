@@ -0,0 +1,79 @@
+#include <QtTest/QtTest>
+
+#include "ClashDetector.h"
+
+/// A triangle crossing another is a clash however small the tolerance; one
+/// resting on another, or clear of it, never is.
+class TestClash : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void crossing();
+    void touching();
+    void separated();
+    void shallowerThanTolerance();
+
+private:
+    // lies in z = 0, the others are tested against it
+    static const osg::Vec3d floor[3];
+};
+
+const osg::Vec3d TestClash::floor[3] = {
+    osg::Vec3d(0.0, 0.0, 0.0), osg::Vec3d(2.0, 0.0, 0.0), osg::Vec3d(0.0, 2.0, 0.0)
+};
+
+void TestClash::crossing()
+{
+    // stands upright through the middle of the floor, 0.5 below and above
+    const osg::Vec3d post[3] = {
+        osg::Vec3d(0.5, 0.5, -0.5), osg::Vec3d(0.5, 0.5, 0.5), osg::Vec3d(1.0, 0.2, 0.0)
+    };
+
+    QVERIFY(ClashDetector::trianglesIntersect(floor, post, 0.0));
+    QVERIFY(ClashDetector::trianglesIntersect(floor, post, 1e-4));
+    QVERIFY(ClashDetector::trianglesIntersect(post, floor, 1e-4));
+}
+
+void TestClash::touching()
+{
+    // one corner rests on the floor
+    const osg::Vec3d leaning[3] = {
+        osg::Vec3d(0.5, 0.5, 0.0), osg::Vec3d(0.5, 0.5, 1.0), osg::Vec3d(1.0, 0.2, 1.0)
+    };
+    QVERIFY(!ClashDetector::trianglesIntersect(floor, leaning, 0.0));
+    QVERIFY(!ClashDetector::trianglesIntersect(leaning, floor, 0.0));
+
+    // a face mated with the floor
+    const osg::Vec3d mated[3] = {
+        osg::Vec3d(0.5, 0.5, 0.0), osg::Vec3d(3.0, 0.5, 0.0), osg::Vec3d(0.5, 3.0, 0.0)
+    };
+    QVERIFY(!ClashDetector::trianglesIntersect(floor, mated, 0.0));
+}
+
+void TestClash::separated()
+{
+    const osg::Vec3d above[3] = {
+        osg::Vec3d(0.5, 0.5, 0.1), osg::Vec3d(0.5, 0.5, 1.0), osg::Vec3d(1.0, 0.2, 1.0)
+    };
+    QVERIFY(!ClashDetector::trianglesIntersect(floor, above, 0.0));
+
+    const osg::Vec3d beside[3] = {
+        osg::Vec3d(3.0, 3.0, -1.0), osg::Vec3d(3.0, 3.0, 1.0), osg::Vec3d(4.0, 3.0, 0.0)
+    };
+    QVERIFY(!ClashDetector::trianglesIntersect(floor, beside, 0.0));
+}
+
+void TestClash::shallowerThanTolerance()
+{
+    // pokes 0.01 through the floor
+    const osg::Vec3d tip[3] = {
+        osg::Vec3d(0.5, 0.5, -0.01), osg::Vec3d(0.5, 0.5, 1.0), osg::Vec3d(1.0, 0.2, 1.0)
+    };
+    QVERIFY(ClashDetector::trianglesIntersect(floor, tip, 0.001));
+    QVERIFY(!ClashDetector::trianglesIntersect(floor, tip, 0.1));
+}
+
+QTEST_MAIN(TestClash)
+
+#include "tst_clash.moc"
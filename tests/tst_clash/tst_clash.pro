@@ -0,0 +1,18 @@
+# Which triangle pairs ClashDetector counts as a clash (see
+# ClashDetector::trianglesIntersect()).  Build and run with qmake && make check.
+
+QT       += core concurrent testlib
+
+TARGET = tst_clash
+TEMPLATE = app
+CONFIG += c++11 testcase
+LIBS += -losg -losgUtil
+
+SRC = ../../src
+INCLUDEPATH += $$SRC
+
+SOURCES += tst_clash.cpp \
+    $$SRC/ClashDetector.cpp \
+    $$SRC/SpatialIndex.cpp \
+    $$SRC/TriangleTree.cpp \
+    $$SRC/VertexCompressor.cpp
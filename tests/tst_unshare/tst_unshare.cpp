@@ -0,0 +1,132 @@
+#include <QtTest/QtTest>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+
+#include "OsgItemModel.h"
+#include "VertexCompressor.h"
+
+/// A pasted node is the same object as the one copied until one of them is
+/// edited; every edit made through the model must change only the place
+/// it was made.
+class TestUnshare : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void renamePastedChild();
+    void maskPastedSubtree();
+    void compressPastedSubtree();
+    void cutFromPastedCopy();
+
+private:
+    osg::Object *objectAt(const QModelIndex &index) const
+    {
+        return m_model->getObjectFromModelIndex(index).get();
+    }
+    QString nameAt(const QModelIndex &index) const
+    {
+        return QString::fromStdString(objectAt(index)->getName());
+    }
+    unsigned maskAt(const QModelIndex &index) const
+    {
+        return dynamic_cast<osg::Node *>(objectAt(index))->getNodeMask();
+    }
+
+    // the same assembly, beneath "left" and pasted beneath "right"
+    QModelIndex source() const { return m_model->index(0, 0, m_model->index(0, 0)); }
+    QModelIndex pasted() const { return m_model->index(0, 0, m_model->index(1, 0)); }
+
+    OsgItemModel *m_model;
+};
+
+void TestUnshare::init()
+{
+    m_model = new OsgItemModel;
+
+    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+    vertices->push_back(osg::Vec3(0.0f, 0.0f, 0.0f));
+    vertices->push_back(osg::Vec3(1.0f, 0.0f, 0.0f));
+    vertices->push_back(osg::Vec3(0.0f, 1.0f, 0.0f));
+
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+    geometry->setName("triangle");
+    geometry->setVertexArray(vertices.get());
+    geometry->addPrimitiveSet(new osg::DrawArrays(GL_TRIANGLES, 0, 3));
+
+    osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+    geode->setName("part");
+    geode->addDrawable(geometry.get());
+
+    osg::ref_ptr<osg::Group> assembly = new osg::Group;
+    assembly->setName("assembly");
+    assembly->addChild(geode.get());
+
+    osg::ref_ptr<osg::Group> left = new osg::Group;
+    left->setName("left");
+    left->addChild(assembly.get());
+
+    osg::ref_ptr<osg::Group> right = new osg::Group;
+    right->setName("right");
+
+    osg::Group *loaded = m_model->getRoot()->getChild(0)->asGroup();
+    m_model->insertNode(loaded, left, 0);
+    m_model->insertNode(loaded, right, 1);
+
+    m_model->copy(source());
+    m_model->paste(m_model->index(1, 0));
+
+    QCOMPARE(m_model->rowCount(m_model->index(1, 0)), 1);
+    QVERIFY(objectAt(pasted()) == objectAt(source()));
+}
+
+void TestUnshare::cleanup()
+{
+    delete m_model;
+    m_model = 0;
+}
+
+void TestUnshare::renamePastedChild()
+{
+    QVERIFY(m_model->setData(m_model->index(0, 0, pasted()), "renamed"));
+
+    QCOMPARE(nameAt(m_model->index(0, 0, pasted())), QString("renamed"));
+    QCOMPARE(nameAt(m_model->index(0, 0, source())), QString("part"));
+}
+
+void TestUnshare::maskPastedSubtree()
+{
+    m_model->applyMask(QModelIndexList() << pasted(), OsgItemModel::CLEAR_BITS, 1, true);
+
+    QCOMPARE(maskAt(m_model->index(0, 0, pasted())), ~1u);
+    QCOMPARE(maskAt(m_model->index(0, 0, source())), ~0u);
+}
+
+void TestUnshare::compressPastedSubtree()
+{
+    m_model->compressVertices(pasted());
+
+    osg::Geometry *compressed = dynamic_cast<osg::Geometry *>(
+                objectAt(m_model->index(0, 0, m_model->index(0, 0, pasted()))));
+    osg::Geometry *original = dynamic_cast<osg::Geometry *>(
+                objectAt(m_model->index(0, 0, m_model->index(0, 0, source()))));
+    QVERIFY(compressed && original && compressed != original);
+    QVERIFY(compressed->getVertexAttribArray(VertexCompressor::POSITION_ATTRIBUTE));
+    QVERIFY(!original->getVertexAttribArray(VertexCompressor::POSITION_ATTRIBUTE));
+    QVERIFY(dynamic_cast<osg::Vec3Array *>(original->getVertexArray()));
+}
+
+void TestUnshare::cutFromPastedCopy()
+{
+    m_model->cut(m_model->index(0, 0, pasted()));
+
+    QCOMPARE(m_model->rowCount(pasted()), 0);
+    QCOMPARE(m_model->rowCount(source()), 1);
+}
+
+QTEST_MAIN(TestUnshare)
+
+#include "tst_unshare.moc"
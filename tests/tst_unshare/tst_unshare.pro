@@ -0,0 +1,29 @@
+# Edits of a pasted copy must leave the original alone (see
+# OsgItemModel::unshare()).  Build and run with qmake && make check.
+
+QT       += core gui concurrent testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = tst_unshare
+TEMPLATE = app
+CONFIG += c++11 testcase
+LIBS += -losg -losgDB -losgUtil -losgViewer -losgGA
+
+SRC = ../../src
+INCLUDEPATH += $$SRC
+
+SOURCES += tst_unshare.cpp \
+    $$SRC/OsgItemModel.cpp \
+    $$SRC/LodGenerator.cpp \
+    $$SRC/DuplicateFinder.cpp \
+    $$SRC/VertexCacheOptimizer.cpp \
+    $$SRC/VertexCompressor.cpp \
+    $$SRC/MemoryAccounting.cpp \
+    $$SRC/UndoStack.cpp \
+    $$SRC/SpatialIndex.cpp \
+    $$SRC/ClashDetector.cpp \
+    $$SRC/TriangleTree.cpp
+
+HEADERS += $$SRC/OsgItemModel.h \
+    $$SRC/UndoStack.h